@@ -45,15 +45,40 @@ uint8_t *x264_nal_escape_sse2( uint8_t *dst, uint8_t *src, uint8_t *end );
 uint8_t *x264_nal_escape_avx( uint8_t *dst, uint8_t *src, uint8_t *end );
 #endif
 
-/****************************************************************************
- * x264_nal_encode:
- ****************************************************************************/
-void x264_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal )
+/* Finds the next byte that needs an emulation prevention byte in front of it,
+ * starting the search at p.  Zero bytes are rare in entropy-coded data, so
+ * skipping between them with memchr is much cheaper than a bytewise scan. */
+static uint8_t *x264_nal_find_escape( uint8_t *p, uint8_t *end )
 {
-    uint8_t *src = nal->p_payload;
-    uint8_t *end = nal->p_payload + nal->i_payload;
-    uint8_t *orig_dst = dst;
+    while( end - p > 2 && (p = memchr( p, 0, end - p - 2 )) )
+    {
+        if( p[1] )
+            p += 2;
+        else if( p[2] > 0x03 )
+            p += 3;
+        else
+            return p + 2;
+    }
+    return end;
+}
+
+/* Same output as nal_escape, but safe for dst <= src as long as dst never
+ * overtakes src, i.e. the gap covers every escape byte inserted. */
+static uint8_t *x264_nal_escape_inplace( uint8_t *dst, uint8_t *src, uint8_t *end )
+{
+    for( uint8_t *p = x264_nal_find_escape( src, end ); p < end; p = x264_nal_find_escape( p, end ) )
+    {
+        memmove( dst, src, p - src );
+        dst += p - src;
+        *dst++ = 0x03;
+        src = p;
+    }
+    memmove( dst, src, end - src );
+    return dst + (end - src);
+}
 
+static uint8_t *x264_nal_write_header( x264_t *h, uint8_t *dst, x264_nal_t *nal )
+{
     if( h->param.b_annexb )
     {
         if( nal->b_long_startcode )
@@ -67,8 +92,11 @@ void x264_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal )
 
     /* nal header */
     *dst++ = ( 0x00 << 7 ) | ( nal->i_ref_idc << 5 ) | nal->i_type;
+    return dst;
+}
 
-    dst = h->bsf.nal_escape( dst, src, end );
+static void x264_nal_write_size( x264_t *h, uint8_t *orig_dst, uint8_t *dst, x264_nal_t *nal )
+{
     int size = (dst - orig_dst) - 4;
 
     /* Write the size header for mp4/etc */
@@ -83,9 +111,46 @@ void x264_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal )
 
     nal->i_payload = size+4;
     nal->p_payload = orig_dst;
+}
+
+/****************************************************************************
+ * x264_nal_encode:
+ ****************************************************************************/
+void x264_nal_encode( x264_t *h, uint8_t *dst, x264_nal_t *nal )
+{
+    uint8_t *src = nal->p_payload;
+    uint8_t *end = nal->p_payload + nal->i_payload;
+    uint8_t *orig_dst = dst;
+
+    dst = x264_nal_write_header( h, dst, nal );
+    dst = h->bsf.nal_escape( dst, src, end );
+    x264_nal_write_size( h, orig_dst, dst, nal );
     x264_emms();
 }
 
+/* Number of bytes x264_nal_encode will add to the payload of nal. */
+int x264_nal_encode_growth( x264_t *h, x264_nal_t *nal )
+{
+    uint8_t *end = nal->p_payload + nal->i_payload;
+    int growth = h->param.b_annexb ? 4 + nal->b_long_startcode : 5;
+    for( uint8_t *p = x264_nal_find_escape( nal->p_payload, end ); p < end; p = x264_nal_find_escape( p, end ) )
+        growth++;
+    return growth;
+}
+
+/* x264_nal_encode for dst <= nal->p_payload, overwriting the payload with the
+ * escaped nal.  dst must be at least x264_nal_encode_growth bytes before it. */
+void x264_nal_encode_inplace( x264_t *h, uint8_t *dst, x264_nal_t *nal )
+{
+    uint8_t *src = nal->p_payload;
+    uint8_t *end = nal->p_payload + nal->i_payload;
+    uint8_t *orig_dst = dst;
+
+    dst = x264_nal_write_header( h, dst, nal );
+    dst = x264_nal_escape_inplace( dst, src, end );
+    x264_nal_write_size( h, orig_dst, dst, nal );
+}
+
 void x264_bitstream_init( int cpu, x264_bitstream_function_t *pf )
 {
     pf->nal_escape = x264_nal_escape_c;
@@ -72,6 +72,8 @@ typedef struct
 } x264_bitstream_function_t;
 
 void x264_bitstream_init( int cpu, x264_bitstream_function_t *pf );
+int  x264_nal_encode_growth( x264_t *h, x264_nal_t *nal );
+void x264_nal_encode_inplace( x264_t *h, uint8_t *dst, x264_nal_t *nal );
 
 /* A larger level table size theoretically could help a bit at extremely
  * high bitrates, but the cost in cache is usually too high for it to be
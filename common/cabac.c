@@ -1327,20 +1327,31 @@ const uint16_t x264_cabac_entropy[128] =
 
 uint8_t x264_cabac_contexts[4][QP_MAX_SPEC+1][1024];
 
+/* The tables are the same for every encoder in the process (4:4:4 just uses
+ * more contexts), so only the first call fills them, for all 1024 contexts. */
 void x264_cabac_init( x264_t *h )
 {
-    int ctx_count = CHROMA444 ? 1024 : 460;
+    static UNUSED x264_pthread_mutex_t init_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
+    static int b_init = 0;
+    x264_pthread_mutex_lock( &init_mutex );
+    if( b_init )
+    {
+        x264_pthread_mutex_unlock( &init_mutex );
+        return;
+    }
     for( int i = 0; i < 4; i++ )
     {
         const int8_t (*cabac_context_init)[1024][2] = i == 0 ? &x264_cabac_context_init_I
                                                              : &x264_cabac_context_init_PB[i-1];
         for( int qp = 0; qp <= QP_MAX_SPEC; qp++ )
-            for( int j = 0; j < ctx_count; j++ )
+            for( int j = 0; j < 1024; j++ )
             {
                 int state = x264_clip3( (((*cabac_context_init)[j][0] * qp) >> 4) + (*cabac_context_init)[j][1], 1, 126 );
                 x264_cabac_contexts[i][qp][j] = (X264_MIN( state, 127-state ) << 1) | (state >> 6);
             }
     }
+    b_init = 1;
+    x264_pthread_mutex_unlock( &init_mutex );
 }
 
 /*****************************************************************************
@@ -109,6 +109,9 @@ void x264_param_default( x264_param_t *param )
     param->rc.i_aq_mode = X264_AQ_VARIANCE;
     param->rc.f_aq_strength = 1.0;
     param->rc.i_lookahead = 40;
+    param->rc.f_speed = 0;
+    param->rc.i_speed_bufsize = 30;
+    param->rc.f_speed_bufinit = 0.75;
 
     param->rc.b_stat_write = 0;
     param->rc.psz_stat_out = "x264_2pass.log";
@@ -640,8 +643,12 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         else
             p->i_lookahead_threads = atoi(value);
     }
+    OPT("lookahead-batch")
+        p->b_lookahead_batch = atobool(value);
     OPT("sliced-threads")
         p->b_sliced_threads = atobool(value);
+    OPT("filter-thread")
+        p->b_filter_thread = atobool(value);
     OPT("sync-lookahead")
     {
         if( !strcmp(value, "auto") )
@@ -874,6 +881,8 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
 #endif
     OPT("dump-yuv")
         p->psz_dump_yuv = strdup(value);
+    OPT("stage-timing")
+        p->b_stage_timing = atobool(value);
     OPT2("analyse", "partitions")
     {
         p->analyse.inter = 0;
@@ -932,6 +941,8 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->analyse.i_trellis = atoi(value);
     OPT("fast-pskip")
         p->analyse.b_fast_pskip = atobool(value);
+    OPT("fast-lowres-me")
+        p->analyse.b_fast_lowres_me = atobool(value);
     OPT("dct-decimate")
         p->analyse.b_dct_decimate = atobool(value);
     OPT("deadzone-inter")
@@ -959,6 +970,14 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->rc.f_rf_constant_max = atof(value);
     OPT("rc-lookahead")
         p->rc.i_lookahead = atoi(value);
+    OPT("lookahead-quarter")
+        p->rc.b_lookahead_quarter = atobool(value);
+    OPT("speed")
+        p->rc.f_speed = atof(value);
+    OPT("speed-bufsize")
+        p->rc.i_speed_bufsize = atoi(value);
+    OPT("speed-bufinit")
+        p->rc.f_speed_bufinit = atof(value);
     OPT2("qpmin", "qp-min")
         p->rc.i_qp_min = atoi(value);
     OPT2("qpmax", "qp-max")
@@ -996,6 +1015,18 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->rc.f_qcompress = atof(value);
     OPT("mbtree")
         p->rc.b_mb_tree = atobool(value);
+    OPT("stats-binary")
+        p->rc.b_stat_binary = atobool(value);
+    OPT("mbtree-compact")
+        p->rc.b_mb_tree_compact = atobool(value);
+    OPT("pass2-window")
+        p->rc.i_pass2_window = atoi(value);
+    OPT("chunks")
+        p->rc.i_chunks = atoi(value);
+    OPT("chunk")
+        p->rc.i_chunk = atoi(value);
+    OPT("analysis-reuse")
+        p->rc.b_analysis_reuse = atobool(value);
     OPT("qblur")
         p->rc.f_qblur = atof(value);
     OPT2("cplxblur", "cplx-blur")
@@ -1009,6 +1040,8 @@ int x264_param_parse( x264_param_t *p, const char *name, const char *value )
         p->analyse.b_psnr = atobool(value);
     OPT("ssim")
         p->analyse.b_ssim = atobool(value);
+    OPT("async-metrics")
+        p->analyse.b_async_metrics = atobool(value);
     OPT("aud")
         p->b_aud = atobool(value);
     OPT("sps-id")
@@ -1166,17 +1199,15 @@ void x264_picture_clean( x264_picture_t *pic )
 void *x264_malloc( int i_size )
 {
     uint8_t *align_buf = NULL;
-#if SYS_MACOSX || (SYS_WINDOWS && ARCH_X86_64)
-    /* Mac OS X and Win x64 always returns 16 byte aligned memory */
-    align_buf = malloc( i_size );
-#elif HAVE_MALLOC_H
-    align_buf = memalign( 16, i_size );
+#if HAVE_MALLOC_H
+    align_buf = memalign( NATIVE_ALIGN, i_size );
 #else
-    uint8_t *buf = malloc( i_size + 15 + sizeof(void **) );
+    /* Mac OS X and Win x64 malloc only guarantees 16 byte alignment */
+    uint8_t *buf = malloc( i_size + (NATIVE_ALIGN-1) + sizeof(void **) );
     if( buf )
     {
-        align_buf = buf + 15 + sizeof(void **);
-        align_buf -= (intptr_t) align_buf & 15;
+        align_buf = buf + (NATIVE_ALIGN-1) + sizeof(void **);
+        align_buf -= (intptr_t) align_buf & (NATIVE_ALIGN-1);
         *( (void **) ( align_buf - sizeof(void **) ) ) = buf;
     }
 #endif
@@ -1192,7 +1223,7 @@ void x264_free( void *p )
 {
     if( p )
     {
-#if HAVE_MALLOC_H || SYS_MACOSX || (SYS_WINDOWS && ARCH_X86_64)
+#if HAVE_MALLOC_H
         free( p );
 #else
         free( *( ( ( void **) p ) - 1 ) );
@@ -1299,9 +1330,12 @@ char *x264_param2string( x264_param_t *p, int b_res )
     s += sprintf( s, " cqm=%d", p->i_cqm_preset );
     s += sprintf( s, " deadzone=%d,%d", p->analyse.i_luma_deadzone[0], p->analyse.i_luma_deadzone[1] );
     s += sprintf( s, " fast_pskip=%d", p->analyse.b_fast_pskip );
+    s += sprintf( s, " fast_lowres_me=%d", p->analyse.b_fast_lowres_me );
     s += sprintf( s, " chroma_qp_offset=%d", p->analyse.i_chroma_qp_offset );
     s += sprintf( s, " threads=%d", p->i_threads );
     s += sprintf( s, " lookahead_threads=%d", p->i_lookahead_threads );
+    if( p->b_lookahead_batch )
+        s += sprintf( s, " lookahead_batch=1" );
     s += sprintf( s, " sliced_threads=%d", p->b_sliced_threads );
     if( p->i_slice_count )
         s += sprintf( s, " slices=%d", p->i_slice_count );
@@ -1334,6 +1368,8 @@ char *x264_param2string( x264_param_t *p, int b_res )
 
     if( p->rc.b_mb_tree || p->rc.i_vbv_buffer_size )
         s += sprintf( s, " rc_lookahead=%d", p->rc.i_lookahead );
+    if( p->rc.b_lookahead_quarter )
+        s += sprintf( s, " lookahead_quarter=1" );
 
     s += sprintf( s, " rc=%s mbtree=%d", p->rc.i_rc_method == X264_RC_ABR ?
                                ( p->rc.b_stat_read ? "2pass" : p->rc.i_vbv_max_bitrate == p->rc.i_bitrate ? "cbr" : "abr" )
@@ -1350,6 +1386,10 @@ char *x264_param2string( x264_param_t *p, int b_res )
         if( p->rc.b_stat_read )
             s += sprintf( s, " cplxblur=%.1f qblur=%.1f",
                           p->rc.f_complexity_blur, p->rc.f_qblur );
+        if( p->rc.b_stat_read && p->rc.i_pass2_window )
+            s += sprintf( s, " pass2_window=%d", p->rc.i_pass2_window );
+        if( p->rc.b_stat_read && p->rc.i_chunks )
+            s += sprintf( s, " chunks=%d", p->rc.i_chunks );
         if( p->rc.i_vbv_buffer_size )
         {
             s += sprintf( s, " vbv_maxrate=%d vbv_bufsize=%d",
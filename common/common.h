@@ -80,6 +80,7 @@ do {\
 #define X264_WEIGHTP_FAKE (-1)
 
 #define NALU_OVERHEAD 5 // startcode + NAL type costs 5 bytes per frame
+#define NALU_HEADROOM 1024 // room left before the bitstream to encapsulate NALs in place
 #define FILLER_OVERHEAD (NALU_OVERHEAD+1)
 
 /****************************************************************************
@@ -227,6 +228,8 @@ char *x264_slurp_file( const char *filename );
 
 /* mdate: return the current date in microsecond */
 int64_t x264_mdate( void );
+/* ntime: return a monotonic time in nanoseconds, for measuring short intervals */
+int64_t x264_ntime( void );
 
 /* x264_param2string: return a (malloced) string containing most of
  * the encoding options */
@@ -411,6 +414,19 @@ typedef struct
 
 } x264_slice_header_t;
 
+/* frame type decisions published by one encoder's lookahead for others to follow */
+typedef struct
+{
+    x264_pthread_mutex_t          mutex;
+    x264_pthread_cond_t           cv_fill;
+    int                           i_refcount;
+    int                           b_closed;   /* the leader is gone, no more decisions will come */
+    int                           i_decided;  /* types of frames [0,i_decided) are final */
+    int                           i_known;    /* types of frames [i_decided,i_known) are tentative */
+    int                           i_max_size;
+    int8_t                        *type;      /* indexed by input frame number */
+} x264_lookahead_share_t;
+
 typedef struct x264_lookahead_t
 {
     volatile uint8_t              b_exit_thread;
@@ -423,9 +439,15 @@ typedef struct x264_lookahead_t
     x264_sync_frame_list_t        ifbuf;
     x264_sync_frame_list_t        next;
     x264_sync_frame_list_t        ofbuf;
+    x264_lookahead_share_t        *share_out; /* decisions of this lookahead, if it leads others */
+    x264_lookahead_share_t        *share_in;  /* decisions of the lookahead this one follows */
+    int64_t                       i_stage_time; /* total time in x264_slicetype_decide (b_stage_timing) */
 } x264_lookahead_t;
 
 typedef struct x264_ratecontrol_t   x264_ratecontrol_t;
+typedef struct x264_speedcontrol_t  x264_speedcontrol_t;
+typedef struct x264_filter_thread_t x264_filter_thread_t;
+typedef struct x264_metrics_job_t x264_metrics_job_t;
 
 typedef struct x264_left_table_t
 {
@@ -479,6 +501,8 @@ struct x264_t
     int             i_threadslice_pass; /* which pass of encoding we are on */
     x264_threadpool_t *threadpool;
     x264_threadpool_t *lookaheadpool;
+    x264_threadpool_t *metricspool;     /* b_async_metrics */
+    x264_metrics_job_t *metrics;
     x264_pthread_mutex_t mutex;
     x264_pthread_cond_t cv;
 
@@ -592,6 +616,7 @@ struct x264_t
         int64_t i_second_largest_pts;
         int b_have_lowres;  /* Whether 1/2 resolution luma planes are being used */
         int b_have_sub8x8_esa;
+        int b_have_hash;    /* Whether reference frames carry block hash tables (me=hash) */
     } frames;
 
     /* current frame being encoded */
@@ -648,6 +673,7 @@ struct x264_t
 
         /* Search parameters */
         int     i_me_method;
+        int     i_me_range;
         int     i_subpel_refine;
         int     b_chroma_me;
         int     b_trellis;
@@ -792,6 +818,7 @@ struct x264_t
             pixel *p_fref[2][X264_REF_MAX*2][12];
             pixel *p_fref_w[X264_REF_MAX*2];  /* weighted fullpel luma */
             uint16_t *p_integral[2][X264_REF_MAX];
+            uint32_t *p_hash[2][X264_REF_MAX];
 
             /* fref stride */
             int     i_stride[3];
@@ -867,6 +894,15 @@ struct x264_t
 
     /* rate control encoding only */
     x264_ratecontrol_t *rc;
+    x264_speedcontrol_t *sc;    /* only set in thread[0] */
+    x264_filter_thread_t *filter_thread; /* b_filter_thread */
+
+    /* stage timing (b_stage_timing), in nanoseconds */
+    struct
+    {
+        int64_t frame[X264_STAGE_MAX];  /* current frame; slice threads are merged into the main one */
+        int64_t thread[X264_STAGE_MAX]; /* everything this thread context has encoded */
+    } stage;
 
     /* stats */
     struct
@@ -949,6 +985,21 @@ struct x264_t
     x264_lookahead_t *lookahead;
 };
 
+static ALWAYS_INLINE int64_t x264_stage_start( x264_t *h )
+{
+    return h->param.b_stage_timing ? x264_ntime() : 0;
+}
+
+static ALWAYS_INLINE void x264_stage_end( x264_t *h, int stage, int64_t start )
+{
+    if( h->param.b_stage_timing )
+    {
+        int64_t time = x264_ntime() - start;
+        h->stage.frame[stage] += time;
+        h->stage.thread[stage] += time;
+    }
+}
+
 // included at the end because it needs x264_t
 #include "macroblock.h"
 
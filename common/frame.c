@@ -65,6 +65,76 @@ static int x264_frame_internal_csp( int external_csp )
     }
 }
 
+static int x264_frame_align( x264_t *h )
+{
+    return h->param.cpu&X264_CPU_CACHELINE_64 ? 64 : h->param.cpu&(X264_CPU_CACHELINE_32|X264_CPU_AVX2) ? 32 : 16;
+}
+
+static int x264_frame_disalign( x264_t *h )
+{
+    return h->param.cpu&X264_CPU_ALTIVEC ? 1<<9 : 1<<10;
+}
+
+/* The quarter level is sized in whole 8x8 lowres macroblocks, reading into the
+ * padding of the half resolution level where needed. */
+static x264_frame_t *x264_frame_new_quarter( x264_t *h, x264_frame_t *parent )
+{
+    x264_frame_t *frame;
+    int mb_width = (h->mb.i_mb_width + 1) / 2;
+    int mb_height = (h->mb.i_mb_height + 1) / 2;
+    int mb_count = mb_width * mb_height;
+    int align = x264_frame_align( h );
+    int disalign = x264_frame_disalign( h );
+
+    CHECKED_MALLOCZERO( frame, sizeof(x264_frame_t) );
+    for( int i = 0; i < 3; i++ )
+    {
+        frame->i_width[i] = parent->i_width[i];
+        frame->i_lines[i] = parent->i_lines[i];
+    }
+    frame->i_width_lowres = mb_width * 8;
+    frame->i_lines_lowres = mb_height * 8;
+    frame->i_stride_lowres = align_stride( frame->i_width_lowres + 2*PADH, align, disalign<<2 );
+
+    int luma_plane_size = align_plane_size( frame->i_stride_lowres * (frame->i_lines_lowres + 2*PADV), disalign );
+    CHECKED_MALLOC( frame->buffer_lowres[0], 4 * luma_plane_size * sizeof(pixel) );
+    for( int i = 0; i < 4; i++ )
+        frame->lowres[i] = frame->buffer_lowres[0] + (frame->i_stride_lowres * PADV + PADH) + i * luma_plane_size;
+
+    for( int j = 0; j <= !!h->param.i_bframe; j++ )
+        for( int i = 0; i <= h->param.i_bframe; i++ )
+        {
+            CHECKED_MALLOCZERO( frame->lowres_mvs[j][i], 2*(mb_count+7)*sizeof(int16_t) );
+            CHECKED_MALLOC( frame->lowres_mv_costs[j][i], mb_count*sizeof(int) );
+        }
+    for( int j = 0; j <= h->param.i_bframe+1; j++ )
+        for( int i = 0; i <= h->param.i_bframe+1; i++ )
+        {
+            CHECKED_MALLOC( frame->lowres_costs[j][i], (mb_count+7) * sizeof(uint16_t) );
+            CHECKED_MALLOC( frame->i_row_satds[j][i], mb_height * sizeof(int) );
+        }
+    frame->i_intra_cost = frame->lowres_costs[0][0];
+    memset( frame->i_intra_cost, -1, (mb_count+3) * sizeof(uint16_t) );
+    if( h->param.rc.i_aq_mode )
+    {
+        /* Decisions only use the unweighted costs; keep the AQ ones neutral. */
+        CHECKED_MALLOC( frame->i_inv_qscale_factor, (mb_count+3) * sizeof(uint16_t) );
+        for( int i = 0; i < mb_count+3; i++ )
+            frame->i_inv_qscale_factor[i] = 256;
+    }
+
+    if( x264_pthread_mutex_init( &frame->mutex, NULL ) )
+        goto fail;
+    if( x264_pthread_cond_init( &frame->cv, NULL ) )
+        goto fail;
+
+    return frame;
+
+fail:
+    x264_free( frame );
+    return NULL;
+}
+
 static x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
 {
     x264_frame_t *frame;
@@ -72,8 +142,8 @@ static x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
     int i_mb_count = h->mb.i_mb_count;
     int i_stride, i_width, i_lines, luma_plane_count;
     int i_padv = PADV << PARAM_INTERLACED;
-    int align = h->param.cpu&X264_CPU_CACHELINE_64 ? 64 : h->param.cpu&X264_CPU_CACHELINE_32 ? 32 : 16;
-    int disalign = h->param.cpu&X264_CPU_ALTIVEC ? 1<<9 : 1<<10;
+    int align = x264_frame_align( h );
+    int disalign = x264_frame_disalign( h );
 
     CHECKED_MALLOCZERO( frame, sizeof(x264_frame_t) );
 
@@ -202,12 +272,20 @@ static x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
         CHECKED_MALLOC( frame->i_row_bits, i_lines/16 * sizeof(int) );
         CHECKED_MALLOC( frame->f_row_qp, i_lines/16 * sizeof(float) );
         CHECKED_MALLOC( frame->f_row_qscale, i_lines/16 * sizeof(float) );
-        if( h->param.analyse.i_me_method >= X264_ME_ESA )
+        if( h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA )
         {
             CHECKED_MALLOC( frame->buffer[3],
                             frame->i_stride[0] * (frame->i_lines[0] + 2*i_padv) * sizeof(uint16_t) << h->frames.b_have_sub8x8_esa );
             frame->integral = (uint16_t*)frame->buffer[3] + frame->i_stride[0] * i_padv + PADH;
         }
+        if( h->frames.b_have_hash )
+        {
+            /* about one bucket per block position */
+            int bits = x264_clip3( 32 - x264_clz( frame->i_width[0] * frame->i_lines[0] - 1 ), 12, 22 );
+            frame->i_hash_mask = (1 << bits) - 1;
+            CHECKED_MALLOC( frame->hash, (frame->i_hash_mask + 1) * sizeof(uint32_t) );
+            CHECKED_MALLOC( frame->hash_rows, 8 * frame->i_width[0] * sizeof(uint32_t) );
+        }
         if( PARAM_INTERLACED )
             CHECKED_MALLOC( frame->field, i_mb_count * sizeof(uint8_t) );
         if( h->param.analyse.b_mb_info )
@@ -226,16 +304,29 @@ static x264_frame_t *x264_frame_new( x264_t *h, int b_fdec )
             for( int j = 0; j <= !!h->param.i_bframe; j++ )
                 for( int i = 0; i <= h->param.i_bframe; i++ )
                 {
-                    CHECKED_MALLOCZERO( frame->lowres_mvs[j][i], 2*h->mb.i_mb_count*sizeof(int16_t) );
+                    /* padded for the overread of mbtree_propagate_list asm */
+                    CHECKED_MALLOCZERO( frame->lowres_mvs[j][i], 2*(h->mb.i_mb_count+7)*sizeof(int16_t) );
                     CHECKED_MALLOC( frame->lowres_mv_costs[j][i], h->mb.i_mb_count*sizeof(int) );
                 }
             CHECKED_MALLOC( frame->i_propagate_cost, (i_mb_count+7) * sizeof(uint16_t) );
             for( int j = 0; j <= h->param.i_bframe+1; j++ )
                 for( int i = 0; i <= h->param.i_bframe+1; i++ )
-                    CHECKED_MALLOC( frame->lowres_costs[j][i], (i_mb_count+3) * sizeof(uint16_t) );
+                    CHECKED_MALLOC( frame->lowres_costs[j][i], (i_mb_count+7) * sizeof(uint16_t) );
             frame->i_intra_cost = frame->lowres_costs[0][0];
             memset( frame->i_intra_cost, -1, (i_mb_count+3) * sizeof(uint16_t) );
+            if( h->param.rc.b_lookahead_quarter )
+            {
+                frame->quarter = x264_frame_new_quarter( h, frame );
+                if( !frame->quarter )
+                    goto fail;
+            }
         }
+        if( h->param.rc.b_analysis_reuse && h->param.rc.b_stat_read )
+            for( int j = 0; j < 2; j++ )
+            {
+                CHECKED_MALLOC( frame->reuse_ref[j], 4 * i_mb_count * sizeof(int8_t) );
+                CHECKED_MALLOC( frame->reuse_mv[j], 2*4 * i_mb_count * sizeof(int16_t) );
+            }
         if( h->param.rc.i_aq_mode )
         {
             CHECKED_MALLOC( frame->f_qp_offset, h->mb.i_mb_count * sizeof(float) );
@@ -258,17 +349,31 @@ fail:
     return NULL;
 }
 
+static void x264_frame_release_planes( x264_frame_t *frame )
+{
+    if( frame->img_free )
+    {
+        frame->img_free( frame->opaque );
+        frame->img_free = NULL;
+        for( int i = 0; i < frame->i_plane; i++ )
+            frame->plane[i] = frame->plane_own[i];
+    }
+}
+
 void x264_frame_delete( x264_frame_t *frame )
 {
     /* Duplicate frames are blank copies of real frames (including pointers),
      * so freeing those pointers would cause a double free later. */
     if( !frame->b_duplicate )
     {
+        x264_frame_release_planes( frame );
         for( int i = 0; i < 4; i++ )
         {
             x264_free( frame->buffer[i] );
             x264_free( frame->buffer_fld[i] );
         }
+        x264_free( frame->hash );
+        x264_free( frame->hash_rows );
         for( int i = 0; i < 4; i++ )
             x264_free( frame->buffer_lowres[i] );
         for( int i = 0; i < X264_BFRAME_MAX+2; i++ )
@@ -281,6 +386,11 @@ void x264_frame_delete( x264_frame_t *frame )
                 x264_free( frame->lowres_mv_costs[j][i] );
             }
         x264_free( frame->i_propagate_cost );
+        for( int j = 0; j < 2; j++ )
+        {
+            x264_free( frame->reuse_ref[j] );
+            x264_free( frame->reuse_mv[j] );
+        }
         for( int j = 0; j <= X264_BFRAME_MAX+1; j++ )
             for( int i = 0; i <= X264_BFRAME_MAX+1; i++ )
                 x264_free( frame->lowres_costs[j][i] );
@@ -312,6 +422,8 @@ void x264_frame_delete( x264_frame_t *frame )
         }
         x264_pthread_mutex_destroy( &frame->mutex );
         x264_pthread_cond_destroy( &frame->cv );
+        if( frame->quarter )
+            x264_frame_delete( frame->quarter );
     }
     x264_free( frame );
 }
@@ -337,6 +449,44 @@ static int get_plane_ptr( x264_t *h, x264_picture_t *src, uint8_t **pix, int *st
 
 #define get_plane_ptr(...) do{ if( get_plane_ptr(__VA_ARGS__) < 0 ) return -1; }while(0)
 
+void x264_frame_input_layout( x264_t *h, x264_image_t *img, int *pad_h, int *pad_v )
+{
+    int i_csp = x264_frame_internal_csp( h->param.i_csp );
+    int i_stride = align_stride( h->mb.i_mb_width*16 + 2*PADH, x264_frame_align( h ), x264_frame_disalign( h ) );
+    memset( img, 0, sizeof(x264_image_t) );
+    img->i_csp = i_csp | (BIT_DEPTH > 8 ? X264_CSP_HIGH_DEPTH : 0);
+    img->i_plane = i_csp == X264_CSP_I444 ? 3 : 2;
+    for( int i = 0; i < img->i_plane; i++ )
+        img->i_stride[i] = i_stride * sizeof(pixel);
+    *pad_h = PADH;
+    *pad_v = PADV << PARAM_INTERLACED;
+}
+
+/* Use the caller's planes as the frame's planes instead of copying them.
+ * They must already be in the internal layout, see x264_frame_input_layout. */
+static int x264_frame_borrow_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
+{
+    if( (src->img.i_csp & X264_CSP_MASK) != dst->i_csp || (src->img.i_csp & X264_CSP_VFLIP) )
+    {
+        x264_log( h, X264_LOG_ERROR, "Zero-copy input must use the internal colorspace\n" );
+        return -1;
+    }
+    for( int i = 0; i < dst->i_plane; i++ )
+        if( src->img.i_stride[i] != dst->i_stride[i] * (int)sizeof(pixel) || ((intptr_t)src->img.plane[i] & (NATIVE_ALIGN-1)) )
+        {
+            x264_log( h, X264_LOG_ERROR, "Zero-copy input plane %d has an invalid stride or alignment\n", i );
+            return -1;
+        }
+
+    for( int i = 0; i < dst->i_plane; i++ )
+    {
+        dst->plane_own[i] = dst->plane[i];
+        dst->plane[i] = (pixel*)src->img.plane[i];
+    }
+    dst->img_free = src->img_free;
+    return 0;
+}
+
 int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
 {
     int i_csp = src->img.i_csp & X264_CSP_MASK;
@@ -370,6 +520,9 @@ int x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src )
     dst->mb_info    = h->param.analyse.b_mb_info ? src->prop.mb_info : NULL;
     dst->mb_info_free = h->param.analyse.b_mb_info ? src->prop.mb_info_free : NULL;
 
+    if( src->img_free )
+        return x264_frame_borrow_picture( h, dst, src );
+
     uint8_t *pix[3];
     int stride[3];
     if ( i_csp >= X264_CSP_BGR )
@@ -699,7 +852,10 @@ void x264_frame_push_unused( x264_t *h, x264_frame_t *frame )
     assert( frame->i_reference_count > 0 );
     frame->i_reference_count--;
     if( frame->i_reference_count == 0 )
+    {
+        x264_frame_release_planes( frame );
         x264_frame_push( h->frames.unused[frame->b_fdec], frame );
+    }
 }
 
 x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
@@ -717,6 +873,7 @@ x264_frame_t *x264_frame_pop_unused( x264_t *h, int b_fdec )
     frame->b_scenecut = 1;
     frame->b_keyframe = 0;
     frame->b_corrupt = 0;
+    frame->i_lookahead_time = 0;
 
     memset( frame->weight, 0, sizeof(frame->weight) );
     memset( frame->f_weighted_cost_delta, 0, sizeof(frame->f_weighted_cost_delta) );
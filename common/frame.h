@@ -79,6 +79,9 @@ typedef struct x264_frame
     pixel *filtered_fld[3][4];
     pixel *lowres[4]; /* half-size copy of input frame: Orig, H, V, HV */
     uint16_t *integral;
+    uint32_t *hash;      /* me=hash: position (y<<16|x) of the last 8x8 block seen per hash bucket */
+    uint32_t *hash_rows; /* rolling row hashes for the last 8 lines */
+    int     i_hash_mask;
 
     /* for unrestricted mv we allocate more data than needed
      * allocated data are stored in buffer */
@@ -90,6 +93,9 @@ typedef struct x264_frame
     pixel *weighted[X264_REF_MAX]; /* plane[0] weighted of the reference frames */
     int b_duplicate;
     struct x264_frame *orig;
+    /* b_lookahead_quarter: a second lowres level at 1/4 resolution for B-adapt and scenecut,
+     * carrying only the lowres fields.  Its lowres[] are built from this frame's lowres[0]. */
+    struct x264_frame *quarter;
 
     /* motion data */
     int8_t  *mb_type;
@@ -98,6 +104,8 @@ typedef struct x264_frame
     int16_t (*mv16x16)[2];
     int16_t (*lowres_mvs[2][X264_BFRAME_MAX+1])[2];
     uint8_t *field;
+    int8_t  *reuse_ref[2];       /* motion from the previous pass, per 8x8 block */
+    int16_t (*reuse_mv[2])[2];
     uint8_t *effective_qp;
 
     /* Stored as (lists_used << LOWRES_COST_SHIFT) + (cost).
@@ -153,6 +161,9 @@ typedef struct x264_frame
     x264_pthread_mutex_t mutex;
     x264_pthread_cond_t  cv;
 
+    /* time spent in x264_slicetype_decide, attributed to the first frame it decided (b_stage_timing) */
+    int64_t i_lookahead_time;
+
     /* periodic intra refresh */
     float   f_pir_position;
     int     i_pir_start_col;
@@ -168,6 +179,10 @@ typedef struct x264_frame
     /* user data */
     void *opaque;
 
+    /* zero-copy input: plane[] are borrowed from the caller until img_free( opaque ) */
+    void (*img_free)( void* );
+    pixel *plane_own[3];
+
     /* user frame properties */
     uint8_t *mb_info;
     void (*mb_info_free)( void* );
@@ -212,6 +227,7 @@ typedef struct
 void          x264_frame_delete( x264_frame_t *frame );
 
 int           x264_frame_copy_picture( x264_t *h, x264_frame_t *dst, x264_picture_t *src );
+void          x264_frame_input_layout( x264_t *h, x264_image_t *img, int *pad_h, int *pad_v );
 
 void          x264_frame_expand_border( x264_t *h, x264_frame_t *frame, int mb_y );
 void          x264_frame_expand_border_filtered( x264_t *h, x264_frame_t *frame, int mb_y, int b_end );
@@ -251,4 +267,34 @@ void          x264_sync_frame_list_delete( x264_sync_frame_list_t *slist );
 void          x264_sync_frame_list_push( x264_sync_frame_list_t *slist, x264_frame_t *frame );
 x264_frame_t *x264_sync_frame_list_pop( x264_sync_frame_list_t *slist );
 
+/* me=hash: polynomial hash of an 8x8 luma block, computed as a hash of each
+ * 8-pixel row (which can be rolled along a line) combined over 8 rows. */
+#define HASH_ROW_MUL   0x01000193U
+#define HASH_BLOCK_MUL 0x9e3779b1U
+
+static ALWAYS_INLINE uint32_t x264_hash_row8( pixel *p )
+{
+    uint32_t hash = 0;
+    for( int i = 0; i < 8; i++ )
+        hash = hash * HASH_ROW_MUL + p[i];
+    return hash;
+}
+
+static ALWAYS_INLINE uint32_t x264_hash_block8( pixel *p, intptr_t stride )
+{
+    uint32_t hash = 0;
+    for( int j = 0; j < 8; j++ )
+        hash = hash * HASH_BLOCK_MUL + x264_hash_row8( p + j*stride );
+    return hash;
+}
+
+/* the low bits of a polynomial hash are poorly mixed */
+static ALWAYS_INLINE int x264_hash_bucket( uint32_t hash, int mask )
+{
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6dU;
+    hash ^= hash >> 12;
+    return hash & mask;
+}
+
 #endif
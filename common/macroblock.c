@@ -366,7 +366,8 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
                 CHECKED_MALLOC( h->intra_border_backup[i][j], (h->sps->i_mb_width*16+32) * sizeof(pixel) );
                 h->intra_border_backup[i][j] += 16;
             }
-        for( int i = 0; i <= PARAM_INTERLACED; i++ )
+        /* With a filter thread, deblocking lags encoding by a row, so keep two rows of strengths. */
+        for( int i = 0; i <= (PARAM_INTERLACED || h->param.b_filter_thread); i++ )
         {
             if( h->param.b_sliced_threads )
             {
@@ -390,7 +391,7 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
         int buf_hpel = (h->thread[0]->fdec->i_width[0]+48) * sizeof(int16_t);
         int buf_ssim = h->param.analyse.b_ssim * 8 * (h->param.i_width/4+3) * sizeof(int);
         int me_range = X264_MIN(h->param.analyse.i_me_range, h->param.analyse.i_mv_range);
-        int buf_tesa = (h->param.analyse.i_me_method >= X264_ME_ESA) *
+        int buf_tesa = (h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA) *
             ((me_range*2+24) * sizeof(int16_t) + (me_range+4) * (me_range+1) * 4 * sizeof(mvsad_t));
         scratch_size = X264_MAX3( buf_hpel, buf_ssim, buf_tesa );
     }
@@ -402,7 +403,10 @@ int x264_macroblock_thread_allocate( x264_t *h, int b_lookahead )
         h->scratch_buffer = NULL;
 
     int buf_lookahead_threads = (h->mb.i_mb_height + (4 + 32) * h->param.i_lookahead_threads) * sizeof(int) * 2;
-    CHECKED_MALLOC( h->scratch_buffer2, buf_lookahead_threads );
+    /* mbtree_propagate_list asm output: 6 int16 per macroblock, in groups of 8 */
+    int buf_mbtree2 = h->param.rc.b_mb_tree * ((h->mb.i_mb_width+7)&~7) * sizeof(int16_t) * 6;
+    scratch_size = X264_MAX( buf_lookahead_threads, buf_mbtree2 );
+    CHECKED_MALLOC( h->scratch_buffer2, scratch_size );
 
     return 0;
 fail:
@@ -413,7 +417,7 @@ void x264_macroblock_thread_free( x264_t *h, int b_lookahead )
 {
     if( !b_lookahead )
     {
-        for( int i = 0; i <= PARAM_INTERLACED; i++ )
+        for( int i = 0; i <= (PARAM_INTERLACED || h->param.b_filter_thread); i++ )
             if( !h->param.b_sliced_threads || (h == h->thread[0] && !i) )
                 x264_free( h->deblock_strength[i] );
         for( int i = 0; i < (PARAM_INTERLACED ? 5 : 2); i++ )
@@ -505,6 +509,7 @@ void x264_macroblock_slice_init( x264_t *h )
 void x264_macroblock_thread_init( x264_t *h )
 {
     h->mb.i_me_method = h->param.analyse.i_me_method;
+    h->mb.i_me_range = h->param.analyse.i_me_range;
     h->mb.i_subpel_refine = h->param.analyse.i_subpel_refine;
     if( h->sh.i_type == SLICE_TYPE_B && (h->mb.i_subpel_refine == 6 || h->mb.i_subpel_refine == 8) )
         h->mb.i_subpel_refine--;
@@ -1042,6 +1047,11 @@ static void ALWAYS_INLINE x264_macroblock_cache_load( x264_t *h, int mb_x, int m
                 h->mb.pic.p_integral[list][i] = &h->fref[list][i]->integral[offset];
     }
 
+    if( h->fdec->hash )
+        for( int list = 0; list < 2; list++ )
+            for( int i = 0; i < h->mb.pic.i_fref[list]; i++ )
+                h->mb.pic.p_hash[list][i] = h->fref[list][i]->hash;
+
     x264_prefetch_fenc( h, h->fenc, mb_x, mb_y );
 
     /* load ref/mv/mvd */
@@ -402,6 +402,20 @@ static void integral_init8v( uint16_t *sum8, intptr_t stride )
         sum8[x] = sum8[x+8*stride] - sum8[x];
 }
 
+/* Forget the costs and vectors of whatever frame previously used these buffers. */
+static void x264_frame_reset_lowres( x264_t *h, x264_frame_t *frame )
+{
+    memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
+
+    for( int y = 0; y < h->param.i_bframe + 2; y++ )
+        for( int x = 0; x < h->param.i_bframe + 2; x++ )
+            frame->i_row_satds[y][x][0] = -1;
+
+    for( int y = 0; y <= !!h->param.i_bframe; y++ )
+        for( int x = 0; x <= h->param.i_bframe; x++ )
+            frame->lowres_mvs[y][x][0][0] = 0x7FFF;
+}
+
 void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
 {
     pixel *src = frame->plane[0];
@@ -416,16 +430,23 @@ void x264_frame_init_lowres( x264_t *h, x264_frame_t *frame )
     h->mc.frame_init_lowres_core( src, frame->lowres[0], frame->lowres[1], frame->lowres[2], frame->lowres[3],
                                   i_stride, frame->i_stride_lowres, frame->i_width_lowres, frame->i_lines_lowres );
     x264_frame_expand_border_lowres( frame );
+    x264_frame_reset_lowres( h, frame );
 
-    memset( frame->i_cost_est, -1, sizeof(frame->i_cost_est) );
-
-    for( int y = 0; y < h->param.i_bframe + 2; y++ )
-        for( int x = 0; x < h->param.i_bframe + 2; x++ )
-            frame->i_row_satds[y][x][0] = -1;
-
-    for( int y = 0; y <= !!h->param.i_bframe; y++ )
-        for( int x = 0; x <= h->param.i_bframe; x++ )
-            frame->lowres_mvs[y][x][0][0] = 0x7FFF;
+    x264_frame_t *quarter = frame->quarter;
+    if( quarter )
+    {
+        /* The quarter level may be a few pixels wider or taller than half of the
+         * half level; those come out of its padding. */
+        h->mc.frame_init_lowres_core( frame->lowres[0], quarter->lowres[0], quarter->lowres[1], quarter->lowres[2], quarter->lowres[3],
+                                      frame->i_stride_lowres, quarter->i_stride_lowres, quarter->i_width_lowres, quarter->i_lines_lowres );
+        x264_frame_expand_border_lowres( quarter );
+        x264_frame_reset_lowres( h, quarter );
+        quarter->i_frame = frame->i_frame;
+        quarter->b_intra_calculated = 0;
+        quarter->b_scenecut = 1;
+        memcpy( quarter->i_pixel_sum, frame->i_pixel_sum, sizeof(frame->i_pixel_sum) );
+        memcpy( quarter->i_pixel_ssd, frame->i_pixel_ssd, sizeof(frame->i_pixel_ssd) );
+    }
 }
 
 static void frame_init_lowres_core( pixel *src0, pixel *dst0, pixel *dsth, pixel *dstv, pixel *dstc,
@@ -469,6 +490,77 @@ static void mbtree_propagate_cost( int *dst, uint16_t *propagate_in, uint16_t *i
     }
 }
 
+/* Distribute the propagate amounts of one row of macroblocks in one list
+ * to the up to 4 macroblocks of the reference frame each one predicts from. */
+static void mbtree_propagate_list( x264_t *h, uint16_t *ref_costs, int16_t (*mvs)[2],
+                                   int *propagate_amount, uint16_t *lowres_costs,
+                                   int bipred_weight, int mb_y, int len, int list )
+{
+    int stride = h->mb.i_mb_stride;
+    int width = h->mb.i_mb_width;
+    int height = h->mb.i_mb_height;
+
+    for( int i = 0; i < len; i++ )
+    {
+#define CLIP_ADD(s,x) (s) = X264_MIN((s)+(x),(1<<16)-1)
+        int listamount = propagate_amount[i];
+        /* Access width-2 bitfield. */
+        int lists_used = lowres_costs[i] >> LOWRES_COST_SHIFT;
+
+        /* Don't propagate for an intra block. */
+        if( listamount <= 0 || !((lists_used >> list)&1) )
+            continue;
+
+        /* Apply bipred weighting. */
+        if( lists_used == 3 )
+            listamount = (listamount * bipred_weight + 32) >> 6;
+
+        /* Early termination for simple case of mv0. */
+        if( !M32( mvs[i] ) )
+        {
+            CLIP_ADD( ref_costs[mb_y*stride + i], listamount );
+            continue;
+        }
+
+        int x = mvs[i][0];
+        int y = mvs[i][1];
+        int mbx = (x>>5)+i;
+        int mby = (y>>5)+mb_y;
+        int idx0 = mbx + mby * stride;
+        int idx1 = idx0 + 1;
+        int idx2 = idx0 + stride;
+        int idx3 = idx0 + stride + 1;
+        x &= 31;
+        y &= 31;
+        int idx0weight = (32-y)*(32-x);
+        int idx1weight = (32-y)*x;
+        int idx2weight = y*(32-x);
+        int idx3weight = y*x;
+
+        /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
+         * be counted. */
+        if( mbx < width-1 && mby < height-1 && mbx >= 0 && mby >= 0 )
+        {
+            CLIP_ADD( ref_costs[idx0], (listamount*idx0weight+512)>>10 );
+            CLIP_ADD( ref_costs[idx1], (listamount*idx1weight+512)>>10 );
+            CLIP_ADD( ref_costs[idx2], (listamount*idx2weight+512)>>10 );
+            CLIP_ADD( ref_costs[idx3], (listamount*idx3weight+512)>>10 );
+        }
+        else /* Check offsets individually */
+        {
+            if( mbx < width && mby < height && mbx >= 0 && mby >= 0 )
+                CLIP_ADD( ref_costs[idx0], (listamount*idx0weight+512)>>10 );
+            if( mbx+1 < width && mby < height && mbx+1 >= 0 && mby >= 0 )
+                CLIP_ADD( ref_costs[idx1], (listamount*idx1weight+512)>>10 );
+            if( mbx < width && mby+1 < height && mbx >= 0 && mby+1 >= 0 )
+                CLIP_ADD( ref_costs[idx2], (listamount*idx2weight+512)>>10 );
+            if( mbx+1 < width && mby+1 < height && mbx+1 >= 0 && mby+1 >= 0 )
+                CLIP_ADD( ref_costs[idx3], (listamount*idx3weight+512)>>10 );
+        }
+#undef CLIP_ADD
+    }
+}
+
 void x264_mc_init( int cpu, x264_mc_functions_t *pf )
 {
     pf->mc_luma   = mc_luma;
@@ -523,6 +615,7 @@ void x264_mc_init( int cpu, x264_mc_functions_t *pf )
     pf->integral_init8v = integral_init8v;
 
     pf->mbtree_propagate_cost = mbtree_propagate_cost;
+    pf->mbtree_propagate_list = mbtree_propagate_list;
 
 #if HAVE_MMX
     x264_mc_init_mmx( cpu, pf );
@@ -536,6 +629,42 @@ void x264_mc_init( int cpu, x264_mc_functions_t *pf )
 #endif
 }
 
+/* Hash the luma lines [start,end) and insert every 8x8 block whose last line
+ * is among them, so blocks become searchable as soon as their pixels are final. */
+static void x264_frame_hash_lines( x264_frame_t *frame, int start, int end )
+{
+    int stride = frame->i_stride[0];
+    int width = frame->i_width[0];
+    const uint32_t roll = HASH_ROW_MUL*HASH_ROW_MUL*HASH_ROW_MUL*HASH_ROW_MUL
+                        * HASH_ROW_MUL*HASH_ROW_MUL*HASH_ROW_MUL;
+    if( start <= 0 )
+    {
+        memset( frame->hash, 0xff, (frame->i_hash_mask + 1) * sizeof(uint32_t) );
+        start = 0;
+    }
+    for( int y = start; y < end; y++ )
+    {
+        pixel *pix = frame->plane[0] + y * stride;
+        uint32_t *row = frame->hash_rows + (y&7) * width;
+        uint32_t hash = x264_hash_row8( pix );
+        for( int x = 0; x < width-8; x++ )
+        {
+            row[x] = hash;
+            hash = (hash - pix[x] * roll) * HASH_ROW_MUL + pix[x+8];
+        }
+        row[width-8] = hash;
+        if( y < 7 )
+            continue;
+        for( int x = 0; x <= width-8; x++ )
+        {
+            hash = 0;
+            for( int j = y-7; j <= y; j++ )
+                hash = hash * HASH_BLOCK_MUL + frame->hash_rows[(j&7) * width + x];
+            frame->hash[x264_hash_bucket( hash, frame->i_hash_mask )] = ((y-7) << 16) + x;
+        }
+    }
+}
+
 void x264_frame_filter( x264_t *h, x264_frame_t *frame, int mb_y, int b_end )
 {
     const int b_interlaced = PARAM_INTERLACED;
@@ -580,6 +709,9 @@ void x264_frame_filter( x264_t *h, x264_frame_t *frame, int mb_y, int b_end )
         }
     }
 
+    if( frame->hash )
+        x264_frame_hash_lines( frame, start, X264_MIN( height, frame->i_lines[0] ) );
+
     /* generate integral image:
      * frame->integral contains 2 planes. in the upper plane, each element is
      * the sum of an 8x8 pixel region with top-left corner on that point.
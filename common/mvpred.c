@@ -516,7 +516,45 @@ int x264_mb_predict_mv_direct16x16( x264_t *h, int *b_changed )
 }
 
 /* This just improves encoder performance, it's not part of the spec */
-void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[9][2], int *i_mvc )
+int x264_mb_predict_mv_lowres( x264_t *h, int i_list, int i_ref, int16_t mv[2] )
+{
+    if( !h->frames.b_have_lowres || (i_ref && SLICE_MBAFF) )
+        return 0;
+
+    int dist0 = i_list ? h->fref[1][0]->i_frame - h->fenc->i_frame
+                       : h->fenc->i_frame - h->fref[0][0]->i_frame;
+    int dist  = i_list ? h->fref[1][i_ref]->i_frame - h->fenc->i_frame
+                       : h->fenc->i_frame - h->fref[0][i_ref]->i_frame;
+    if( dist0 <= 0 || dist <= 0 )
+        return 0;
+
+    /* the lookahead searched this exact distance */
+    if( dist <= h->param.i_bframe+1 )
+    {
+        int16_t (*lowres_mv)[2] = h->fenc->lowres_mvs[i_list][dist-1];
+        if( lowres_mv[0][0] != 0x7fff )
+        {
+            M32( mv ) = (M32( lowres_mv[h->mb.i_mb_xy] )*2)&0xfffeffff;
+            return 1;
+        }
+    }
+
+    /* older refs: scale the vector to the nearest one by temporal distance */
+    if( dist != dist0 && dist0 <= h->param.i_bframe+1 )
+    {
+        int16_t (*lowres_mv)[2] = h->fenc->lowres_mvs[i_list][dist0-1];
+        if( lowres_mv[0][0] != 0x7fff )
+        {
+            int16_t *mv0 = lowres_mv[h->mb.i_mb_xy];
+            mv[0] = x264_clip3( mv0[0]*2*dist/dist0, h->mb.mv_min_spel[0], h->mb.mv_max_spel[0] );
+            mv[1] = x264_clip3( mv0[1]*2*dist/dist0, h->mb.mv_min_spel[1], h->mb.mv_max_spel[1] );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[10][2], int *i_mvc )
 {
     int16_t (*mvr)[2] = h->mb.mvr[i_list][i_ref];
     int i = 0;
@@ -544,19 +582,19 @@ void x264_mb_predict_mv_ref16x16( x264_t *h, int i_list, int i_ref, int16_t mvc[
         SET_MVP( h->mb.cache.mv[i_list][x264_scan8[12]] );
     }
 
-    if( i_ref == 0 && h->frames.b_have_lowres )
+    if( x264_mb_predict_mv_lowres( h, i_list, i_ref, mvc[i] ) )
+        i++;
+
+    /* motion found by the previous pass */
+    if( h->fenc->reuse_ref[i_list] )
     {
-        int idx = i_list ? h->fref[1][0]->i_frame-h->fenc->i_frame-1
-                         : h->fenc->i_frame-h->fref[0][0]->i_frame-1;
-        if( idx <= h->param.i_bframe )
-        {
-            int16_t (*lowres_mv)[2] = h->fenc->lowres_mvs[i_list][idx];
-            if( lowres_mv[0][0] != 0x7fff )
+        int8_t *ref = h->fenc->reuse_ref[i_list] + 4*h->mb.i_mb_xy;
+        for( int j = 0; j < 4; j++ )
+            if( ref[j] == i_ref )
             {
-                M32( mvc[i] ) = (M32( lowres_mv[h->mb.i_mb_xy] )*2)&0xfffeffff;
-                i++;
+                SET_MVP( h->fenc->reuse_mv[i_list][4*h->mb.i_mb_xy+j] );
+                break;
             }
-        }
     }
 
     /* spatial predictors */
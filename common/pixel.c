@@ -504,6 +504,10 @@ SATD_X_DECL7( _ssse3 )
 SATD_X_DECL7( _sse4 )
 SATD_X_DECL7( _avx )
 SATD_X_DECL7( _xop )
+SATD_X( 16x16, _avx2 )
+SATD_X( 16x8, _avx2 )
+SATD_X( 8x16, _avx2 )
+SATD_X( 8x8, _avx2 )
 #endif // !HIGH_BIT_DEPTH
 #endif
 
@@ -1221,6 +1225,19 @@ void x264_pixel_init( int cpu, x264_pixel_function_t *pixf )
         pixf->var2[PIXEL_8x8] = x264_pixel_var2_8x8_xop;
         pixf->var2[PIXEL_8x16] = x264_pixel_var2_8x16_xop;
     }
+
+    if( cpu&X264_CPU_AVX2 )
+    {
+        INIT2( sad_x3, _avx2 );
+        INIT2( sad_x4, _avx2 );
+        INIT4( satd, _avx2 );
+        INIT4( satd_x3, _avx2 );
+        INIT4( satd_x4, _avx2 );
+#if ARCH_X86_64
+        INIT2( hadamard_ac, _avx2 );
+        pixf->sa8d[PIXEL_16x16] = x264_pixel_sa8d_16x16_avx2;
+#endif
+    }
 #endif //HAVE_MMX
 
 #if HAVE_ARMV6
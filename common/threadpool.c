@@ -32,6 +32,22 @@ typedef struct
     void *ret;
 } x264_threadpool_job_t;
 
+/* each worker owns a queue of jobs, with its own lock. a worker takes jobs
+ * from the front of its own queue and, when that is empty, steals from the
+ * back of the other workers' queues. */
+typedef struct
+{
+    x264_threadpool_t     *pool;
+    int                    index;
+    x264_pthread_mutex_t   mutex;
+    x264_threadpool_job_t **list; /* jobs queued on this worker */
+    int                    i_size;
+
+    /* statistics, only written by the owning worker */
+    int64_t                steals;
+    int64_t                idle_time;
+} x264_threadpool_worker_t;
+
 struct x264_threadpool_t
 {
     int            exit;
@@ -40,32 +56,103 @@ struct x264_threadpool_t
     void           (*init_func)(void *);
     void           *init_arg;
 
+    x264_threadpool_worker_t *worker;
+    int            next_worker; /* worker the next job is queued on */
+
+    /* the pool mutex only protects the count of queued jobs,
+     * which idle workers sleep on */
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_fill;
+    int            pending;
+
     /* requires a synchronized list structure and associated methods,
        so use what is already implemented for frames */
     x264_sync_frame_list_t uninit; /* list of jobs that are awaiting use */
-    x264_sync_frame_list_t run;    /* list of jobs that are queued for processing by the pool */
     x264_sync_frame_list_t done;   /* list of jobs that have finished processing */
+
+    /* a pool attached to a scheduler has no workers of its own: its jobs wait
+     * in queue, protected by the scheduler's mutex, until a shared worker takes them */
+    x264_scheduler_t *sched;
+    x264_threadpool_job_t **queue;
+    int            i_queue;
 };
 
-static void x264_threadpool_thread( x264_threadpool_t *pool )
+/* workers shared by the pools of many encoders.  each pool's jobs start in the
+ * order they were queued, and idle workers serve the pools round robin, so a
+ * stream with many queued jobs can't starve the others. */
+struct x264_scheduler_t
+{
+    int            exit;
+    int            threads;
+    x264_pthread_t *thread_handle;
+    void           (*init_func)(void *);
+    void           *init_arg;
+
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t  cv_fill;
+    x264_threadpool_t **pools;  /* attached pools */
+    int            i_pools;
+    int            next_pool;   /* pool served first by the next idle worker */
+    int            refcount;    /* the creator's reference plus one per attached pool */
+};
+
+static x264_threadpool_job_t *x264_threadpool_take( x264_threadpool_worker_t *worker )
+{
+    x264_threadpool_t *pool = worker->pool;
+    x264_threadpool_job_t *job = NULL;
+
+    x264_pthread_mutex_lock( &worker->mutex );
+    if( worker->i_size )
+    {
+        job = (void*)x264_frame_shift( (void*)worker->list );
+        worker->i_size--;
+    }
+    x264_pthread_mutex_unlock( &worker->mutex );
+
+    for( int i = 1; !job && i < pool->threads; i++ )
+    {
+        x264_threadpool_worker_t *victim = pool->worker + (worker->index + i) % pool->threads;
+        x264_pthread_mutex_lock( &victim->mutex );
+        if( victim->i_size )
+        {
+            job = (void*)x264_frame_pop( (void*)victim->list );
+            victim->i_size--;
+            worker->steals++;
+        }
+        x264_pthread_mutex_unlock( &victim->mutex );
+    }
+
+    if( job )
+    {
+        x264_pthread_mutex_lock( &pool->mutex );
+        pool->pending--;
+        x264_pthread_mutex_unlock( &pool->mutex );
+    }
+    return job;
+}
+
+static void x264_threadpool_thread( x264_threadpool_worker_t *worker )
 {
+    x264_threadpool_t *pool = worker->pool;
+
     if( pool->init_func )
         pool->init_func( pool->init_arg );
 
     while( !pool->exit )
     {
-        x264_threadpool_job_t *job = NULL;
-        x264_pthread_mutex_lock( &pool->run.mutex );
-        while( !pool->exit && !pool->run.i_size )
-            x264_pthread_cond_wait( &pool->run.cv_fill, &pool->run.mutex );
-        if( pool->run.i_size )
-        {
-            job = (void*)x264_frame_shift( pool->run.list );
-            pool->run.i_size--;
-        }
-        x264_pthread_mutex_unlock( &pool->run.mutex );
+        x264_threadpool_job_t *job = x264_threadpool_take( worker );
         if( !job )
+        {
+            /* a job counted as pending may be in the middle of being taken by
+             * another worker, in which case we just rescan */
+            int64_t start = x264_mdate();
+            x264_pthread_mutex_lock( &pool->mutex );
+            while( !pool->exit && !pool->pending )
+                x264_pthread_cond_wait( &pool->cv_fill, &pool->mutex );
+            x264_pthread_mutex_unlock( &pool->mutex );
+            worker->idle_time += x264_mdate() - start;
             continue;
+        }
         job->ret = (void*)x264_stack_align( job->func, job->arg ); /* execute the function */
         x264_sync_frame_list_push( &pool->done, (void*)job );
     }
@@ -86,9 +173,24 @@ int x264_threadpool_init( x264_threadpool_t **p_pool, int threads,
     pool->threads   = threads;
 
     CHECKED_MALLOC( pool->thread_handle, pool->threads * sizeof(x264_pthread_t) );
+    CHECKED_MALLOCZERO( pool->worker, pool->threads * sizeof(x264_threadpool_worker_t) );
+
+    if( x264_pthread_mutex_init( &pool->mutex, NULL ) ||
+        x264_pthread_cond_init( &pool->cv_fill, NULL ) )
+        goto fail;
+
+    for( int i = 0; i < pool->threads; i++ )
+    {
+        x264_threadpool_worker_t *worker = pool->worker + i;
+        worker->pool  = pool;
+        worker->index = i;
+        /* a queue never holds more than the total number of jobs */
+        CHECKED_MALLOCZERO( worker->list, (pool->threads + 1) * sizeof(x264_threadpool_job_t*) );
+        if( x264_pthread_mutex_init( &worker->mutex, NULL ) )
+            goto fail;
+    }
 
     if( x264_sync_frame_list_init( &pool->uninit, pool->threads ) ||
-        x264_sync_frame_list_init( &pool->run, pool->threads ) ||
         x264_sync_frame_list_init( &pool->done, pool->threads ) )
         goto fail;
 
@@ -99,7 +201,7 @@ int x264_threadpool_init( x264_threadpool_t **p_pool, int threads,
        x264_sync_frame_list_push( &pool->uninit, (void*)job );
     }
     for( int i = 0; i < pool->threads; i++ )
-        if( x264_pthread_create( pool->thread_handle+i, NULL, (void*)x264_threadpool_thread, pool ) )
+        if( x264_pthread_create( pool->thread_handle+i, NULL, (void*)x264_threadpool_thread, pool->worker+i ) )
             goto fail;
 
     return 0;
@@ -112,7 +214,28 @@ void x264_threadpool_run( x264_threadpool_t *pool, void *(*func)(void *), void *
     x264_threadpool_job_t *job = (void*)x264_sync_frame_list_pop( &pool->uninit );
     job->func = func;
     job->arg  = arg;
-    x264_sync_frame_list_push( &pool->run, (void*)job );
+
+    if( pool->sched )
+    {
+        x264_scheduler_t *sched = pool->sched;
+        x264_pthread_mutex_lock( &sched->mutex );
+        x264_frame_push( (void*)pool->queue, (void*)job );
+        pool->i_queue++;
+        x264_pthread_cond_signal( &sched->cv_fill );
+        x264_pthread_mutex_unlock( &sched->mutex );
+        return;
+    }
+
+    x264_pthread_mutex_lock( &pool->mutex );
+    x264_threadpool_worker_t *worker = pool->worker + pool->next_worker;
+    pool->next_worker = (pool->next_worker + 1) % pool->threads;
+    x264_pthread_mutex_lock( &worker->mutex );
+    x264_frame_push( (void*)worker->list, (void*)job );
+    worker->i_size++;
+    x264_pthread_mutex_unlock( &worker->mutex );
+    pool->pending++;
+    x264_pthread_cond_signal( &pool->cv_fill );
+    x264_pthread_mutex_unlock( &pool->mutex );
 }
 
 void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg )
@@ -141,6 +264,16 @@ void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg )
     return ret;
 }
 
+void x264_threadpool_stats( x264_threadpool_t *pool, int64_t *steals, int64_t *idle_time )
+{
+    *steals = *idle_time = 0;
+    for( int i = 0; i < pool->threads && !pool->sched; i++ )
+    {
+        *steals    += pool->worker[i].steals;
+        *idle_time += pool->worker[i].idle_time;
+    }
+}
+
 static void x264_threadpool_list_delete( x264_sync_frame_list_t *slist )
 {
     for( int i = 0; slist->list[i]; i++ )
@@ -151,18 +284,195 @@ static void x264_threadpool_list_delete( x264_sync_frame_list_t *slist )
     x264_sync_frame_list_delete( slist );
 }
 
+static void x264_scheduler_detach( x264_threadpool_t *pool );
+
 void x264_threadpool_delete( x264_threadpool_t *pool )
 {
-    x264_pthread_mutex_lock( &pool->run.mutex );
+    if( pool->sched )
+    {
+        x264_scheduler_detach( pool );
+        x264_threadpool_list_delete( &pool->uninit );
+        x264_threadpool_list_delete( &pool->done );
+        x264_free( pool->queue );
+        x264_free( pool );
+        return;
+    }
+
+    x264_pthread_mutex_lock( &pool->mutex );
     pool->exit = 1;
-    x264_pthread_cond_broadcast( &pool->run.cv_fill );
-    x264_pthread_mutex_unlock( &pool->run.mutex );
+    x264_pthread_cond_broadcast( &pool->cv_fill );
+    x264_pthread_mutex_unlock( &pool->mutex );
     for( int i = 0; i < pool->threads; i++ )
         x264_pthread_join( pool->thread_handle[i], NULL );
 
+    for( int i = 0; i < pool->threads; i++ )
+    {
+        x264_threadpool_worker_t *worker = pool->worker + i;
+        for( int j = 0; worker->list[j]; j++ )
+            x264_free( worker->list[j] );
+        x264_free( worker->list );
+        x264_pthread_mutex_destroy( &worker->mutex );
+    }
     x264_threadpool_list_delete( &pool->uninit );
-    x264_threadpool_list_delete( &pool->run );
     x264_threadpool_list_delete( &pool->done );
+    x264_pthread_cond_destroy( &pool->cv_fill );
+    x264_pthread_mutex_destroy( &pool->mutex );
+    x264_free( pool->worker );
     x264_free( pool->thread_handle );
     x264_free( pool );
 }
+
+static void x264_scheduler_thread( x264_scheduler_t *sched )
+{
+    if( sched->init_func )
+        sched->init_func( sched->init_arg );
+
+    x264_pthread_mutex_lock( &sched->mutex );
+    while( !sched->exit )
+    {
+        x264_threadpool_t *pool = NULL;
+        x264_threadpool_job_t *job = NULL;
+        for( int i = 0; i < sched->i_pools && !job; i++ )
+        {
+            int idx = (sched->next_pool + i) % sched->i_pools;
+            pool = sched->pools[idx];
+            if( pool->i_queue )
+            {
+                job = (void*)x264_frame_shift( (void*)pool->queue );
+                pool->i_queue--;
+                sched->next_pool = (idx + 1) % sched->i_pools;
+            }
+        }
+        if( !job )
+        {
+            x264_pthread_cond_wait( &sched->cv_fill, &sched->mutex );
+            continue;
+        }
+        x264_pthread_mutex_unlock( &sched->mutex );
+        job->ret = (void*)x264_stack_align( job->func, job->arg ); /* execute the function */
+        x264_sync_frame_list_push( &pool->done, (void*)job );
+        x264_pthread_mutex_lock( &sched->mutex );
+    }
+    x264_pthread_mutex_unlock( &sched->mutex );
+}
+
+int x264_scheduler_init( x264_scheduler_t **p_sched, int threads,
+                         void (*init_func)(void *), void *init_arg )
+{
+    if( threads <= 0 )
+        return -1;
+
+    x264_scheduler_t *sched;
+    CHECKED_MALLOCZERO( sched, sizeof(x264_scheduler_t) );
+    *p_sched = sched;
+
+    sched->init_func = init_func;
+    sched->init_arg  = init_arg;
+    sched->threads   = threads;
+    sched->refcount  = 1;
+
+    CHECKED_MALLOC( sched->thread_handle, sched->threads * sizeof(x264_pthread_t) );
+
+    if( x264_pthread_mutex_init( &sched->mutex, NULL ) ||
+        x264_pthread_cond_init( &sched->cv_fill, NULL ) )
+        goto fail;
+
+    for( int i = 0; i < sched->threads; i++ )
+        if( x264_pthread_create( sched->thread_handle+i, NULL, (void*)x264_scheduler_thread, sched ) )
+            goto fail;
+
+    return 0;
+fail:
+    return -1;
+}
+
+static void x264_scheduler_delete( x264_scheduler_t *sched )
+{
+    x264_pthread_mutex_lock( &sched->mutex );
+    sched->exit = 1;
+    x264_pthread_cond_broadcast( &sched->cv_fill );
+    x264_pthread_mutex_unlock( &sched->mutex );
+    for( int i = 0; i < sched->threads; i++ )
+        x264_pthread_join( sched->thread_handle[i], NULL );
+
+    x264_pthread_cond_destroy( &sched->cv_fill );
+    x264_pthread_mutex_destroy( &sched->mutex );
+    x264_free( sched->pools );
+    x264_free( sched->thread_handle );
+    x264_free( sched );
+}
+
+/* drops a reference; the workers exit with the last one, which is only
+ * dropped once every pool attached to the scheduler has been deleted. */
+void x264_scheduler_release( x264_scheduler_t *sched )
+{
+    x264_pthread_mutex_lock( &sched->mutex );
+    int refcount = --sched->refcount;
+    x264_pthread_mutex_unlock( &sched->mutex );
+    if( !refcount )
+        x264_scheduler_delete( sched );
+}
+
+/* like x264_threadpool_init, but the pool's jobs run on the scheduler's workers.
+ * threads is the number of jobs the pool can have in flight at once. */
+int x264_threadpool_init_shared( x264_threadpool_t **p_pool, int threads, x264_scheduler_t *sched )
+{
+    if( threads <= 0 )
+        return -1;
+
+    x264_threadpool_t *pool;
+    CHECKED_MALLOCZERO( pool, sizeof(x264_threadpool_t) );
+    *p_pool = pool;
+
+    pool->threads = threads;
+    CHECKED_MALLOCZERO( pool->queue, (pool->threads + 1) * sizeof(x264_threadpool_job_t*) );
+
+    if( x264_sync_frame_list_init( &pool->uninit, pool->threads ) ||
+        x264_sync_frame_list_init( &pool->done, pool->threads ) )
+        goto fail;
+
+    for( int i = 0; i < pool->threads; i++ )
+    {
+       x264_threadpool_job_t *job;
+       CHECKED_MALLOC( job, sizeof(x264_threadpool_job_t) );
+       x264_sync_frame_list_push( &pool->uninit, (void*)job );
+    }
+
+    x264_pthread_mutex_lock( &sched->mutex );
+    x264_threadpool_t **pools = x264_malloc( (sched->i_pools + 1) * sizeof(x264_threadpool_t*) );
+    if( pools )
+    {
+        memcpy( pools, sched->pools, sched->i_pools * sizeof(x264_threadpool_t*) );
+        pools[sched->i_pools++] = pool;
+        x264_free( sched->pools );
+        sched->pools = pools;
+        sched->refcount++;
+        pool->sched = sched;
+    }
+    x264_pthread_mutex_unlock( &sched->mutex );
+    if( !pools )
+        goto fail;
+
+    return 0;
+fail:
+    return -1;
+}
+
+static void x264_scheduler_detach( x264_threadpool_t *pool )
+{
+    x264_scheduler_t *sched = pool->sched;
+    x264_pthread_mutex_lock( &sched->mutex );
+    for( int i = 0; i < sched->i_pools; i++ )
+        if( sched->pools[i] == pool )
+        {
+            memmove( sched->pools+i, sched->pools+i+1, (sched->i_pools-i-1) * sizeof(x264_threadpool_t*) );
+            sched->i_pools--;
+            if( sched->next_pool > i )
+                sched->next_pool--;
+            break;
+        }
+    if( sched->next_pool >= sched->i_pools )
+        sched->next_pool = 0;
+    x264_pthread_mutex_unlock( &sched->mutex );
+    x264_scheduler_release( sched );
+}
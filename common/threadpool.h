@@ -33,11 +33,19 @@ int   x264_threadpool_init( x264_threadpool_t **p_pool, int threads,
                             void (*init_func)(void *), void *init_arg );
 void  x264_threadpool_run( x264_threadpool_t *pool, void *(*func)(void *), void *arg );
 void *x264_threadpool_wait( x264_threadpool_t *pool, void *arg );
+void  x264_threadpool_stats( x264_threadpool_t *pool, int64_t *steals, int64_t *idle_time );
 void  x264_threadpool_delete( x264_threadpool_t *pool );
+int   x264_scheduler_init( x264_scheduler_t **p_sched, int threads,
+                           void (*init_func)(void *), void *init_arg );
+void  x264_scheduler_release( x264_scheduler_t *sched );
+int   x264_threadpool_init_shared( x264_threadpool_t **p_pool, int threads, x264_scheduler_t *sched );
 #else
 #define x264_threadpool_init(p,t,f,a) -1
+#define x264_threadpool_init_shared(p,t,s) -1
+#define x264_scheduler_release(s)
 #define x264_threadpool_run(p,f,a)
 #define x264_threadpool_wait(p,a)     NULL
+#define x264_threadpool_stats(p,s,i)  (*(s) = *(i) = 0)
 #define x264_threadpool_delete(p)
 #endif
 
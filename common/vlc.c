@@ -801,8 +801,17 @@ static const vlc_t run_before[7][16] =
 vlc_large_t x264_level_token[7][LEVEL_TABLE_SIZE];
 uint32_t x264_run_before[1<<16];
 
+/* The tables are the same for every encoder in the process: only the first call fills them. */
 void x264_cavlc_init( x264_t *h )
 {
+    static UNUSED x264_pthread_mutex_t init_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
+    static int b_init = 0;
+    x264_pthread_mutex_lock( &init_mutex );
+    if( b_init )
+    {
+        x264_pthread_mutex_unlock( &init_mutex );
+        return;
+    }
     for( int i_suffix = 0; i_suffix < 7; i_suffix++ )
         for( int16_t level = -LEVEL_TABLE_SIZE/2; level < LEVEL_TABLE_SIZE/2; level++ )
         {
@@ -866,4 +875,6 @@ void x264_cavlc_init( x264_t *h )
         }
         x264_run_before[i] = (bits << 5) + size;
     }
+    b_init = 1;
+    x264_pthread_mutex_unlock( &init_mutex );
 }
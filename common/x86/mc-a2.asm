@@ -35,7 +35,7 @@ SECTION_RODATA
 filt_mul20: times 16 db 20
 filt_mul15: times 8 db 1, -5
 filt_mul51: times 8 db -5, 1
-hpel_shuf: db 0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15
+hpel_shuf: times 2 db 0,8,1,9,2,10,3,11,4,12,5,13,6,14,7,15
 deinterleave_shuf: db 0,2,4,6,8,10,12,14,1,3,5,7,9,11,13,15
 %if HIGH_BIT_DEPTH
 deinterleave_shuf32a: SHUFFLE_MASK_W 0,2,4,6,8,10,12,14
@@ -49,6 +49,14 @@ pd_16: times 4 dd 16
 pd_0f: times 4 dd 0xffff
 pf_inv256: times 8 dd 0.00390625
 
+; ymm constants for mbtree_propagate_list
+pd_3_ymm:   times 8 dd 3
+pd_31_ymm:  times 8 dd 31
+pd_32_ymm:  times 8 dd 32
+pd_512_ymm: times 8 dd 512
+pw_mbx_init: dw 0,0,1,0,2,0,3,0,4,0,5,0,6,0,7,0
+pw_mbx_inc:  times 8 dw 8,0
+
 pad10: times 8 dw    10*PIXEL_MAX
 pad20: times 8 dw    20*PIXEL_MAX
 pad30: times 8 dw    30*PIXEL_MAX
@@ -629,7 +637,7 @@ HPEL_H
     ;In real use, the prefetch seems to be a slight win.
     ;+16 is picked somewhat arbitrarily here based on the fact that even one
     ;loop iteration is going to take longer than the prefetch.
-    prefetcht0 [r1+r2*2+16]
+    prefetcht0 [r1+r2*2+mmsize]
 %if cpuflag(ssse3)
     mova m1, [r3]
     mova m2, [r3+r2]
@@ -662,15 +670,35 @@ HPEL_H
     packuswb %3, %4
     FILT_V2 m1, m2, m3, m4, m5, m6
 %endif
-    add       r3, 16
-    add       r1, 16
+    add       r3, mmsize
+    add       r1, mmsize
+%if mmsize==32
+    ; the words are interleaved across lanes, the packed bytes are not
+    vinserti128 %1, m1, xm4, 1
+    vperm2i128  %2, m1, m4, q0301
+%else
     mova      %1, m1
     mova      %2, m4
+%endif
     FILT_PACK m1, m4, 5, m15
     movntps  [r8+r4+%5], m1
 %endmacro
 
 %macro FILT_C 4
+%if mmsize==32
+    ; palignr only works within lanes, so build the straddling halves first
+    vperm2i128 m3, %2, %1, q0003
+    PALIGNR   m1, %2, m3, 12, m2
+    PALIGNR   m2, %2, m3, 14, m3
+    vperm2i128 %1, %3, %2, q0003
+    PALIGNR   m3, %1, %2, 4, m4
+    PALIGNR   m4, %1, %2, 2, m4
+    paddw     m3, m2
+    PALIGNR   m2, %1, %2, 6, m2
+    mova      %1, %3
+    paddw     m4, %2
+    paddw     %3, m2, m1
+%else
     PALIGNR   m1, %2, %1, 12, m2
     PALIGNR   m2, %2, %1, 14, %1
     PALIGNR   m3, %3, %2, 4, %1
@@ -680,6 +708,7 @@ HPEL_H
     PALIGNR   %3, %2, 6, m2
     paddw     m4, %2
     paddw     %3, m1
+%endif
     FILT_H    %3, m3, m4
 %endmacro
 
@@ -687,6 +716,9 @@ HPEL_H
     FILT_C %1, %2, %3, 6
     FILT_C %2, %1, %4, 6
     FILT_PACK %3, %4, 6, m15
+%if mmsize==32
+    vpermq    %3, %3, q3120
+%endif
     movntps   [r5+r4], %3
 %endmacro
 
@@ -700,11 +732,21 @@ HPEL_H
 %endmacro
 
 %macro DO_FILT_H 3
+%if mmsize==32
+    vperm2i128 m3, %2, %1, q0003
+    PALIGNR   m1, %2, m3, 14, m3
+    PALIGNR   m2, %2, m3, 15, m3
+    vperm2i128 m3, %3, %2, q0003
+    PALIGNR   m4, m3, %2, 1 , m3
+    PALIGNR   m5, m3, %2, 2 , m3
+    PALIGNR   m6, m3, %2, 3 , m3
+%else
     PALIGNR   m1, %2, %1, 14, m3
     PALIGNR   m2, %2, %1, 15, m3
     PALIGNR   m4, %3, %2, 1 , m3
     PALIGNR   m5, %3, %2, 2 , m3
     PALIGNR   m6, %3, %2, 3 , m3
+%endif
     mova      %1, %2
 %if cpuflag(ssse3)
     pmaddubsw m1, m12
@@ -737,9 +779,9 @@ HPEL_H
 ;-----------------------------------------------------------------------------
 cglobal hpel_filter, 7,9,16
     mov       r7, r3
-    sub      r5d, 16
+    sub      r5d, mmsize
     mov       r8, r1
-    and       r7, 15
+    and       r7, mmsize-1
     sub       r3, r7
     add       r0, r5
     add       r8, r5
@@ -751,12 +793,18 @@ cglobal hpel_filter, 7,9,16
     sub       r3, r2
     sub       r3, r2
     mov       r4, r7
+%if mmsize==32
+    vbroadcasti128 m15, [pw_16]
+    vbroadcasti128 m0, [filt_mul51]
+    vbroadcasti128 m12, [filt_mul15]
+    vbroadcasti128 m14, [filt_mul20]
+%elif cpuflag(ssse3)
     mova     m15, [pw_16]
-%if cpuflag(ssse3)
     mova      m0, [filt_mul51]
     mova     m12, [filt_mul15]
     mova     m14, [filt_mul20]
 %else
+    mova     m15, [pw_16]
     pxor      m0, m0
 %endif
 ;ALIGN 16
@@ -765,16 +813,16 @@ cglobal hpel_filter, 7,9,16
     DO_FILT_V m8, m7, m13, m12, 0
 ;ALIGN 16
 .loopx:
-    DO_FILT_V m6, m5, m11, m12, 16
+    DO_FILT_V m6, m5, m11, m12, mmsize
 .lastx:
     paddw   m15, m15 ; pw_32
     DO_FILT_C m9, m8, m7, m6
     psrlw   m15, 1 ; pw_16
-    movdqa   m7, m5
+    mova     m7, m5
     DO_FILT_H m10, m13, m11
-    add      r4, 16
+    add      r4, mmsize
     jl .loopx
-    cmp      r4, 16
+    cmp      r4, mmsize
     jl .lastx
 ; setup regs for next y
     sub      r4, r7
@@ -797,6 +845,8 @@ INIT_XMM ssse3
 HPEL
 INIT_XMM avx
 HPEL
+INIT_YMM avx2
+HPEL
 %endif ; ARCH_X86_64
 
 %undef movntq
@@ -1241,6 +1291,27 @@ cglobal integral_init4h_sse4, 3,4
     jl .loop
     REP_RET
 
+; mpsadbw works within lanes, so the ymm versions duplicate the middle
+; 8 pixels into both lanes: lane 0 gets pix[0..15], lane 1 gets pix[8..23].
+INIT_YMM avx2
+cglobal integral_init4h, 3,4
+    lea     r3, [r0+r2*2]
+    add     r1, r2
+    neg     r2
+    pxor    m4, m4
+.loop:
+    vpermq  m0, [r1+r2], q2110
+    vpermq  m1, [r1+r2+16], q2110
+    mpsadbw m0, m4, 0
+    mpsadbw m1, m4, 0
+    paddw   m0, [r0+r2*2]
+    paddw   m1, [r0+r2*2+32]
+    mova    [r3+r2*2   ], m0
+    mova    [r3+r2*2+32], m1
+    add     r2, 32
+    jl .loop
+    RET
+
 %macro INTEGRAL_INIT8H 0
 cglobal integral_init8h, 3,4
     lea     r3, [r0+r2*2]
@@ -1248,20 +1319,27 @@ cglobal integral_init8h, 3,4
     neg     r2
     pxor    m4, m4
 .loop:
+%if mmsize == 32
+    vpermq  m0, [r1+r2], q2110
+    vpermq  m1, [r1+r2+16], q2110
+    mpsadbw m2, m0, m4, 100100b
+    mpsadbw m3, m1, m4, 100100b
+%else
     movdqa  m0, [r1+r2]
     movdqa  m1, [r1+r2+16]
     palignr m1, m0, 8
     mpsadbw m2, m0, m4, 4
     mpsadbw m3, m1, m4, 4
+%endif
     mpsadbw m0, m4, 0
     mpsadbw m1, m4, 0
     paddw   m0, [r0+r2*2]
-    paddw   m1, [r0+r2*2+16]
+    paddw   m1, [r0+r2*2+mmsize]
     paddw   m0, m2
     paddw   m1, m3
-    movdqa  [r3+r2*2   ], m0
-    movdqa  [r3+r2*2+16], m1
-    add     r2, 16
+    mova    [r3+r2*2   ], m0
+    mova    [r3+r2*2+mmsize], m1
+    add     r2, mmsize
     jl .loop
     REP_RET
 %endmacro
@@ -1270,6 +1348,8 @@ INIT_XMM sse4
 INTEGRAL_INIT8H
 INIT_XMM avx
 INTEGRAL_INIT8H
+INIT_YMM avx2
+INTEGRAL_INIT8H
 %endif ; !HIGH_BIT_DEPTH
 
 %macro INTEGRAL_INIT_8V 0
@@ -1297,6 +1377,8 @@ INIT_MMX mmx
 INTEGRAL_INIT_8V
 INIT_XMM sse2
 INTEGRAL_INIT_8V
+INIT_YMM avx2
+INTEGRAL_INIT_8V
 
 ;-----------------------------------------------------------------------------
 ; void integral_init4v( uint16_t *sum8, uint16_t *sum4, intptr_t stride )
@@ -1374,13 +1456,49 @@ cglobal integral_init4v_ssse3, 3,5
     jl .loop
     REP_RET
 
+INIT_YMM avx2
+cglobal integral_init4v, 3,5
+    shl     r2, 1
+    add     r0, r2
+    add     r1, r2
+    lea     r3, [r0+r2*4]
+    lea     r4, [r0+r2*8]
+    neg     r2
+.loop:
+    mova    m2, [r0+r2]
+    movu    m0, [r0+r2+8]
+    mova    m4, [r4+r2]
+    movu    m1, [r4+r2+8]
+    paddw   m0, m2
+    paddw   m1, m4
+    mova    m3, [r3+r2]
+    psubw   m1, m0
+    psubw   m3, m2
+    mova  [r0+r2], m1
+    mova  [r1+r2], m3
+    add     r2, 32
+    jl .loop
+    RET
+
 %macro FILT8x4 7
+%if mmsize == 32
+    ; strides aren't necessarily a multiple of 32 bytes, so don't assume alignment
+    movu      %3, [r0+%7]
+    movu      %4, [r0+r5+%7]
+    pavgb     %3, %4
+    pavgb     %4, [r0+r5*2+%7]
+    vperm2i128 m6, %3, %1, q0201
+    palignr   %1, m6, %3, 1
+    vperm2i128 m6, %4, %2, q0201
+    palignr   %2, m6, %4, 1
+%else
     mova      %3, [r0+%7]
     mova      %4, [r0+r5+%7]
     pavgb     %3, %4
     pavgb     %4, [r0+r5*2+%7]
     PALIGNR   %1, %3, 1, m6
     PALIGNR   %2, %4, 1, m6
+%endif
 %if cpuflag(xop)
     pavgb     %1, %3
     pavgb     %2, %4
@@ -1573,7 +1691,17 @@ cglobal frame_init_lowres_core, 6,7,(12-4*(BIT_DEPTH/9)) ; 8 for HIGH_BIT_DEPTH,
 %endif
 .vloop:
     mov      r6d, r7m
-%ifnidn cpuname, mmx2
+%if mmsize == 32
+    movu      m0, [r0]
+    movu      m1, [r0+r5]
+    pavgb     m0, m1
+    pavgb     m1, [r0+r5*2]
+    ; odd end: filter the 32 columns ending at the right edge first, then
+    ; continue from the last multiple of 32 (see .odd_end)
+    test     r6d, 31
+    jz .hloop
+    mov      r6d, 1
+%elifnidn cpuname, mmx2
     mova      m0, [r0]
     mova      m1, [r0+r5]
     pavgb     m0, m1
@@ -1627,10 +1755,21 @@ cglobal frame_init_lowres_core, 6,7,(12-4*(BIT_DEPTH/9)) ; 8 for HIGH_BIT_DEPTH,
     packuswb  m4, m10
     packuswb  m5, m11
 %endif
+%if mmsize == 32
+    vpermq    m2, m2, q3120
+    vpermq    m3, m3, q3120
+    vpermq    m4, m4, q3120
+    vpermq    m5, m5, q3120
+    movu    [r1], m2
+    movu    [r2], m4
+    movu    [r3], m3
+    movu    [r4], m5
+%else
     mova    [r1], m2
     mova    [r2], m4
     mova    [r3], m3
     mova    [r4], m5
+%endif
 %elifidn cpuname, mmx2
     FILT8x2U  r1, r2, 0
     FILT8x2U  r3, r4, r5
@@ -1640,6 +1779,9 @@ cglobal frame_init_lowres_core, 6,7,(12-4*(BIT_DEPTH/9)) ; 8 for HIGH_BIT_DEPTH,
 %endif
     sub      r6d, mmsize
     jg .hloop
+%if mmsize == 32
+    jl .odd_end
+%endif
 %endif ; HIGH_BIT_DEPTH
 .skip:
     mov       r6, dst_gap
@@ -1653,6 +1795,27 @@ cglobal frame_init_lowres_core, 6,7,(12-4*(BIT_DEPTH/9)) ; 8 for HIGH_BIT_DEPTH,
     ADD      rsp, 2*gprsize
     emms
     RET
+%if mmsize == 32 && HIGH_BIT_DEPTH == 0
+.odd_end:
+    ; the block just written overlaps the next one by 32-(width&31) columns
+    mov      r6d, r7m
+    and      r6d, 31
+    neg       r6
+    add       r6, 32
+    lea       r0, [r0+r6*2]
+    add       r1, r6
+    add       r2, r6
+    add       r3, r6
+    add       r4, r6
+    mov      r6d, r7m
+    and      r6d, ~31
+    jz .skip
+    movu      m0, [r0]
+    movu      m1, [r0+r5]
+    pavgb     m0, m1
+    pavgb     m1, [r0+r5*2]
+    jmp .hloop
+%endif
 %endmacro ; FRAME_INIT_LOWRES
 
 INIT_MMX mmx2
@@ -1669,6 +1832,10 @@ INIT_XMM avx
 FRAME_INIT_LOWRES
 INIT_XMM xop
 FRAME_INIT_LOWRES
+%if ARCH_X86_64 && HIGH_BIT_DEPTH == 0
+INIT_YMM avx2
+FRAME_INIT_LOWRES
+%endif
 
 ;-----------------------------------------------------------------------------
 ; void mbtree_propagate_cost( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
@@ -1787,3 +1954,108 @@ cglobal mbtree_propagate_cost, 7,7,8
     add            r6, 16
     jl .loop
     REP_RET
+
+INIT_YMM avx2, fma3
+cglobal mbtree_propagate_cost, 7,7,8
+    add           r6d, r6d
+    lea            r0, [r0+r6*2]
+    add            r1, r6
+    add            r2, r6
+    add            r3, r6
+    add            r4, r6
+    neg            r6
+    vmovdqa      xmm5, [pw_3fff]
+    vbroadcastss ymm6, [r5]
+    vmulps       ymm6, ymm6, [pf_inv256]
+.loop:
+    vpmovzxwd    ymm0, [r2+r6]       ; intra
+    vpmovzxwd    ymm1, [r4+r6]       ; invq
+    vpmovzxwd    ymm2, [r1+r6]       ; prop
+    vpand        xmm3, xmm5, [r3+r6] ; inter
+    vpmovzxwd    ymm3, xmm3
+    vpmaddwd     ymm1, ymm1, ymm0    ; intra*invq
+    vpsubd       ymm4, ymm0, ymm3    ; intra - inter
+    vcvtdq2ps    ymm1, ymm1
+    vcvtdq2ps    ymm2, ymm2
+    vcvtdq2ps    ymm4, ymm4
+    vcvtdq2ps    ymm0, ymm0
+    vfmadd213ps  ymm1, ymm6, ymm2    ; prop + (intra*invq*fps_factor>>8)
+    vrcpps       ymm3, ymm0          ; 1 / intra 1st approximation
+    vmulps       ymm2, ymm0, ymm3    ; intra * (1/intra 1st approx)
+    vmulps       ymm1, ymm1, ymm4    ; (prop + (intra*invq*fps_factor>>8)) * (intra - inter)
+    vaddps       ymm4, ymm3, ymm3    ; 2 * (1/intra 1st approx)
+    vfnmadd231ps ymm4, ymm2, ymm3    ; 2nd approximation for 1/intra
+    vmulps       ymm1, ymm1, ymm4    ; / intra
+    vcvtps2dq    ymm1, ymm1
+    vmovdqu [r0+r6*2], ymm1
+    add            r6, 16
+    jl .loop
+    RET
+
+;-----------------------------------------------------------------------------
+; void mbtree_propagate_list_internal( int16_t (*mvs)[2], int *propagate_amount,
+;                                      uint16_t *lowres_costs, int16_t *output,
+;                                      int bipred_weight, int mb_y, int len )
+;-----------------------------------------------------------------------------
+; For each group of 8 macroblocks, output holds the target mb coordinates as
+; 8 (x,y) pairs, followed by the 8 amounts for each of the 4 bilinear targets,
+; saturated to 16 bits. len is rounded up to a multiple of 8.
+INIT_YMM avx2
+cglobal mbtree_propagate_list_internal, 7,7,8
+    vmovd         xm6, r4d
+    vpbroadcastd   m6, xm6           ; bipred_weight
+    vmovd         xm7, r5d
+    vpbroadcastd   m7, xm7
+    pslld          m7, 16
+    paddw          m7, [pw_mbx_init] ; mbx, mb_y
+    xor           r4d, r4d
+.loop:
+    vpmovzxwd      m0, [r2+r4*2]
+    psrld          m0, 14            ; lists_used
+    pcmpeqd        m0, [pd_3_ymm]
+    movu           m1, [r1+r4*4]     ; propagate_amount
+    pmulld         m2, m1, m6
+    paddd          m2, [pd_32_ymm]
+    psrad          m2, 6             ; bipred weighted amount
+    vpblendvb      m1, m1, m2, m0
+
+    movu           m0, [r0+r4*4]     ; mvs
+    psraw          m2, m0, 5
+    paddw          m2, m7
+    movu         [r3], m2            ; (x>>5)+mb_x, (y>>5)+mb_y
+    paddw          m7, [pw_mbx_inc]
+    pand           m2, m0, [pd_31_ymm] ; x&31
+    psrld          m0, 16
+    pand           m0, [pd_31_ymm]   ; y&31
+    movu           m3, [pd_32_ymm]
+    psubd          m4, m3, m2        ; 32-x
+    psubd          m3, m0            ; 32-y
+    ; all factors are < 2^16 with zeroed high words, so pmullw is enough here
+    pmullw         m5, m4, m3        ; idx0weight
+    pmullw         m3, m2            ; idx1weight
+    pmullw         m4, m0            ; idx2weight
+    pmullw         m2, m0            ; idx3weight
+    pmulld         m5, m1
+    pmulld         m3, m1
+    pmulld         m4, m1
+    pmulld         m2, m1
+    movu           m0, [pd_512_ymm]
+    paddd          m5, m0
+    paddd          m3, m0
+    paddd          m4, m0
+    paddd          m2, m0
+    psrad          m5, 10
+    psrad          m3, 10
+    psrad          m4, 10
+    psrad          m2, 10
+    packusdw       m5, m3
+    packusdw       m4, m2
+    vpermq         m5, m5, q3120
+    vpermq         m4, m4, q3120
+    movu      [r3+32], m5
+    movu      [r3+64], m4
+    add            r3, 96
+    add            r4, 8
+    cmp           r4d, r6d
+    jl .loop
+    RET
@@ -126,19 +126,28 @@ void *x264_memcpy_aligned_sse2( void *dst, const void *src, size_t n );
 void x264_memzero_aligned_mmx ( void *dst, size_t n );
 void x264_memzero_aligned_sse2( void *dst, size_t n );
 void x264_integral_init4h_sse4( uint16_t *sum, uint8_t *pix, intptr_t stride );
+void x264_integral_init4h_avx2( uint16_t *sum, uint8_t *pix, intptr_t stride );
 void x264_integral_init8h_sse4( uint16_t *sum, uint8_t *pix, intptr_t stride );
 void x264_integral_init8h_avx ( uint16_t *sum, uint8_t *pix, intptr_t stride );
+void x264_integral_init8h_avx2( uint16_t *sum, uint8_t *pix, intptr_t stride );
 void x264_integral_init4v_mmx  ( uint16_t *sum8, uint16_t *sum4, intptr_t stride );
 void x264_integral_init4v_sse2 ( uint16_t *sum8, uint16_t *sum4, intptr_t stride );
 void x264_integral_init4v_ssse3( uint16_t *sum8, uint16_t *sum4, intptr_t stride );
+void x264_integral_init4v_avx2 ( uint16_t *sum8, uint16_t *sum4, intptr_t stride );
 void x264_integral_init8v_mmx ( uint16_t *sum8, intptr_t stride );
 void x264_integral_init8v_sse2( uint16_t *sum8, intptr_t stride );
+void x264_integral_init8v_avx2( uint16_t *sum8, intptr_t stride );
 void x264_mbtree_propagate_cost_sse2( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
                                       uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
 void x264_mbtree_propagate_cost_avx ( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
                                       uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
 void x264_mbtree_propagate_cost_fma4( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
                                       uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
+void x264_mbtree_propagate_cost_avx2_fma3( int *dst, uint16_t *propagate_in, uint16_t *intra_costs,
+                                           uint16_t *inter_costs, uint16_t *inv_qscales, float *fps_factor, int len );
+void x264_mbtree_propagate_list_internal_avx2( int16_t (*mvs)[2], int *propagate_amount,
+                                               uint16_t *lowres_costs, int16_t *output,
+                                               int bipred_weight, int mb_y, int len );
 
 #define MC_CHROMA(cpu)\
 void x264_mc_chroma_##cpu( pixel *dstu, pixel *dstv, intptr_t i_dst, pixel *src, intptr_t i_src,\
@@ -160,6 +169,7 @@ LOWRES(sse2)
 LOWRES(ssse3)
 LOWRES(avx)
 LOWRES(xop)
+LOWRES(avx2)
 
 #define PIXEL_AVG_W(width,cpu)\
 void x264_pixel_avg2_w##width##_##cpu( pixel *, intptr_t, pixel *, intptr_t, pixel *, intptr_t );
@@ -443,6 +453,7 @@ HPEL(16, sse2_amd, mmx2, mmx2, sse2)
 void x264_hpel_filter_sse2 ( uint8_t *dsth, uint8_t *dstv, uint8_t *dstc, uint8_t *src, intptr_t stride, int width, int height, int16_t *buf );
 void x264_hpel_filter_ssse3( uint8_t *dsth, uint8_t *dstv, uint8_t *dstc, uint8_t *src, intptr_t stride, int width, int height, int16_t *buf );
 void x264_hpel_filter_avx  ( uint8_t *dsth, uint8_t *dstv, uint8_t *dstc, uint8_t *src, intptr_t stride, int width, int height, int16_t *buf );
+void x264_hpel_filter_avx2 ( uint8_t *dsth, uint8_t *dstv, uint8_t *dstc, uint8_t *src, intptr_t stride, int width, int height, int16_t *buf );
 #else
 HPEL(16, sse2, sse2, sse2, sse2)
 HPEL(16, ssse3, ssse3, ssse3, ssse3)
@@ -451,6 +462,63 @@ HPEL(16, avx, avx, avx, avx)
 HPEL(16, sse2_misalign, sse2, sse2_misalign, sse2)
 #endif // HIGH_BIT_DEPTH
 
+/* The asm computes the target coordinates and the 4 bilinear amounts for each
+ * macroblock, the scattered adds into ref_costs are done here. */
+static void x264_mbtree_propagate_list_avx2( x264_t *h, uint16_t *ref_costs, int16_t (*mvs)[2],
+                                             int *propagate_amount, uint16_t *lowres_costs,
+                                             int bipred_weight, int mb_y, int len, int list )
+{
+    int16_t *current = h->scratch_buffer2;
+    int stride = h->mb.i_mb_stride;
+    int width = h->mb.i_mb_width;
+    int height = h->mb.i_mb_height;
+
+    x264_mbtree_propagate_list_internal_avx2( mvs, propagate_amount, lowres_costs, current,
+                                              bipred_weight, mb_y, len );
+
+    for( int i = 0; i < len; i++ )
+    {
+#define CLIP_ADD(s,x) (s) = X264_MIN((s)+(x),(1<<16)-1)
+        int16_t *mb = current + (i>>3)*48 + (i&7)*2;
+        uint16_t *amount = (uint16_t*)current + (i>>3)*48 + 16 + (i&7);
+
+        if( propagate_amount[i] <= 0 || !(lowres_costs[i] & (1 << (list+LOWRES_COST_SHIFT))) )
+            continue;
+
+        int mbx = mb[0];
+        int mby = mb[1];
+        int idx0 = mbx + mby * stride;
+        int idx2 = idx0 + stride;
+
+        /* Shortcut for the simple/common case of zero MV */
+        if( !M32( mvs[i] ) )
+        {
+            CLIP_ADD( ref_costs[idx0], amount[0] );
+            continue;
+        }
+
+        if( mbx < width-1 && mby < height-1 && mbx >= 0 && mby >= 0 )
+        {
+            CLIP_ADD( ref_costs[idx0+0], amount[0] );
+            CLIP_ADD( ref_costs[idx0+1], amount[8] );
+            CLIP_ADD( ref_costs[idx2+0], amount[16] );
+            CLIP_ADD( ref_costs[idx2+1], amount[24] );
+        }
+        else
+        {
+            if( mbx < width && mby < height && mbx >= 0 && mby >= 0 )
+                CLIP_ADD( ref_costs[idx0+0], amount[0] );
+            if( mbx+1 < width && mby < height && mbx+1 >= 0 && mby >= 0 )
+                CLIP_ADD( ref_costs[idx0+1], amount[8] );
+            if( mbx < width && mby+1 < height && mbx >= 0 && mby+1 >= 0 )
+                CLIP_ADD( ref_costs[idx2+0], amount[16] );
+            if( mbx+1 < width && mby+1 < height && mbx+1 >= 0 && mby+1 >= 0 )
+                CLIP_ADD( ref_costs[idx2+1], amount[24] );
+        }
+#undef CLIP_ADD
+    }
+}
+
 static void x264_plane_copy_mmx2( pixel *dst, intptr_t i_dst, pixel *src, intptr_t i_src, int w, int h )
 {
     int c_w = 16/sizeof(pixel) - 1;
@@ -748,13 +816,31 @@ void x264_mc_init_mmx( int cpu, x264_mc_functions_t *pf )
 
     if( cpu&X264_CPU_XOP )
         pf->frame_init_lowres_core = x264_frame_init_lowres_core_xop;
+
+    if( cpu&X264_CPU_AVX2 )
+    {
+        pf->integral_init4h = x264_integral_init4h_avx2;
+        pf->integral_init8h = x264_integral_init8h_avx2;
+        pf->integral_init4v = x264_integral_init4v_avx2;
+        pf->integral_init8v = x264_integral_init8v_avx2;
+#if ARCH_X86_64
+        pf->hpel_filter = x264_hpel_filter_avx2;
+        pf->frame_init_lowres_core = x264_frame_init_lowres_core_avx2;
+#endif
+    }
 #endif // HIGH_BIT_DEPTH
 
     if( !(cpu&X264_CPU_AVX) )
         return;
     pf->mbtree_propagate_cost = x264_mbtree_propagate_cost_avx;
 
-    if( !(cpu&X264_CPU_FMA4) )
+    if( cpu&X264_CPU_FMA4 )
+        pf->mbtree_propagate_cost = x264_mbtree_propagate_cost_fma4;
+
+    if( !(cpu&X264_CPU_AVX2) )
         return;
-    pf->mbtree_propagate_cost = x264_mbtree_propagate_cost_fma4;
+    pf->mbtree_propagate_list = x264_mbtree_propagate_list_avx2;
+
+    if( cpu&X264_CPU_FMA3 )
+        pf->mbtree_propagate_cost = x264_mbtree_propagate_cost_avx2_fma3;
 }
@@ -34,6 +34,8 @@
 SECTION_RODATA 32
 mask_ff:   times 16 db 0xff
            times 16 db 0
+hmul_16p:  times 16 db 1
+           times 8 db 1, -1
 %if BIT_DEPTH == 10
 ssim_c1:   times 4 dd 6697.7856    ; .01*.01*1023*1023*64
 ssim_c2:   times 4 dd 3797644.4352 ; .03*.03*1023*1023*64*63
@@ -1051,6 +1053,69 @@ VAR2_8x8_SSSE3 16, 7
     SUMSUB_BA w, %1, %2, %3
 %endmacro
 
+%macro LOAD_DUP_4x16P_AVX2 8 ; 4*dst, 4*pointer
+    ; same as LOAD_DUP_4x8P, except that each lane gets one 8-pixel half of the row
+    movu      xm%3, %6
+    movu      xm%4, %8
+    movu      xm%1, %5
+    movu      xm%2, %7
+    vpermq     m%3, m%3, q1100
+    vpermq     m%4, m%4, q1100
+    vpermq     m%1, m%1, q1100
+    vpermq     m%2, m%2, q1100
+%endmacro
+
+%macro LOAD_SUMSUB_8x8P_AVX2 7 ; 4*dst, 2*tmp, mul
+; rows 0-3 go in the low lane, rows 4-7 in the high lane. expects r4=5*stride1, r5=5*stride2
+    movq      xm%1, [r0]
+    movq      xm%3, [r2]
+    movq      xm%2, [r0+r1]
+    movq      xm%4, [r2+r3]
+    vinserti128 m%1, m%1, [r0+4*r1], 1
+    vinserti128 m%3, m%3, [r2+4*r3], 1
+    vinserti128 m%2, m%2, [r0+r4], 1
+    vinserti128 m%4, m%4, [r2+r5], 1
+    punpcklqdq m%1, m%1
+    punpcklqdq m%3, m%3
+    punpcklqdq m%2, m%2
+    punpcklqdq m%4, m%4
+    DIFF_SUMSUB_SSSE3 %1, %3, %2, %4, %7
+    lea        r0, [r0+2*r1]
+    lea        r2, [r2+2*r3]
+
+    movq      xm%3, [r0]
+    movq      xm%5, [r2]
+    movq      xm%4, [r0+r1]
+    movq      xm%6, [r2+r3]
+    vinserti128 m%3, m%3, [r0+4*r1], 1
+    vinserti128 m%5, m%5, [r2+4*r3], 1
+    vinserti128 m%4, m%4, [r0+r4], 1
+    vinserti128 m%6, m%6, [r2+r5], 1
+    punpcklqdq m%3, m%3
+    punpcklqdq m%5, m%5
+    punpcklqdq m%4, m%4
+    punpcklqdq m%6, m%6
+    DIFF_SUMSUB_SSSE3 %3, %5, %4, %6, %7
+%endmacro
+
+%macro LOAD_SUMSUB_16x2P_AVX2 9 ; 2*dst, 2*tmp, mul, 4*ptr
+    vbroadcasti128 m%1, [%6]
+    vbroadcasti128 m%3, [%7]
+    vbroadcasti128 m%2, [%8]
+    vbroadcasti128 m%4, [%9]
+    DIFF_SUMSUB_SSSE3 %1, %3, %2, %4, %5
+%endmacro
+
+%macro LOAD_SUMSUB_16x4P_AVX2 7-10 r0, r2, 0
+; 4x dest, 2x tmp, 1x mul, [2* ptr], [increment?]
+    LOAD_SUMSUB_16x2P_AVX2 %1, %2, %5, %6, %7, %8, %9, %8+r1, %9+r3
+    LOAD_SUMSUB_16x2P_AVX2 %3, %4, %5, %6, %7, %8+2*r1, %9+2*r3, %8+r4, %9+r5
+%if %10
+    lea  %8, [%8+4*r1]
+    lea  %9, [%9+4*r3]
+%endif
+%endmacro
+
 %macro LOAD_SUMSUB_16x4P 10-13 r0, r2, none
 ; 8x dest, 1x tmp, 1x mul, [2* ptr] [2nd tmp]
     LOAD_SUMSUB_16P %1, %5, %2, %3, %10, %11, %12
@@ -3835,6 +3900,216 @@ INTRA_X9
 ; no xop INTRA8_X9. it's slower than avx on bulldozer. dunno why.
 %endif
 HADAMARD_AC_SSE2
+;-----------------------------------------------------------------------------
+; avx2: 16-wide blocks are split across the two lanes, 8-wide blocks are
+; stacked (rows 0-3 in the low lane, rows 4-7 in the high lane), so each
+; instruction covers twice as many pixels as the xmm versions above.
+;-----------------------------------------------------------------------------
+%if HIGH_BIT_DEPTH == 0
+%macro SATD_START_AVX2 2-3 0
+%if %3
+    vbroadcasti128 %2, [hmul_8p]
+    lea     r4, [5*r1]
+    lea     r5, [5*r3]
+%else
+    mova    %2, [hmul_16p]
+    lea     r4, [3*r1]
+    lea     r5, [3*r3]
+%endif
+    pxor    %1, %1
+%endmacro
+
+%macro SATD_END_AVX2 0
+    vextracti128 xm0, m6, 1
+    paddw   xm0, xm6
+    HADDW   xm0, xm1
+    vmovd   eax, xm0
+    RET
+%endmacro
+
+%define TRANS TRANS_SSE4
+INIT_YMM avx2
+cglobal pixel_satd_16x8_internal
+    LOAD_SUMSUB_16x4P_AVX2 0, 1, 2, 3, 4, 5, 7, r0, r2, 1
+    SATD_8x4_SSE cpuname, 0, 1, 2, 3, 4, 5, 6
+    LOAD_SUMSUB_16x4P_AVX2 0, 1, 2, 3, 4, 5, 7, r0, r2, 0
+    SATD_8x4_SSE cpuname, 0, 1, 2, 3, 4, 5, 6
+    ret
+
+cglobal pixel_satd_16x16, 4,6,8
+    SATD_START_AVX2 m6, m7
+    call pixel_satd_16x8_internal
+    lea  r0, [r0+4*r1]
+    lea  r2, [r2+4*r3]
+    call pixel_satd_16x8_internal
+    SATD_END_AVX2
+
+cglobal pixel_satd_16x8, 4,6,8
+    SATD_START_AVX2 m6, m7
+    call pixel_satd_16x8_internal
+    SATD_END_AVX2
+
+cglobal pixel_satd_8x8_internal
+    LOAD_SUMSUB_8x8P_AVX2 0, 1, 2, 3, 4, 5, 7
+    SATD_8x4_SSE cpuname, 0, 1, 2, 3, 4, 5, 6
+    ret
+
+cglobal pixel_satd_8x16, 4,6,8
+    SATD_START_AVX2 m6, m7, 1
+    call pixel_satd_8x8_internal
+    lea  r0, [r0+2*r1]
+    lea  r2, [r2+2*r3]
+    lea  r0, [r0+4*r1]
+    lea  r2, [r2+4*r3]
+    call pixel_satd_8x8_internal
+    SATD_END_AVX2
+
+cglobal pixel_satd_8x8, 4,6,8
+    SATD_START_AVX2 m6, m7, 1
+    call pixel_satd_8x8_internal
+    SATD_END_AVX2
+
+%if ARCH_X86_64
+%define LOAD_DUP_4x8P LOAD_DUP_4x16P_AVX2
+;-----------------------------------------------------------------------------
+; two side-by-side 8x8 sa8ds, one per lane
+;-----------------------------------------------------------------------------
+cglobal pixel_sa8d_16x8_internal
+    lea  r6, [r0+4*r1]
+    lea  r7, [r2+4*r3]
+    LOAD_SUMSUB_8x4P 0, 1, 2, 8, 5, 6, 7, r0, r2
+    LOAD_SUMSUB_8x4P 4, 5, 3, 9, 11, 6, 7, r6, r7
+    HADAMARD8_2D_HMUL 0, 1, 2, 8, 4, 5, 3, 9, 6, 11
+    paddw m0, m1
+    paddw m0, m2
+    paddw m0, m8
+    SAVE_MM_PERMUTATION
+    ret
+
+cglobal pixel_sa8d_16x16, 4,8,12
+    lea  r4, [3*r1]
+    lea  r5, [3*r3]
+    vbroadcasti128 m7, [hmul_8p]
+    call pixel_sa8d_16x8_internal ; pix[0], pix[8]
+    lea  r0, [r0+8*r1]
+    lea  r2, [r2+8*r3]
+    mova m10, m0
+    call pixel_sa8d_16x8_internal ; pix[8*stride], pix[8*stride+8]
+    paddusw m0, m10
+    vextracti128 xm1, m0, 1
+    paddusw xm0, xm1
+    HADDUW xm0, xm1
+    vmovd eax, xm0
+    add  eax, 1
+    shr  eax, 1
+    RET
+
+;-----------------------------------------------------------------------------
+; in:  r0=pix, r1=stride, r2=stride*3, m11=mask_ac4b, m12=mask_ac8
+; out: m13+=sa8d, m14+=satd, r0+=stride*4
+; same algorithm as hadamard_ac_8x8, on two side-by-side 8x8s at once.
+;-----------------------------------------------------------------------------
+cglobal hadamard_ac_16x8
+    vbroadcasti128 m7, [hmul_8p]
+    LOAD_INC_8x4W 0, 1, 2, 3, 7
+    HADAMARD4_V 0, 1, 2, 3, 4
+    mova      m8, m1
+    SWAP 1, 7
+    LOAD_INC_8x4W 4, 5, 6, 7, 1
+    HADAMARD4_V 4, 5, 6, 7, 1
+    mova      m1, m8
+    mova      m8, m6
+    mova      m9, m7
+    HADAMARD 1, sumsub, 0, 1, 6, 7
+    HADAMARD 1, sumsub, 2, 3, 6, 7
+    mova      m6, m8
+    mova      m7, m9
+    mova      m8, m1
+    mova      m9, m0
+    HADAMARD 1, sumsub, 4, 5, 1, 0
+    HADAMARD 1, sumsub, 6, 7, 1, 0
+    mova      m0, m9
+    mova      m9, m2
+    mova     m10, m3
+    ABSW      m1, m0, m0
+    ABSW      m2, m4, m4
+    ABSW      m3, m5, m5
+    paddw     m1, m2
+    SUMSUB_BA w, 0, 4
+    pand      m1, m11
+    ABSW      m2, m8
+    paddw     m1, m3
+    ABSW      m3, m9
+    paddw     m1, m2
+    ABSW      m2, m10
+    paddw     m1, m3
+    ABSW      m3, m6, m6
+    paddw     m1, m2
+    ABSW      m2, m7, m7
+    paddw     m1, m3
+    mova      m3, m7
+    paddw     m1, m2
+    mova      m2, m6
+    psubw     m7, m10
+    paddw     m3, m10
+    paddusw  m14, m1 ; satd
+    mova      m1, m5
+    psubw     m6, m9
+    paddw     m2, m9
+    psubw     m5, m8
+    paddw     m1, m8
+    mova      m9, m4
+    HADAMARD 2, amax, 3, 7, 4
+    HADAMARD 2, amax, 2, 6, 7, 4
+    mova      m4, m9
+    HADAMARD 2, amax, 1, 5, 6, 7
+    HADAMARD 2, sumsub, 0, 4, 5, 6
+    paddw     m2, m3
+    paddw     m2, m1
+    paddw     m2, m2
+    ABSW      m4, m4, m7
+    pand      m0, m12
+    ABSW      m0, m0, m7
+    paddw     m2, m4
+    paddw     m2, m0
+    paddusw  m13, m2 ; sa8d
+    ret
+
+; struct { int satd, int sa8d; } pixel_hadamard_ac_16x16( uint8_t *pix, int stride )
+%macro HADAMARD_AC_WXH_AVX2 2
+cglobal pixel_hadamard_ac_%1x%2, 2,3,15
+    lea  r2, [r1*3]
+    vbroadcasti128 m11, [mask_ac4b]
+    vbroadcasti128 m12, [mask_ac8]
+    pxor m13, m13
+    pxor m14, m14
+    call hadamard_ac_16x8
+%if %2==16
+    lea  r0, [r0+r1*4]
+    call hadamard_ac_16x8
+%endif
+    vextracti128 xm0, m13, 1
+    vextracti128 xm1, m14, 1
+    paddusw xm0, xm13
+    paddusw xm1, xm14
+%if %1*%2 == 256
+    psrlw   xm0, 1
+%endif
+    HADDUW  xm0, xm2
+    HADDW   xm1, xm3
+    vmovd   edx, xm0
+    vmovd   eax, xm1
+    shr     edx, 2 - (%1*%2 >> 8)
+    shr     eax, 1
+    shl     rdx, 32
+    add     rax, rdx
+    RET
+%endmacro
+
+HADAMARD_AC_WXH_AVX2 16, 16
+HADAMARD_AC_WXH_AVX2 16,  8
+%endif ; ARCH_X86_64
+%endif ; !HIGH_BIT_DEPTH
 
 ;=============================================================================
 ; SSIM
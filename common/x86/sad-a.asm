@@ -1221,6 +1221,135 @@ SAD_X_SSE2 3, 16,  8
 SAD_X_SSE2 4, 16, 16
 SAD_X_SSE2 4, 16,  8
 
+;-----------------------------------------------------------------------------
+; avx2: two rows per register, one in each lane.
+; fenc rows are contiguous (FENC_STRIDE == 16), so both come in one load.
+;-----------------------------------------------------------------------------
+%macro SAD_X3_2x16P_AVX2 1
+    movu    m3, [r0]
+    movu   xm4, [r1]
+    movu   xm5, [r2]
+    movu   xm6, [r3]
+    vinserti128 m4, m4, [r1+r4], 1
+    vinserti128 m5, m5, [r2+r4], 1
+    vinserti128 m6, m6, [r3+r4], 1
+%if %1
+    psadbw  m0, m4, m3
+    psadbw  m1, m5, m3
+    psadbw  m2, m6, m3
+%else
+    psadbw  m4, m3
+    psadbw  m5, m3
+    psadbw  m6, m3
+    paddw   m0, m4
+    paddw   m1, m5
+    paddw   m2, m6
+%endif
+    add     r0, 2*FENC_STRIDE
+    lea     r1, [r1+2*r4]
+    lea     r2, [r2+2*r4]
+    lea     r3, [r3+2*r4]
+%endmacro
+
+%macro SAD_X4_2x16P_AVX2 1
+    movu    m4, [r0]
+    movu   xm5, [r1]
+    movu   xm6, [r2]
+    movu   xm7, [r3]
+    vinserti128 m5, m5, [r1+r5], 1
+    vinserti128 m6, m6, [r2+r5], 1
+    vinserti128 m7, m7, [r3+r5], 1
+%if %1
+    psadbw  m0, m5, m4
+    psadbw  m1, m6, m4
+    psadbw  m2, m7, m4
+%else
+    psadbw  m5, m4
+    psadbw  m6, m4
+    psadbw  m7, m4
+    paddw   m0, m5
+    paddw   m1, m6
+    paddw   m2, m7
+%endif
+    movu   xm5, [r4]
+    vinserti128 m5, m5, [r4+r5], 1
+%if %1
+    psadbw  m3, m5, m4
+%else
+    psadbw  m5, m4
+    paddw   m3, m5
+%endif
+    add     r0, 2*FENC_STRIDE
+    lea     r1, [r1+2*r5]
+    lea     r2, [r2+2*r5]
+    lea     r3, [r3+2*r5]
+    lea     r4, [r4+2*r5]
+%endmacro
+
+%macro SAD_X3_END_AVX2 0
+    vextracti128 xm4, m0, 1
+    vextracti128 xm5, m1, 1
+    vextracti128 xm6, m2, 1
+    paddw   xm0, xm4
+    paddw   xm1, xm5
+    paddw   xm2, xm6
+    movhlps xm4, xm0
+    movhlps xm5, xm1
+    movhlps xm6, xm2
+    paddw   xm0, xm4
+    paddw   xm1, xm5
+    paddw   xm2, xm6
+%if UNIX64
+    vmovd [r5+0], xm0
+    vmovd [r5+4], xm1
+    vmovd [r5+8], xm2
+%else
+    mov      r0, r5mp
+    vmovd [r0+0], xm0
+    vmovd [r0+4], xm1
+    vmovd [r0+8], xm2
+%endif
+    RET
+%endmacro
+
+%macro SAD_X4_END_AVX2 0
+    mov      r0, r6mp
+    psllq    m1, 32
+    psllq    m3, 32
+    paddw    m0, m1
+    paddw    m2, m3
+    vextracti128 xm1, m0, 1
+    vextracti128 xm3, m2, 1
+    paddw   xm0, xm1
+    paddw   xm2, xm3
+    movhlps xm1, xm0
+    movhlps xm3, xm2
+    paddw   xm0, xm1
+    paddw   xm2, xm3
+    vmovq [r0+0], xm0
+    vmovq [r0+8], xm2
+    RET
+%endmacro
+
+;-----------------------------------------------------------------------------
+; void pixel_sad_x3_16x16( uint8_t *fenc, uint8_t *pix0, uint8_t *pix1,
+;                          uint8_t *pix2, intptr_t i_stride, int scores[3] )
+;-----------------------------------------------------------------------------
+%macro SAD_X_AVX2 3
+cglobal pixel_sad_x%1_%2x%3, 2+%1,2+%1,8
+    SAD_X%1_2x%2P_AVX2 1
+%rep %3/2-1
+    SAD_X%1_2x%2P_AVX2 0
+%endrep
+    SAD_X%1_END_AVX2
+%endmacro
+
+INIT_YMM avx2
+SAD_X_AVX2 3, 16, 16
+SAD_X_AVX2 3, 16,  8
+SAD_X_AVX2 4, 16, 16
+SAD_X_AVX2 4, 16,  8
+
 
 
 ;=============================================================================
@@ -691,6 +691,30 @@ SECTION .note.GNU-stack noalloc noexec nowrite progbits
 
 INIT_XMM
 
+; xm# and ym# refer to the xmm/ymm halves of whatever register m# currently
+; names, so they track SWAP/PERMUTE. Mostly useful for the xmm tail of an
+; avx2 function, e.g. "vextracti128 xm1, m0, 1".
+%macro DECLARE_MMCAST 1
+    %define  mmmm%1   mm%1
+    %define  mmxmm%1  mm%1
+    %define  mmymm%1  mm%1
+    %define xmmmm%1   mm%1
+    %define xmmxmm%1 xmm%1
+    %define xmmymm%1 xmm%1
+    %define ymmmm%1   mm%1
+    %define ymmxmm%1 ymm%1
+    %define ymmymm%1 ymm%1
+    %define xm%1 xmm %+ m%1
+    %define ym%1 ymm %+ m%1
+%endmacro
+
+%assign i 0
+%rep 16
+    DECLARE_MMCAST i
+%assign i i+1
+%endrep
+%undef i
+
 ; I often want to use macros that permute their arguments. e.g. there's no
 ; efficient way to implement butterfly or transpose or dct without swapping some
 ; arguments.
@@ -851,7 +875,9 @@ INIT_XMM
     %else
         %define %%sizeofreg mmsize
     %endif
-    %if %%sizeofreg==32
+    ; In ymm functions, VEX-encode xmm ops too: mixing legacy SSE with dirty
+    ; upper halves costs a state transition on every switch.
+    %if %%sizeofreg==32 || mmsize==32
         %if %4>=3
             v%1 %5, %6, %7
         %else
@@ -52,7 +52,7 @@
 
 
 %macro SBUTTERFLY 4
-%if avx_enabled && mmsize == 16
+%if avx_enabled && mmsize >= 16
     punpckh%1 m%4, m%2, m%3
     punpckl%1 m%2, m%3
 %else
@@ -275,7 +275,7 @@
 %endmacro
 
 %macro HADDD 2 ; sum junk
-%if mmsize == 16
+%if mmsize >= 16 ; ymm functions pass the xm# halves
     movhlps %2, %1
     paddd   %1, %2
 %endif
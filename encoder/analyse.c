@@ -274,67 +274,124 @@ static const uint8_t i_sub_mb_p_cost_table[4] =
 
 static void x264_analyse_update_cache( x264_t *h, x264_mb_analysis_t *a );
 
+/* The mv, ref and i4x4 mode cost tables depend only on the qp, so they're shared
+ * by every encoder in the process.  Each qp's tables are built the first time an
+ * encoder uses that qp and are never written again; they're freed once the last
+ * encoder using them is closed.  The mutex guards building and the refcount. */
 static uint16_t x264_cost_ref[QP_MAX+1][3][33];
-static UNUSED x264_pthread_mutex_t cost_ref_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
+static UNUSED x264_pthread_mutex_t cost_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
 static uint16_t x264_cost_i4x4_mode[(QP_MAX+2)*32];
+static uint16_t *x264_cost_mv[QP_MAX+1];
+static uint16_t *x264_cost_mv_fpel[QP_MAX+1][4];
+static float *x264_cost_logs;
+static int x264_cost_users;
 
-float *x264_analyse_prepare_costs( x264_t *h )
-{
-    float *logs = x264_malloc( (2*4*2048+1)*sizeof(float) );
-    if( !logs )
-        return NULL;
-    logs[0] = 0.718f;
-    for( int i = 1; i <= 2*4*2048; i++ )
-        logs[i] = log2f(i+1)*2 + 1.718f;
-    return logs;
-}
-
-int x264_analyse_init_costs( x264_t *h, float *logs, int qp )
+static int x264_analyse_build_costs( int qp, int b_fpel )
 {
     int lambda = x264_lambda_tab[qp];
-    if( h->cost_mv[qp] )
-        return 0;
-    /* factor of 4 from qpel, 2 from sign, and 2 because mv can be opposite from mvp */
-    CHECKED_MALLOC( h->cost_mv[qp], (4*4*2048 + 1) * sizeof(uint16_t) );
-    h->cost_mv[qp] += 2*4*2048;
-    for( int i = 0; i <= 2*4*2048; i++ )
-    {
-        h->cost_mv[qp][-i] =
-        h->cost_mv[qp][i]  = X264_MIN( lambda * logs[i] + .5f, (1<<16)-1 );
-    }
-    x264_pthread_mutex_lock( &cost_ref_mutex );
-    for( int i = 0; i < 3; i++ )
-        for( int j = 0; j < 33; j++ )
-            x264_cost_ref[qp][i][j] = X264_MIN( i ? lambda * bs_size_te( i, j ) : 0, (1<<16)-1 );
-    x264_pthread_mutex_unlock( &cost_ref_mutex );
-    if( h->param.analyse.i_me_method >= X264_ME_ESA && !h->cost_mv_fpel[qp][0] )
+    if( !x264_cost_mv[qp] )
+    {
+        /* factor of 4 from qpel, 2 from sign, and 2 because mv can be opposite from mvp */
+        uint16_t *cost_mv;
+        CHECKED_MALLOC( cost_mv, (4*4*2048 + 1) * sizeof(uint16_t) );
+        cost_mv += 2*4*2048;
+        for( int i = 0; i <= 2*4*2048; i++ )
+        {
+            cost_mv[-i] =
+            cost_mv[i]  = X264_MIN( lambda * x264_cost_logs[i] + .5f, (1<<16)-1 );
+        }
+        for( int i = 0; i < 3; i++ )
+            for( int j = 0; j < 33; j++ )
+                x264_cost_ref[qp][i][j] = X264_MIN( i ? lambda * bs_size_te( i, j ) : 0, (1<<16)-1 );
+        uint16_t *cost_i4x4_mode = (uint16_t*)ALIGN((intptr_t)x264_cost_i4x4_mode,64) + qp*32;
+        for( int i = 0; i < 17; i++ )
+            cost_i4x4_mode[i] = 3*lambda*(i!=8);
+        x264_cost_mv[qp] = cost_mv;
+    }
+    if( b_fpel && !x264_cost_mv_fpel[qp][0] )
     {
         for( int j = 0; j < 4; j++ )
         {
-            CHECKED_MALLOC( h->cost_mv_fpel[qp][j], (4*2048 + 1) * sizeof(uint16_t) );
-            h->cost_mv_fpel[qp][j] += 2*2048;
+            uint16_t *cost_mv_fpel;
+            CHECKED_MALLOC( cost_mv_fpel, (4*2048 + 1) * sizeof(uint16_t) );
+            cost_mv_fpel += 2*2048;
             for( int i = -2*2048; i < 2*2048; i++ )
-                h->cost_mv_fpel[qp][j][i] = h->cost_mv[qp][i*4+j];
+                cost_mv_fpel[i] = x264_cost_mv[qp][i*4+j];
+            x264_cost_mv_fpel[qp][j] = cost_mv_fpel;
         }
     }
-    uint16_t *cost_i4x4_mode = (uint16_t*)ALIGN((intptr_t)x264_cost_i4x4_mode,64) + qp*32;
-    for( int i = 0; i < 17; i++ )
-        cost_i4x4_mode[i] = 3*lambda*(i!=8);
     return 0;
 fail:
     return -1;
 }
 
-void x264_analyse_free_costs( x264_t *h )
+/* Point h at the shared tables for qp, building them on first use. */
+static int x264_analyse_load_qp_costs( x264_t *h, int qp )
 {
+    int b_fpel = h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA;
+    x264_pthread_mutex_lock( &cost_mutex );
+    int ret = x264_analyse_build_costs( qp, b_fpel );
+    x264_pthread_mutex_unlock( &cost_mutex );
+    if( ret < 0 )
+        return -1;
+    h->cost_mv[qp] = x264_cost_mv[qp];
+    for( int j = 0; j < 4; j++ )
+        h->cost_mv_fpel[qp][j] = x264_cost_mv_fpel[qp][j];
+    return 0;
+}
+
+static void x264_analyse_release_costs( void )
+{
+    if( --x264_cost_users )
+        return;
     for( int i = 0; i < QP_MAX+1; i++ )
     {
-        if( h->cost_mv[i] )
-            x264_free( h->cost_mv[i] - 2*4*2048 );
-        if( h->cost_mv_fpel[i][0] )
+        if( x264_cost_mv[i] )
+            x264_free( x264_cost_mv[i] - 2*4*2048 );
+        if( x264_cost_mv_fpel[i][0] )
             for( int j = 0; j < 4; j++ )
-                x264_free( h->cost_mv_fpel[i][j] - 2*2048 );
+                x264_free( x264_cost_mv_fpel[i][j] - 2*2048 );
     }
+    memset( x264_cost_mv, 0, sizeof(x264_cost_mv) );
+    memset( x264_cost_mv_fpel, 0, sizeof(x264_cost_mv_fpel) );
+    x264_free( x264_cost_logs );
+    x264_cost_logs = NULL;
+}
+
+int x264_analyse_init_costs( x264_t *h )
+{
+    x264_pthread_mutex_lock( &cost_mutex );
+    x264_cost_users++;
+    if( !x264_cost_logs )
+    {
+        CHECKED_MALLOC( x264_cost_logs, (2*4*2048+1)*sizeof(float) );
+        x264_cost_logs[0] = 0.718f;
+        for( int i = 1; i <= 2*4*2048; i++ )
+            x264_cost_logs[i] = log2f(i+1)*2 + 1.718f;
+    }
+    x264_pthread_mutex_unlock( &cost_mutex );
+
+    /* The lookahead always needs its qp; the others are loaded as they come up. */
+    if( x264_analyse_load_qp_costs( h, X264_LOOKAHEAD_QP ) < 0 )
+    {
+        x264_pthread_mutex_lock( &cost_mutex );
+        goto fail;
+    }
+    return 0;
+fail:
+    x264_analyse_release_costs();
+    x264_pthread_mutex_unlock( &cost_mutex );
+    return -1;
+}
+
+void x264_analyse_free_costs( x264_t *h )
+{
+    /* Only encoders that got as far as loading the lookahead's tables hold a reference. */
+    if( !h->cost_mv[X264_LOOKAHEAD_QP] )
+        return;
+    x264_pthread_mutex_lock( &cost_mutex );
+    x264_analyse_release_costs();
+    x264_pthread_mutex_unlock( &cost_mutex );
 }
 
 void x264_analyse_weight_frame( x264_t *h, int end )
@@ -368,6 +425,16 @@ void x264_analyse_weight_frame( x264_t *h, int end )
 /* initialize an array of lambda*nbits for all possible mvs */
 static void x264_mb_analyse_load_costs( x264_t *h, x264_mb_analysis_t *a )
 {
+    int b_fpel = h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA;
+    if( (!h->cost_mv[a->i_qp] || (b_fpel && !h->cost_mv_fpel[a->i_qp][0]))
+        && x264_analyse_load_qp_costs( h, a->i_qp ) < 0 )
+    {
+        /* Out of memory: fall back to the lookahead's tables, which always exist. */
+        x264_log( h, X264_LOG_WARNING, "failed to allocate mv costs for qp %d\n", a->i_qp );
+        h->cost_mv[a->i_qp] = h->cost_mv[X264_LOOKAHEAD_QP];
+        for( int j = 0; j < 4; j++ )
+            h->cost_mv_fpel[a->i_qp][j] = h->cost_mv_fpel[X264_LOOKAHEAD_QP][j];
+    }
     a->p_cost_mv = h->cost_mv[a->i_qp];
     a->p_cost_ref[0] = x264_cost_ref[a->i_qp][x264_clip3(h->sh.i_num_ref_idx_l0_active-1,0,2)];
     a->p_cost_ref[1] = x264_cost_ref[a->i_qp][x264_clip3(h->sh.i_num_ref_idx_l1_active-1,0,2)];
@@ -481,7 +548,9 @@ static void x264_mb_analyse_init( x264_t *h, x264_mb_analysis_t *a, int qp )
                 for( int i = (h->sh.i_type == SLICE_TYPE_B); i >= 0; i-- )
                     for( int j = 0; j < h->i_ref[i]; j++ )
                     {
+                        int64_t start = x264_stage_start( h );
                         x264_frame_cond_wait( h->fref[i][j]->orig, thresh );
+                        x264_stage_end( h, X264_STAGE_WAIT, start );
                         thread_mvy_range = X264_MIN( thread_mvy_range, h->fref[i][j]->orig->i_lines_completed - pix_y );
                     }
 
@@ -1334,6 +1403,7 @@ static void x264_intra_rd_refine( x264_t *h, x264_mb_analysis_t *a )
     else \
         (m)->p_fref[4] = &(src)[4][(xoff)+((yoff)>>CHROMA_V_SHIFT)*(m)->i_stride[1]]; \
     (m)->integral = &h->mb.pic.p_integral[list][ref][(xoff)+(yoff)*(m)->i_stride[0]]; \
+    (m)->hash = h->mb.pic.p_hash[list][ref]; \
     (m)->weight = x264_weight_none; \
     (m)->i_ref = ref; \
 }
@@ -1349,7 +1419,7 @@ static void x264_mb_analyse_inter_p16x16( x264_t *h, x264_mb_analysis_t *a )
 {
     x264_me_t m;
     int i_mvc;
-    ALIGNED_4( int16_t mvc[8][2] );
+    ALIGNED_4( int16_t mvc[10][2] );
     int i_halfpel_thresh = INT_MAX;
     int *p_halfpel_thresh = (a->b_early_terminate && h->mb.pic.i_fref[0]>1) ? &i_halfpel_thresh : NULL;
 
@@ -1377,7 +1447,18 @@ static void x264_mb_analyse_inter_p16x16( x264_t *h, x264_mb_analysis_t *a )
         else
         {
             x264_mb_predict_mv_ref16x16( h, 0, i_ref, mvc, &i_mvc );
+
+            /* When the lookahead's motion lands within a pixel of the spatial
+             * predictor, the true vector is almost always close by: a wide
+             * search would mostly spend SADs confirming it. */
+            ALIGNED_4( int16_t lowres_mv[2] );
+            if( h->param.analyse.b_fast_lowres_me
+                && x264_mb_predict_mv_lowres( h, 0, i_ref, lowres_mv )
+                && abs( lowres_mv[0] - m.mvp[0] ) <= 4
+                && abs( lowres_mv[1] - m.mvp[1] ) <= 4 )
+                h->mb.i_me_range = X264_MAX( h->param.analyse.i_me_range >> 1, 4 );
             x264_me_search_ref( h, &m, mvc, i_mvc, p_halfpel_thresh );
+            h->mb.i_me_range = h->param.analyse.i_me_range;
         }
 
         /* save mv for predicting neighbors */
@@ -1989,7 +2070,7 @@ static void x264_mb_analyse_inter_b16x16( x264_t *h, x264_mb_analysis_t *a )
     pixel *src0, *src1;
     intptr_t stride0 = 16, stride1 = 16;
     int i_ref, i_mvc;
-    ALIGNED_4( int16_t mvc[9][2] );
+    ALIGNED_4( int16_t mvc[10][2] );
     int try_skip = a->b_try_skip;
     int list1_skipped = 0;
     int i_halfpel_thresh[2] = {INT_MAX, INT_MAX};
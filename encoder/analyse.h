@@ -27,8 +27,7 @@
 #ifndef X264_ANALYSE_H
 #define X264_ANALYSE_H
 
-float *x264_analyse_prepare_costs( x264_t *h );
-int x264_analyse_init_costs( x264_t *h, float *logs, int qp );
+int x264_analyse_init_costs( x264_t *h );
 void x264_analyse_free_costs( x264_t *h );
 void x264_analyse_weight_frame( x264_t *h, int end );
 void x264_macroblock_analyse( x264_t *h );
@@ -43,5 +42,8 @@ int  x264_lookahead_is_empty( x264_t *h );
 void x264_lookahead_put_frame( x264_t *h, x264_frame_t *frame );
 void x264_lookahead_get_frames( x264_t *h );
 void x264_lookahead_delete( x264_t *h );
+int  x264_lookahead_share( x264_t *leader, x264_t *follower );
+void x264_lookahead_share_put( x264_lookahead_share_t *share, int i_frame, int i_type, int b_final );
+int  x264_lookahead_share_get( x264_lookahead_share_t *share, int i_frame, int b_final, int b_wait );
 
 #endif
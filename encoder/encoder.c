@@ -44,6 +44,9 @@
 static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
                                    x264_nal_t **pp_nal, int *pi_nal,
                                    x264_picture_t *pic_out );
+static int  x264_filter_thread_init( x264_t *h );
+static void x264_filter_thread_delete( x264_t *h );
+static int  x264_metrics_init( x264_t *h );
 
 /****************************************************************************
  *
@@ -404,6 +407,16 @@ static void x264_lookahead_thread_init( x264_t *h )
         x264_cpu_mask_misalign_sse();
 #endif
 }
+
+static void x264_scheduler_thread_init( void *arg )
+{
+#if HAVE_MMX
+    /* Shared workers serve encoders with any cpu flags; the misalign mask
+     * doesn't change results, so set it whenever the cpu supports it. */
+    if( x264_cpu_detect()&X264_CPU_SSE_MISALIGN )
+        x264_cpu_mask_misalign_sse();
+#endif
+}
 #endif
 
 /****************************************************************************
@@ -524,6 +537,17 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         h->param.b_sliced_threads = 0;
         h->param.i_lookahead_threads = 1;
     }
+    h->param.b_lookahead_batch &= h->param.i_lookahead_threads > 1;
+#if HAVE_THREAD
+    if( h->param.b_filter_thread && (h->param.b_sliced_threads || PARAM_INTERLACED) )
+    {
+        x264_log( h, X264_LOG_WARNING, "filter thread is not supported with %s\n",
+                  h->param.b_sliced_threads ? "sliced threads" : "interlacing" );
+        h->param.b_filter_thread = 0;
+    }
+#else
+    h->param.b_filter_thread = 0;
+#endif
     h->i_thread_frames = h->param.b_sliced_threads ? 1 : h->param.i_threads;
     if( h->i_thread_frames > 1 )
         h->param.nalu_process = NULL;
@@ -757,16 +781,65 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         x264_log( h, X264_LOG_WARNING, "lookaheadless mb-tree requires intra refresh or infinite keyint\n" );
         h->param.rc.b_mb_tree = 0;
     }
+    if( !h->param.rc.b_stat_read )
+        h->param.rc.i_pass2_window = 0;
+    h->param.rc.i_pass2_window = X264_MAX( h->param.rc.i_pass2_window, 0 );
+    if( !h->param.rc.b_stat_read || h->param.rc.i_chunks <= 1 )
+        h->param.rc.i_chunks = h->param.rc.i_chunk = 0;
+    if( b_open )
+        h->param.rc.i_chunk_start = 0;
+    if( h->param.rc.i_chunks )
+    {
+        if( h->param.rc.i_chunk < 0 || h->param.rc.i_chunk >= h->param.rc.i_chunks )
+        {
+            x264_log( h, X264_LOG_ERROR, "chunk %d out of range (0-%d)\n", h->param.rc.i_chunk, h->param.rc.i_chunks-1 );
+            return -1;
+        }
+        if( h->param.rc.b_stat_write )
+        {
+            x264_log( h, X264_LOG_ERROR, "chunked encoding can't write stats\n" );
+            return -1;
+        }
+        if( h->param.b_open_gop || h->param.b_intra_refresh )
+        {
+            x264_log( h, X264_LOG_ERROR, "chunked encoding requires closed GOPs starting with IDR frames\n" );
+            return -1;
+        }
+        if( h->param.rc.i_pass2_window )
+        {
+            x264_log( h, X264_LOG_WARNING, "pass2-window is not compatible with chunks, disabling\n" );
+            h->param.rc.i_pass2_window = 0;
+        }
+    }
+    if( h->param.rc.b_analysis_reuse && !h->param.rc.b_stat_read && !h->param.rc.b_stat_write )
+        h->param.rc.b_analysis_reuse = 0;
+    if( h->param.rc.b_analysis_reuse && (PARAM_INTERLACED || h->param.b_fake_interlaced) )
+    {
+        x264_log( h, X264_LOG_WARNING, "analysis reuse is not supported with interlacing\n" );
+        h->param.rc.b_analysis_reuse = 0;
+    }
     if( b_open && h->param.rc.b_stat_read )
+    {
         h->param.rc.i_lookahead = 0;
+        h->param.rc.b_lookahead_quarter = 0;
+    }
+    if( h->param.rc.f_speed > 0 )
+    {
+        h->param.rc.i_speed_bufsize = X264_MAX( h->param.rc.i_speed_bufsize, 1 );
+        h->param.rc.f_speed_bufinit = x264_clip3f( h->param.rc.f_speed_bufinit, 0, 1 );
+    }
+    else
+        h->param.rc.f_speed = 0;
 #if HAVE_THREAD
     if( h->param.i_sync_lookahead < 0 )
         h->param.i_sync_lookahead = h->param.i_bframe + 1;
     h->param.i_sync_lookahead = X264_MIN( h->param.i_sync_lookahead, X264_LOOKAHEAD_MAX );
-    if( h->param.rc.b_stat_read || h->i_thread_frames == 1 )
+    /* The lookahead thread runs for the encoder's whole life, so it can't be a scheduler job. */
+    if( h->param.rc.b_stat_read || h->i_thread_frames == 1 || h->param.scheduler )
         h->param.i_sync_lookahead = 0;
 #else
     h->param.i_sync_lookahead = 0;
+    h->param.scheduler = NULL;
 #endif
 
     h->param.i_deblocking_filter_alphac0 = x264_clip3( h->param.i_deblocking_filter_alphac0, -6, 6 );
@@ -780,7 +853,7 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         h->param.i_cqm_preset = X264_CQM_FLAT;
 
     if( h->param.analyse.i_me_method < X264_ME_DIA ||
-        h->param.analyse.i_me_method > X264_ME_TESA )
+        h->param.analyse.i_me_method > X264_ME_HASH )
         h->param.analyse.i_me_method = X264_ME_HEX;
     h->param.analyse.i_me_range = x264_clip3( h->param.analyse.i_me_range, 4, 1024 );
     if( h->param.analyse.i_me_range > 16 && h->param.analyse.i_me_method <= X264_ME_HEX )
@@ -788,6 +861,15 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     if( h->param.analyse.i_me_method == X264_ME_TESA &&
         (h->mb.b_lossless || h->param.analyse.i_subpel_refine <= 1) )
         h->param.analyse.i_me_method = X264_ME_ESA;
+    /* The hash tables are built as reference rows are filtered, which happens
+     * out of order with sliced threads and not at all with subme 0. */
+    if( h->param.analyse.i_me_method == X264_ME_HASH &&
+        (h->param.b_sliced_threads || !h->param.analyse.i_subpel_refine) )
+    {
+        x264_log( h, X264_LOG_WARNING, "me=hash is not supported with %s\n",
+                  h->param.b_sliced_threads ? "sliced threads" : "subme 0" );
+        h->param.analyse.i_me_method = X264_ME_UMH;
+    }
     h->param.analyse.b_mixed_references = h->param.analyse.b_mixed_references && h->param.i_frame_reference > 1;
     h->param.analyse.inter &= X264_ANALYSE_PSUB16x16|X264_ANALYSE_PSUB8x8|X264_ANALYSE_BSUB16x16|
                               X264_ANALYSE_I4x4|X264_ANALYSE_I8x8;
@@ -810,6 +892,10 @@ static int x264_validate_parameters( x264_t *h, int b_open )
         h->param.analyse.b_psnr = 0;
         h->param.analyse.b_ssim = 0;
     }
+#if HAVE_THREAD
+    if( !h->param.analyse.b_psnr && !h->param.analyse.b_ssim )
+#endif
+        h->param.analyse.b_async_metrics = 0;
     /* Warn users trying to measure PSNR/SSIM with psy opts on. */
     if( b_open && (h->param.analyse.b_psnr || h->param.analyse.b_ssim) )
     {
@@ -899,7 +985,8 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     {
         if( h->param.analyse.i_me_method >= X264_ME_ESA )
         {
-            x264_log( h, X264_LOG_WARNING, "interlace + me=esa is not implemented\n" );
+            x264_log( h, X264_LOG_WARNING, "interlace + me=%s is not implemented\n",
+                      x264_motion_est_names[h->param.analyse.i_me_method] );
             h->param.analyse.i_me_method = X264_ME_UMH;
         }
         if( h->param.analyse.i_weighted_pred > 0 )
@@ -969,6 +1056,8 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     BOOLIFY( b_deblocking_filter );
     BOOLIFY( b_deterministic );
     BOOLIFY( b_sliced_threads );
+    BOOLIFY( b_lookahead_batch );
+    BOOLIFY( b_filter_thread );
     BOOLIFY( b_interlaced );
     BOOLIFY( b_intra_refresh );
     BOOLIFY( b_visualize );
@@ -988,13 +1077,19 @@ static int x264_validate_parameters( x264_t *h, int b_open )
     BOOLIFY( analyse.b_chroma_me );
     BOOLIFY( analyse.b_mixed_references );
     BOOLIFY( analyse.b_fast_pskip );
+    BOOLIFY( analyse.b_fast_lowres_me );
     BOOLIFY( analyse.b_dct_decimate );
     BOOLIFY( analyse.b_psy );
     BOOLIFY( analyse.b_psnr );
     BOOLIFY( analyse.b_ssim );
+    BOOLIFY( analyse.b_async_metrics );
     BOOLIFY( rc.b_stat_write );
     BOOLIFY( rc.b_stat_read );
     BOOLIFY( rc.b_mb_tree );
+    BOOLIFY( rc.b_lookahead_quarter );
+    BOOLIFY( rc.b_stat_binary );
+    BOOLIFY( rc.b_mb_tree_compact );
+    BOOLIFY( rc.b_analysis_reuse );
 #undef BOOLIFY
 
     return 0;
@@ -1100,7 +1195,7 @@ x264_t *x264_encoder_open( x264_param_t *param )
 {
     x264_t *h;
     char buf[1000], *p;
-    int qp, i_slicetype_length;
+    int i_slicetype_length;
 
     CHECKED_MALLOCZERO( h, sizeof(x264_t) );
 
@@ -1191,6 +1286,7 @@ x264_t *x264_encoder_open( x264_param_t *param )
           || h->param.analyse.i_weighted_pred );
     h->frames.b_have_lowres |= h->param.rc.b_stat_read && h->param.rc.i_vbv_buffer_size > 0;
     h->frames.b_have_sub8x8_esa = !!(h->param.analyse.inter & X264_ANALYSE_PSUB8x8);
+    h->frames.b_have_hash = h->param.analyse.i_me_method == X264_ME_HASH;
 
     h->frames.i_last_idr =
     h->frames.i_last_keyframe = - h->param.i_keyint_max;
@@ -1253,15 +1349,8 @@ x264_t *x264_encoder_open( x264_param_t *param )
         p += sprintf( p, " none!" );
     x264_log( h, X264_LOG_INFO, "%s\n", buf );
 
-    float *logs = x264_analyse_prepare_costs( h );
-    if( !logs )
-        goto fail;
-    for( qp = X264_MIN( h->param.rc.i_qp_min, QP_MAX_SPEC ); qp <= h->param.rc.i_qp_max; qp++ )
-        if( x264_analyse_init_costs( h, logs, qp ) )
-            goto fail;
-    if( x264_analyse_init_costs( h, logs, X264_LOOKAHEAD_QP ) )
+    if( x264_analyse_init_costs( h ) )
         goto fail;
-    x264_free( logs );
 
     static const uint16_t cost_mv_correct[7] = { 24, 47, 95, 189, 379, 757, 1515 };
     /* Checks for known miscompilation issues. */
@@ -1291,11 +1380,25 @@ x264_t *x264_encoder_open( x264_param_t *param )
     h->nal_buffer_size = h->out.i_bitstream * 3/2 + 4;
     CHECKED_MALLOC( h->nal_buffer, h->nal_buffer_size );
 
-    if( h->param.i_threads > 1 &&
-        x264_threadpool_init( &h->threadpool, h->param.i_threads, (void*)x264_encoder_thread_init, h ) )
-        goto fail;
-    if( h->param.i_lookahead_threads > 1 &&
-        x264_threadpool_init( &h->lookaheadpool, h->param.i_lookahead_threads, (void*)x264_lookahead_thread_init, h ) )
+    if( h->param.scheduler )
+    {
+        if( h->param.i_threads > 1 &&
+            x264_threadpool_init_shared( &h->threadpool, h->param.i_threads, h->param.scheduler ) )
+            goto fail;
+        if( h->param.i_lookahead_threads > 1 &&
+            x264_threadpool_init_shared( &h->lookaheadpool, h->param.i_lookahead_threads, h->param.scheduler ) )
+            goto fail;
+    }
+    else
+    {
+        if( h->param.i_threads > 1 &&
+            x264_threadpool_init( &h->threadpool, h->param.i_threads, (void*)x264_encoder_thread_init, h ) )
+            goto fail;
+        if( h->param.i_lookahead_threads > 1 &&
+            x264_threadpool_init( &h->lookaheadpool, h->param.i_lookahead_threads, (void*)x264_lookahead_thread_init, h ) )
+            goto fail;
+    }
+    if( h->param.analyse.b_async_metrics && x264_metrics_init( h ) < 0 )
         goto fail;
 
     h->thread[0] = h;
@@ -1345,9 +1448,29 @@ x264_t *x264_encoder_open( x264_param_t *param )
         if( x264_macroblock_thread_allocate( h->thread[i], 0 ) < 0 )
             goto fail;
 
+    /* Batched lookahead estimates whole frames on each lookahead thread, which then
+     * needs its own cost outputs and lowres weighting buffer. */
+    if( h->param.b_lookahead_batch )
+        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            x264_t *t = h->lookahead_thread[i];
+            CHECKED_MALLOC( t->scratch_buffer2, (h->mb.i_mb_height + 4 + 32) * sizeof(int) * 2 );
+            if( h->param.analyse.i_weighted_pred > 0 )
+                CHECKED_MALLOC( t->mb.p_weight_buf[0], h->thread[0]->fdec->i_stride_lowres *
+                                (h->mb.i_mb_height*8 + 2*(PADV << PARAM_INTERLACED)) * sizeof(pixel) );
+        }
+
+    if( h->param.b_filter_thread )
+        for( int i = 0; i < h->param.i_threads; i++ )
+            if( x264_filter_thread_init( h->thread[i] ) < 0 )
+                goto fail;
+
     if( x264_ratecontrol_new( h ) < 0 )
         goto fail;
 
+    if( h->param.rc.f_speed > 0 && x264_speedcontrol_new( h ) < 0 )
+        goto fail;
+
     if( h->param.i_nal_hrd )
     {
         x264_log( h, X264_LOG_DEBUG, "HRD bitrate: %i bits/sec\n", h->sps->vui.hrd.i_bit_rate_unscaled );
@@ -1426,8 +1549,10 @@ int x264_encoder_reconfig( x264_t *h, x264_param_t *param )
     COPY( analyse.inter );
     COPY( analyse.intra );
     COPY( analyse.i_direct_mv_pred );
+    int b_esa = h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA;
+    int b_new_esa = param->analyse.i_me_method == X264_ME_ESA || param->analyse.i_me_method == X264_ME_TESA;
     /* Scratch buffer prevents me_range from being increased for esa/tesa */
-    if( h->param.analyse.i_me_method < X264_ME_ESA || param->analyse.i_me_range < h->param.analyse.i_me_range )
+    if( !b_esa || param->analyse.i_me_range < h->param.analyse.i_me_range )
         COPY( analyse.i_me_range );
     COPY( analyse.i_noise_reduction );
     /* We can't switch out of subme=0 during encoding. */
@@ -1437,14 +1562,16 @@ int x264_encoder_reconfig( x264_t *h, x264_param_t *param )
     COPY( analyse.b_chroma_me );
     COPY( analyse.b_dct_decimate );
     COPY( analyse.b_fast_pskip );
+    COPY( analyse.b_fast_lowres_me );
     COPY( analyse.b_mixed_references );
     COPY( analyse.f_psy_rd );
     COPY( analyse.f_psy_trellis );
     COPY( crop_rect );
     // can only twiddle these if they were enabled to begin with:
-    if( h->param.analyse.i_me_method >= X264_ME_ESA || param->analyse.i_me_method < X264_ME_ESA )
+    if( (b_esa || !b_new_esa) && (h->frames.b_have_hash || param->analyse.i_me_method != X264_ME_HASH) )
         COPY( analyse.i_me_method );
-    if( h->param.analyse.i_me_method >= X264_ME_ESA && !h->frames.b_have_sub8x8_esa )
+    if( (h->param.analyse.i_me_method == X264_ME_ESA || h->param.analyse.i_me_method == X264_ME_TESA)
+        && !h->frames.b_have_sub8x8_esa )
         h->param.analyse.inter &= ~X264_ANALYSE_PSUB8x8;
     if( h->pps->b_transform_8x8_mode )
         COPY( analyse.b_transform_8x8 );
@@ -1505,7 +1632,7 @@ static void x264_nal_start( x264_t *h, int i_type, int i_ref_idc )
     nal->b_long_startcode = 1;
 
     nal->i_payload= 0;
-    nal->p_payload= &h->out.p_bitstream[bs_pos( &h->out.bs ) / 8];
+    nal->p_payload= &h->out.bs.p_start[bs_pos( &h->out.bs ) / 8];
 }
 
 /* if number of allocated nals is not enough, re-allocate a larger one. */
@@ -1527,7 +1654,7 @@ static int x264_nal_check_buffer( x264_t *h )
 static int x264_nal_end( x264_t *h )
 {
     x264_nal_t *nal = &h->out.nal[h->out.i_nal];
-    uint8_t *end = &h->out.p_bitstream[bs_pos( &h->out.bs ) / 8];
+    uint8_t *end = &h->out.bs.p_start[bs_pos( &h->out.bs ) / 8];
     nal->i_payload = end - nal->p_payload;
     /* nal_escape_mmx reads past the end of the input.
      * While undefined padding wouldn't actually affect the output, it makes valgrind unhappy. */
@@ -1554,27 +1681,69 @@ static int x264_encoder_encapsulate_nals( x264_t *h, int start )
         previous_nal_size += h->out.nal[i].i_payload;
 
     for( int i = start; i < h->out.i_nal; i++ )
+    {
         nal_size += h->out.nal[i].i_payload;
+        h->out.nal[i].b_long_startcode = !i || h->out.nal[i].i_type == NAL_SPS || h->out.nal[i].i_type == NAL_PPS;
+    }
+
+    /* The bitstream starts NALU_HEADROOM bytes into its buffer, so while the NALs
+     * are still back to back there, they can be escaped in place, each one moving
+     * down by the start codes and emulation prevention bytes written so far.
+     * Escapes are rare enough that the headroom almost always suffices; otherwise
+     * (or if the NALs aren't contiguous, e.g. with sliced threads) copy them out. */
+    uint8_t *frame_start = start ? h->out.nal[0].p_payload : h->out.p_bitstream;
+    if( frame_start == h->out.p_bitstream )
+    {
+        uint8_t *dst = frame_start + previous_nal_size;
+        uint8_t *src = h->out.nal[start].p_payload;
+        intptr_t headroom = src - dst;
+        for( int i = start; i < h->out.i_nal && headroom >= 0; i++ )
+        {
+            if( h->out.nal[i].p_payload != src )
+                headroom = -1;
+            else
+            {
+                headroom -= x264_nal_encode_growth( h, &h->out.nal[i] );
+                src += h->out.nal[i].i_payload;
+            }
+        }
+        if( headroom >= 0 )
+        {
+            for( int i = start; i < h->out.i_nal; i++ )
+            {
+                x264_nal_encode_inplace( h, dst, &h->out.nal[i] );
+                dst += h->out.nal[i].i_payload;
+            }
+            return dst - (frame_start + previous_nal_size);
+        }
+    }
 
     /* Worst-case NAL unit escaping: reallocate the buffer if it's too small. */
-    int necessary_size = nal_size * 3/2 + h->out.i_nal * 4;
+    int necessary_size = previous_nal_size + nal_size * 3/2 + h->out.i_nal * 4;
     if( h->nal_buffer_size < necessary_size )
     {
         h->nal_buffer_size = necessary_size * 2;
         uint8_t *buf = x264_malloc( h->nal_buffer_size );
         if( !buf )
             return -1;
-        if( previous_nal_size )
+        if( previous_nal_size && frame_start == h->nal_buffer )
             memcpy( buf, h->nal_buffer, previous_nal_size );
         x264_free( h->nal_buffer );
         h->nal_buffer = buf;
     }
 
+    /* Earlier NALs of this frame were escaped in place: move them over too. */
+    if( previous_nal_size && frame_start != h->nal_buffer )
+    {
+        memcpy( h->nal_buffer, frame_start, previous_nal_size );
+        for( int i = 0; i < start; i++ )
+            h->out.nal[i].p_payload += h->nal_buffer - frame_start;
+    }
+
     uint8_t *nal_buffer = h->nal_buffer + previous_nal_size;
 
     for( int i = start; i < h->out.i_nal; i++ )
     {
-        h->out.nal[i].b_long_startcode = !i || h->out.nal[i].i_type == NAL_SPS || h->out.nal[i].i_type == NAL_PPS;
         x264_nal_encode( h, nal_buffer, &h->out.nal[i] );
         nal_buffer += h->out.nal[i].i_payload;
     }
@@ -1592,7 +1761,7 @@ int x264_encoder_headers( x264_t *h, x264_nal_t **pp_nal, int *pi_nal )
     int frame_size = 0;
     /* init bitstream context */
     h->out.i_nal = 0;
-    bs_init( &h->out.bs, h->out.p_bitstream, h->out.i_bitstream );
+    bs_init( &h->out.bs, h->out.p_bitstream + NALU_HEADROOM, h->out.i_bitstream - NALU_HEADROOM );
 
     /* Write SEI, SPS and PPS. */
 
@@ -1893,7 +2062,7 @@ static void x264_fdec_filter_row( x264_t *h, int mb_y, int pass )
     int b_hpel = h->fdec->b_kept_as_ref;
     int b_deblock = h->sh.i_disable_deblocking_filter_idc != 1;
     int b_end = mb_y == h->i_threadslice_end;
-    int b_measure_quality = 1;
+    int b_measure_quality = !h->param.analyse.b_async_metrics;
     int min_y = mb_y - (1 << SLICE_MBAFF);
     int b_start = min_y == h->i_threadslice_start;
     /* Even in interlaced mode, deblocking never modifies more than 4 pixels
@@ -1930,6 +2099,8 @@ static void x264_fdec_filter_row( x264_t *h, int mb_y, int pass )
     if( min_y < h->i_threadslice_start )
         return;
 
+    int64_t stage_start = x264_stage_start( h );
+
     if( b_deblock )
         for( int y = min_y; y < mb_y; y += (1 << SLICE_MBAFF) )
             x264_frame_deblock_row( h, y );
@@ -2005,13 +2176,290 @@ static void x264_fdec_filter_row( x264_t *h, int mb_y, int pass )
             h->stat.frame.i_ssim_cnt += ssim_cnt;
         }
     }
+
+    x264_stage_end( h, X264_STAGE_FILTER, stage_start );
+}
+
+/* Filter thread (b_filter_thread): runs x264_fdec_filter_row for an encoding thread,
+ * one row behind it.  Deblocking a row only touches that row and the bottom of the one
+ * above, while intra prediction of the next row uses intra_border_backup, so the two can
+ * overlap.  The worker uses a private copy of the encoding context, because deblocking
+ * overwrites h->mb's neighbour state. */
+struct x264_filter_thread_t
+{
+    x264_t *h;
+    x264_pthread_t handle;
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t cv;
+    int b_thread_active;
+    int b_exit;
+    int queue[4];   /* mb_y arguments for x264_fdec_filter_row */
+    int i_queued;
+    int i_done;
+};
+
+static void *x264_filter_thread( x264_filter_thread_t *ft )
+{
+    x264_pthread_mutex_lock( &ft->mutex );
+    while( 1 )
+    {
+        while( ft->i_done == ft->i_queued && !ft->b_exit )
+            x264_pthread_cond_wait( &ft->cv, &ft->mutex );
+        if( ft->i_done == ft->i_queued )
+            break;
+        int mb_y = ft->queue[ft->i_done&3];
+        x264_pthread_mutex_unlock( &ft->mutex );
+        x264_stack_align( x264_fdec_filter_row, ft->h, mb_y, 0 );
+        x264_pthread_mutex_lock( &ft->mutex );
+        ft->i_done++;
+        x264_pthread_cond_broadcast( &ft->cv );
+    }
+    x264_pthread_mutex_unlock( &ft->mutex );
+    return NULL;
+}
+
+static int x264_filter_thread_init( x264_t *h )
+{
+    x264_filter_thread_t *ft;
+    CHECKED_MALLOCZERO( ft, sizeof(x264_filter_thread_t) );
+    h->filter_thread = ft;
+    CHECKED_MALLOCZERO( ft->h, sizeof(x264_t) );
+    int buf_hpel = (h->thread[0]->fdec->i_width[0]+48) * sizeof(int16_t);
+    int buf_ssim = h->param.analyse.b_ssim * 8 * (h->param.i_width/4+3) * sizeof(int);
+    CHECKED_MALLOC( ft->h->scratch_buffer, X264_MAX( buf_hpel, buf_ssim ) );
+    if( x264_pthread_mutex_init( &ft->mutex, NULL ) || x264_pthread_cond_init( &ft->cv, NULL ) )
+        return -1;
+    if( x264_pthread_create( &ft->handle, NULL, (void*)x264_filter_thread, ft ) )
+        return -1;
+    ft->b_thread_active = 1;
+    return 0;
+fail:
+    return -1;
+}
+
+static void x264_filter_thread_delete( x264_t *h )
+{
+    x264_filter_thread_t *ft = h->filter_thread;
+    if( !ft )
+        return;
+    if( ft->b_thread_active )
+    {
+        x264_pthread_mutex_lock( &ft->mutex );
+        ft->b_exit = 1;
+        x264_pthread_cond_broadcast( &ft->cv );
+        x264_pthread_mutex_unlock( &ft->mutex );
+        x264_pthread_join( ft->handle, NULL );
+        x264_pthread_mutex_destroy( &ft->mutex );
+        x264_pthread_cond_destroy( &ft->cv );
+    }
+    if( ft->h )
+        x264_free( ft->h->scratch_buffer );
+    x264_free( ft->h );
+    x264_free( ft );
+}
+
+/* Called at the start of each frame, while the worker is idle. */
+static void x264_filter_thread_frame_start( x264_t *h )
+{
+    x264_filter_thread_t *ft = h->filter_thread;
+    void *scratch_buffer = ft->h->scratch_buffer;
+    memcpy( ft->h, h, sizeof(x264_t) );
+    ft->h->scratch_buffer = scratch_buffer;
+    memset( &ft->h->stat.frame, 0, sizeof(ft->h->stat.frame) );
+    memset( ft->h->stage.frame, 0, sizeof(ft->h->stage.frame) );
+}
+
+/* Filter the rows above mb_y, on the filter thread if there is one.  Unless b_flush,
+ * returns with at most that request pending: deblock_strength only holds two rows. */
+static void x264_fdec_filter_row_pipelined( x264_t *h, int mb_y, int b_flush )
+{
+    x264_filter_thread_t *ft = h->filter_thread;
+    if( !ft )
+    {
+        x264_fdec_filter_row( h, mb_y, 0 );
+        return;
+    }
+    x264_pthread_mutex_lock( &ft->mutex );
+    ft->queue[ft->i_queued&3] = mb_y;
+    ft->i_queued++;
+    x264_pthread_cond_broadcast( &ft->cv );
+    while( ft->i_queued - ft->i_done > !b_flush )
+        x264_pthread_cond_wait( &ft->cv, &ft->mutex );
+    x264_pthread_mutex_unlock( &ft->mutex );
+
+    if( b_flush )
+    {
+        /* collect the quality metrics and timing measured by the worker */
+        x264_t *fh = ft->h;
+        for( int i = 0; i < 3; i++ )
+            h->stat.frame.i_ssd[i] += fh->stat.frame.i_ssd[i];
+        h->stat.frame.f_ssim += fh->stat.frame.f_ssim;
+        h->stat.frame.i_ssim_cnt += fh->stat.frame.i_ssim_cnt;
+        h->stage.frame[X264_STAGE_FILTER] += fh->stage.frame[X264_STAGE_FILTER];
+        h->stage.thread[X264_STAGE_FILTER] += fh->stage.frame[X264_STAGE_FILTER];
+    }
+}
+
+/* Background quality metrics (b_async_metrics): rather than measuring each row as it
+ * is filtered, frame_end hands the finished fenc/fdec pair to a one-thread pool and
+ * measures the whole frame there in one go, while the next frame encodes.  The pair is
+ * kept referenced until the result is collected, at the next frame_end, so each frame's
+ * PSNR/SSIM arrive with the following output picture. */
+struct x264_metrics_job_t
+{
+    x264_t *h;
+    x264_frame_t *fenc;
+    x264_frame_t *fdec;     /* NULL when no measurement is pending */
+    int64_t i_pts;
+    int     i_frame;
+    int     i_type;         /* slice type, for the summary */
+    double  f_duration;
+    int64_t i_ssd[3];
+    float   f_ssim;
+    int     i_ssim_cnt;
+    void   *scratch;
+};
+
+static int x264_metrics_init( x264_t *h )
+{
+    x264_metrics_job_t *job;
+    CHECKED_MALLOCZERO( job, sizeof(x264_metrics_job_t) );
+    h->metrics = job;
+    job->h = h;
+    if( h->param.analyse.b_ssim )
+        CHECKED_MALLOC( job->scratch, 8 * (h->param.i_width/4+3) * sizeof(int) );
+    if( h->param.scheduler )
+        return x264_threadpool_init_shared( &h->metricspool, 1, h->param.scheduler );
+    return x264_threadpool_init( &h->metricspool, 1, NULL, NULL );
+fail:
+    return -1;
+}
+
+static void *x264_metrics_measure( x264_metrics_job_t *job )
+{
+    x264_t *h = job->h;
+    x264_frame_t *fenc = job->fenc;
+    x264_frame_t *fdec = job->fdec;
+    int width = h->param.i_width;
+    int height = h->param.i_height;
+
+    memset( job->i_ssd, 0, sizeof(job->i_ssd) );
+    if( h->param.analyse.b_psnr )
+    {
+        for( int p = 0; p < (CHROMA444 ? 3 : 1); p++ )
+            job->i_ssd[p] = x264_pixel_ssd_wxh( &h->pixf, fdec->plane[p], fdec->i_stride[p],
+                                                fenc->plane[p], fenc->i_stride[p], width, height );
+        if( !CHROMA444 )
+        {
+            uint64_t ssd_u, ssd_v;
+            x264_pixel_ssd_nv12( &h->pixf, fdec->plane[1], fdec->i_stride[1], fenc->plane[1], fenc->i_stride[1],
+                                 width>>1, height>>CHROMA_V_SHIFT, &ssd_u, &ssd_v );
+            job->i_ssd[1] = ssd_u;
+            job->i_ssd[2] = ssd_v;
+        }
+    }
+
+    if( h->param.analyse.b_ssim )
+    {
+        x264_emms();
+        /* same 2-pixel offset as the per-row measurement in x264_fdec_filter_row */
+        job->f_ssim = x264_pixel_ssim_wxh( &h->pixf, fdec->plane[0] + 2+2*fdec->i_stride[0], fdec->i_stride[0],
+                                           fenc->plane[0] + 2+2*fenc->i_stride[0], fenc->i_stride[0],
+                                           width-2, height-2, job->scratch, &job->i_ssim_cnt );
+    }
+    x264_emms();
+    return NULL;
+}
+
+/* Hand the frame just finished to the metrics thread.  The previous measurement must
+ * have been collected. */
+static void x264_metrics_submit( x264_t *h )
+{
+    x264_metrics_job_t *job = h->thread[0]->metrics;
+    job->fenc = h->fenc;
+    job->fdec = h->fdec;
+    job->fenc->i_reference_count++;
+    job->fdec->i_reference_count++;
+    job->i_pts = h->fdec->i_pts;
+    job->i_frame = h->i_frame;
+    job->i_type = h->sh.i_type;
+    job->f_duration = h->fenc->f_duration;
+    x264_threadpool_run( h->thread[0]->metricspool, (void*)x264_metrics_measure, job );
+}
+
+/* Wait for the pending measurement, if any, add it to the stats and report it in pic_out. */
+static void x264_metrics_collect( x264_t *h, x264_picture_t *pic_out )
+{
+    x264_t *h0 = h->thread[0];
+    x264_metrics_job_t *job = h0->metrics;
+    if( pic_out )
+        pic_out->prop.b_metrics = 0;
+    if( !job->fdec )
+        return;
+    x264_threadpool_wait( h0->metricspool, job );
+
+    char psz_message[80];
+    int type = job->i_type;
+    double dur = job->f_duration;
+    double psnr[3], psnr_avg = 0, ssim = 0;
+    psz_message[0] = '\0';
+    if( h->param.analyse.b_psnr )
+    {
+        int luma_size = h->param.i_width * h->param.i_height;
+        int chroma_size = CHROMA_SIZE( luma_size );
+        psnr[0] = x264_psnr( job->i_ssd[0], luma_size );
+        psnr[1] = x264_psnr( job->i_ssd[1], chroma_size );
+        psnr[2] = x264_psnr( job->i_ssd[2], chroma_size );
+        psnr_avg = x264_psnr( job->i_ssd[0] + job->i_ssd[1] + job->i_ssd[2], luma_size + chroma_size*2 );
+
+        h0->stat.f_ssd_global[type]   += dur * (job->i_ssd[0] + job->i_ssd[1] + job->i_ssd[2]);
+        h0->stat.f_psnr_average[type] += dur * psnr_avg;
+        h0->stat.f_psnr_mean_y[type]  += dur * psnr[0];
+        h0->stat.f_psnr_mean_u[type]  += dur * psnr[1];
+        h0->stat.f_psnr_mean_v[type]  += dur * psnr[2];
+
+        snprintf( psz_message, 80, " PSNR Y:%5.2f U:%5.2f V:%5.2f", psnr[0], psnr[1], psnr[2] );
+        if( pic_out )
+        {
+            memcpy( pic_out->prop.f_psnr, psnr, sizeof(psnr) );
+            pic_out->prop.f_psnr_avg = psnr_avg;
+        }
+    }
+    if( h->param.analyse.b_ssim )
+    {
+        ssim = job->f_ssim / job->i_ssim_cnt;
+        h0->stat.f_ssim_mean_y[type] += ssim * dur;
+        snprintf( psz_message + strlen(psz_message), 80 - strlen(psz_message), " SSIM Y:%.5f", ssim );
+        if( pic_out )
+            pic_out->prop.f_ssim = ssim;
+    }
+    psz_message[79] = '\0';
+    x264_log( h, X264_LOG_DEBUG, "frame=%4d%s\n", job->i_frame, psz_message );
+
+    if( pic_out )
+    {
+        pic_out->prop.b_metrics = 1;
+        pic_out->prop.i_metrics_pts = job->i_pts;
+    }
+    x264_frame_push_unused( h, job->fenc );
+    x264_frame_push_unused( h, job->fdec );
+    job->fenc = job->fdec = NULL;
+}
+
+static void x264_metrics_delete( x264_t *h )
+{
+    x264_metrics_collect( h, NULL );
+    x264_threadpool_delete( h->metricspool );
+    x264_free( h->metrics->scratch );
+    x264_free( h->metrics );
 }
 
 static inline int x264_reference_update( x264_t *h )
 {
     if( !h->fdec->b_kept_as_ref )
     {
-        if( h->i_thread_frames > 1 )
+        /* the metrics worker may still be reading the previous fdec */
+        if( h->i_thread_frames > 1 || h->param.analyse.b_async_metrics )
         {
             x264_frame_push_unused( h, h->fdec );
             h->fdec = x264_frame_pop_unused( h, 1 );
@@ -2286,7 +2734,7 @@ static int x264_slice_write( x264_t *h )
             if( !(i_mb_y & SLICE_MBAFF) && h->param.rc.i_vbv_buffer_size )
                 x264_bitstream_backup( h, &bs_bak[1], i_skip, 1 );
             if( !h->mb.b_reencode_mb )
-                x264_fdec_filter_row( h, i_mb_y, 0 );
+                x264_fdec_filter_row_pipelined( h, i_mb_y, 0 );
         }
 
         if( !(i_mb_y & SLICE_MBAFF) && back_up_bitstream )
@@ -2314,12 +2762,19 @@ static int x264_slice_write( x264_t *h )
         else
             x264_macroblock_cache_load_progressive( h, i_mb_x, i_mb_y );
 
+        int64_t stage_start = x264_stage_start( h );
+        int64_t stage_wait = h->stage.frame[X264_STAGE_WAIT];
         x264_macroblock_analyse( h );
+        /* don't count waiting for reference rows as analysis */
+        x264_stage_end( h, X264_STAGE_ANALYSE, stage_start + h->stage.frame[X264_STAGE_WAIT] - stage_wait );
 
         /* encode this macroblock -> be careful it can change the mb type to P_SKIP if needed */
 reencode:
+        stage_start = x264_stage_start( h );
         x264_macroblock_encode( h );
+        x264_stage_end( h, X264_STAGE_ENCODE, stage_start );
 
+        stage_start = x264_stage_start( h );
         if( h->param.b_cabac )
         {
             if( mb_xy > h->sh.i_first_mb && !(SLICE_MBAFF && (i_mb_y&1)) )
@@ -2354,10 +2809,12 @@ reencode:
                     h->mb.b_skip_mc = 0;
                     h->mb.b_overflow = 0;
                     x264_bitstream_restore( h, &bs_bak[0], &i_skip, 0 );
+                    x264_stage_end( h, X264_STAGE_ENTROPY, stage_start );
                     goto reencode;
                 }
             }
         }
+        x264_stage_end( h, X264_STAGE_ENTROPY, stage_start );
 
         int total_bits = bs_pos(&h->out.bs) + x264_cabac_pos(&h->cabac);
         int mb_size = total_bits - mb_spos;
@@ -2408,7 +2865,10 @@ reencode:
         /* save cache */
         x264_macroblock_cache_save( h );
 
-        if( x264_ratecontrol_mb( h, mb_size ) < 0 )
+        stage_start = x264_stage_start( h );
+        int b_rc_reencode = x264_ratecontrol_mb( h, mb_size ) < 0;
+        x264_stage_end( h, X264_STAGE_RATECONTROL, stage_start );
+        if( b_rc_reencode )
         {
             x264_bitstream_restore( h, &bs_bak[1], &i_skip, 1 );
             h->mb.b_reencode_mb = 1;
@@ -2533,7 +2993,7 @@ reencode:
                                   + (h->out.i_nal*NALU_OVERHEAD * 8)
                                   - h->stat.frame.i_tex_bits
                                   - h->stat.frame.i_mv_bits;
-        x264_fdec_filter_row( h, h->i_threadslice_end, 0 );
+        x264_fdec_filter_row_pipelined( h, h->i_threadslice_end, 1 );
 
         if( h->param.b_sliced_threads )
         {
@@ -2604,6 +3064,8 @@ static void *x264_slices_write( x264_t *h )
     /* init stats */
     memset( &h->stat.frame, 0, sizeof(h->stat.frame) );
     h->mb.b_reencode_mb = 0;
+    if( h->filter_thread )
+        x264_filter_thread_frame_start( h );
     while( h->sh.i_first_mb + SLICE_MBAFF*h->mb.i_mb_stride <= last_thread_mb )
     {
         h->sh.i_last_mb = last_thread_mb;
@@ -2680,6 +3142,8 @@ static int x264_threaded_slices_write( x264_t *h )
     /* setup */
     for( int i = 0; i < h->param.i_threads; i++ )
     {
+        if( i )
+            memset( h->thread[i]->stage.frame, 0, sizeof(h->thread[i]->stage.frame) );
         h->thread[i]->i_thread_idx = i;
         h->thread[i]->b_thread_active = 1;
         x264_threadslice_cond_broadcast( h->thread[i], 0 );
@@ -2709,6 +3173,8 @@ static int x264_threaded_slices_write( x264_t *h )
             h->stat.frame.i_ssd[j] += t->stat.frame.i_ssd[j];
         h->stat.frame.f_ssim += t->stat.frame.f_ssim;
         h->stat.frame.i_ssim_cnt += t->stat.frame.i_ssim_cnt;
+        for( int j = 0; j < X264_STAGE_MAX; j++ )
+            h->stage.frame[j] += t->stage.frame[j];
     }
 
     return 0;
@@ -2882,6 +3348,8 @@ int     x264_encoder_encode( x264_t *h,
     /* ------------------- Get frame to be encoded ------------------------- */
     /* 4: get picture to encode */
     h->fenc = x264_frame_shift( h->frames.current );
+    memset( h->stage.frame, 0, sizeof(h->stage.frame) );
+    h->stage.frame[X264_STAGE_LOOKAHEAD] = h->fenc->i_lookahead_time;
 
     /* If applicable, wait for previous frame reconstruction to finish */
     if( h->param.b_sliced_threads )
@@ -2900,6 +3368,9 @@ int     x264_encoder_encode( x264_t *h,
         }
     }
 
+    if( h->thread[0]->sc )
+        x264_speedcontrol_frame( h );
+
     // ok to call this before encoding any frames, since the initial values of fdec have b_kept_as_ref=0
     if( x264_reference_update( h ) )
         return -1;
@@ -3011,13 +3482,14 @@ int     x264_encoder_encode( x264_t *h,
     {
         for( int i = 0; i < h->param.i_threads; i++ )
         {
-            bs_init( &h->thread[i]->out.bs, h->thread[i]->out.p_bitstream, h->thread[i]->out.i_bitstream );
+            bs_init( &h->thread[i]->out.bs, h->thread[i]->out.p_bitstream + NALU_HEADROOM,
+                     h->thread[i]->out.i_bitstream - NALU_HEADROOM );
             h->thread[i]->out.i_nal = 0;
         }
     }
     else
     {
-        bs_init( &h->out.bs, h->out.p_bitstream, h->out.i_bitstream );
+        bs_init( &h->out.bs, h->out.p_bitstream + NALU_HEADROOM, h->out.i_bitstream - NALU_HEADROOM );
         h->out.i_nal = 0;
     }
 
@@ -3138,7 +3610,8 @@ int     x264_encoder_encode( x264_t *h,
 
     if( h->fenc->b_keyframe )
     {
-        if( h->param.b_repeat_headers && h->fenc->i_frame == 0 )
+        /* once per stream: later chunks are appended to the first one */
+        if( h->param.b_repeat_headers && h->fenc->i_frame == 0 && !h->param.rc.i_chunk )
         {
             /* identify ourself */
             x264_nal_start( h, NAL_SEI, NAL_PRIORITY_DISPOSABLE );
@@ -3195,7 +3668,9 @@ int     x264_encoder_encode( x264_t *h,
 
     /* Init the rate control */
     /* FIXME: Include slice header bit cost. */
+    int64_t stage_start = x264_stage_start( h );
     x264_ratecontrol_start( h, h->fenc->i_qpplus1, overhead*8 );
+    x264_stage_end( h, X264_STAGE_RATECONTROL, stage_start );
     i_global_qp = x264_ratecontrol_qp( h );
 
     pic_out->i_qpplus1 =
@@ -3310,17 +3785,31 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
         pic_out->img.plane[i] = (uint8_t*)h->fdec->plane[i];
     }
 
+    if( h->param.analyse.b_async_metrics )
+    {
+        x264_metrics_collect( h, pic_out );
+        x264_metrics_submit( h );
+    }
+    else
+    {
+        pic_out->prop.b_metrics = h->param.analyse.b_psnr || h->param.analyse.b_ssim;
+        pic_out->prop.i_metrics_pts = pic_out->i_pts;
+    }
+
     x264_frame_push_unused( thread_current, h->fenc );
 
     /* ---------------------- Update encoder state ------------------------- */
 
     /* update rc */
     int filler = 0;
+    int64_t stage_start = x264_stage_start( h );
     if( x264_ratecontrol_end( h, frame_size * 8, &filler ) < 0 )
         return -1;
+    x264_stage_end( h, X264_STAGE_RATECONTROL, stage_start );
 
     pic_out->hrd_timing = h->fenc->hrd_timing;
     pic_out->prop.f_crf_avg = h->fdec->f_crf_avg;
+    memcpy( pic_out->prop.i_stage_time, h->stage.frame, sizeof(pic_out->prop.i_stage_time) );
 
     while( filler > 0 )
     {
@@ -3403,7 +3892,7 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
     psz_message[0] = '\0';
     double dur = h->fenc->f_duration;
     h->stat.f_frame_duration[h->sh.i_type] += dur;
-    if( h->param.analyse.b_psnr )
+    if( h->param.analyse.b_psnr && !h->param.analyse.b_async_metrics )
     {
         int64_t ssd[3] =
         {
@@ -3429,7 +3918,7 @@ static int x264_encoder_frame_end( x264_t *h, x264_t *thread_current,
                                                                     pic_out->prop.f_psnr[2] );
     }
 
-    if( h->param.analyse.b_ssim )
+    if( h->param.analyse.b_ssim && !h->param.analyse.b_async_metrics )
     {
         pic_out->prop.f_ssim = h->stat.frame.f_ssim / h->stat.frame.i_ssim_cnt;
         h->stat.f_ssim_mean_y[h->sh.i_type] += pic_out->prop.f_ssim * dur;
@@ -3517,9 +4006,21 @@ void    x264_encoder_close  ( x264_t *h )
     if( h->param.b_sliced_threads )
         x264_threadpool_wait_all( h );
     if( h->param.i_threads > 1 )
+    {
+        int64_t steals, idle_time;
+        x264_threadpool_stats( h->threadpool, &steals, &idle_time );
+        x264_log( h, X264_LOG_DEBUG, "threadpool: %"PRId64" jobs stolen, %.3fs idle\n", steals, idle_time / 1e6 );
         x264_threadpool_delete( h->threadpool );
+    }
     if( h->param.i_lookahead_threads > 1 )
+    {
+        int64_t steals, idle_time;
+        x264_threadpool_stats( h->lookaheadpool, &steals, &idle_time );
+        x264_log( h, X264_LOG_DEBUG, "lookahead threadpool: %"PRId64" jobs stolen, %.3fs idle\n", steals, idle_time / 1e6 );
         x264_threadpool_delete( h->lookaheadpool );
+    }
+    if( h->metricspool )
+        x264_metrics_delete( h );
     if( h->i_thread_frames > 1 )
     {
         for( int i = 0; i < h->i_thread_frames; i++ )
@@ -3649,6 +4150,26 @@ void    x264_encoder_close  ( x264_t *h )
 
     x264_ratecontrol_summary( h );
 
+    if( h->param.b_stage_timing )
+    {
+        static const char * const stage_names[X264_STAGE_MAX] =
+            { "lookahead", "analyse", "encode", "entropy", "filter", "ratecontrol", "wait" };
+        for( int i = -1; i < h->param.i_threads; i++ )
+        {
+            int64_t times[X264_STAGE_MAX], total = 0;
+            char stage_buf[X264_STAGE_MAX*40], *p = stage_buf;
+            x264_encoder_stage_times( h, i, times );
+            for( int j = 0; j < X264_STAGE_MAX; j++ )
+                total += times[j];
+            for( int j = 0; j < X264_STAGE_MAX; j++ )
+                p += sprintf( p, " %s:%.1fms(%.1f%%)", stage_names[j], times[j] / 1e6, total ? times[j] * 100. / total : 0 );
+            if( i < 0 )
+                x264_log( h, X264_LOG_INFO, "stage times:%s\n", stage_buf );
+            else if( h->param.i_threads > 1 )
+                x264_log( h, X264_LOG_DEBUG, "stage times thread %d:%s\n", i, stage_buf );
+        }
+    }
+
     if( h->stat.i_frame_count[SLICE_TYPE_I] + h->stat.i_frame_count[SLICE_TYPE_P] + h->stat.i_frame_count[SLICE_TYPE_B] > 0 )
     {
 #define SUM3(p) (p[SLICE_TYPE_I] + p[SLICE_TYPE_P] + p[SLICE_TYPE_B])
@@ -3801,6 +4322,7 @@ void    x264_encoder_close  ( x264_t *h )
 
     /* rc */
     x264_ratecontrol_delete( h );
+    x264_speedcontrol_delete( h );
 
     /* param */
     if( h->param.rc.psz_stat_out )
@@ -3831,7 +4353,11 @@ void    x264_encoder_close  ( x264_t *h )
 
     if( h->param.i_lookahead_threads > 1 )
         for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        {
+            x264_free( h->lookahead_thread[i]->scratch_buffer2 );
+            x264_free( h->lookahead_thread[i]->mb.p_weight_buf[0] );
             x264_free( h->lookahead_thread[i] );
+        }
 
     for( int i = h->param.i_threads - 1; i >= 0; i-- )
     {
@@ -3856,6 +4382,7 @@ void    x264_encoder_close  ( x264_t *h )
             }
             x264_macroblock_cache_free( h->thread[i] );
         }
+        x264_filter_thread_delete( h->thread[i] );
         x264_macroblock_thread_free( h->thread[i], 0 );
         x264_free( h->thread[i]->out.p_bitstream );
         x264_free( h->thread[i]->out.nal );
@@ -3890,3 +4417,89 @@ int x264_encoder_maximum_delayed_frames( x264_t *h )
 {
     return h->frames.i_delay;
 }
+
+/****************************************************************************
+ * x264_encoder_lookahead_share:
+ ****************************************************************************/
+int x264_encoder_lookahead_share( x264_t *leader, x264_t *follower )
+{
+    x264_param_t *l = &leader->param;
+    x264_param_t *f = &follower->param;
+    if( l->i_bframe != f->i_bframe || l->i_bframe_pyramid != f->i_bframe_pyramid ||
+        l->i_keyint_max != f->i_keyint_max || l->i_keyint_min != f->i_keyint_min ||
+        l->b_open_gop != f->b_open_gop || l->b_bluray_compat != f->b_bluray_compat ||
+        l->b_intra_refresh != f->b_intra_refresh || l->b_interlaced != f->b_interlaced )
+    {
+        x264_log( follower, X264_LOG_ERROR, "shared lookahead requires the same GOP structure parameters\n" );
+        return -1;
+    }
+    if( f->rc.b_stat_read )
+    {
+        x264_log( follower, X264_LOG_ERROR, "shared lookahead is not compatible with 2-pass\n" );
+        return -1;
+    }
+    if( follower->frames.i_delay < leader->frames.i_delay )
+    {
+        x264_log( follower, X264_LOG_ERROR, "shared lookahead requires at least the leader's delay (%d < %d frames)\n",
+                  follower->frames.i_delay, leader->frames.i_delay );
+        return -1;
+    }
+    if( leader->frames.i_input || follower->frames.i_input )
+    {
+        x264_log( follower, X264_LOG_ERROR, "shared lookahead must be set up before encoding\n" );
+        return -1;
+    }
+    return x264_lookahead_share( leader, follower );
+}
+
+/****************************************************************************
+ * x264_encoder_stage_times:
+ ****************************************************************************/
+int x264_encoder_stage_times( x264_t *h, int i_thread, int64_t times[X264_STAGE_MAX] )
+{
+    if( !h->param.b_stage_timing )
+        return -1;
+    memset( times, 0, X264_STAGE_MAX * sizeof(int64_t) );
+    if( i_thread >= h->param.i_threads )
+        return h->param.i_threads;
+    for( int i = X264_MAX( i_thread, 0 ); i < (i_thread < 0 ? h->param.i_threads : i_thread+1); i++ )
+        for( int j = 0; j < X264_STAGE_MAX; j++ )
+            times[j] += h->thread[i]->stage.thread[j];
+    if( i_thread < 0 )
+        times[X264_STAGE_LOOKAHEAD] = h->lookahead->i_stage_time;
+    return h->param.i_threads;
+}
+
+/****************************************************************************
+ * x264_encoder_input_layout:
+ ****************************************************************************/
+void x264_encoder_input_layout( x264_t *h, x264_image_t *img, int *pad_h, int *pad_v )
+{
+    x264_frame_input_layout( h, img, pad_h, pad_v );
+}
+
+/****************************************************************************
+ * x264_scheduler_open:
+ ****************************************************************************/
+x264_scheduler_t *x264_scheduler_open( int i_threads )
+{
+#if HAVE_THREAD
+    x264_scheduler_t *sched = NULL;
+    if( i_threads == X264_THREADS_AUTO )
+        i_threads = x264_cpu_num_processors();
+    if( x264_scheduler_init( &sched, x264_clip3( i_threads, 1, X264_THREAD_MAX ), x264_scheduler_thread_init, NULL ) )
+        return NULL;
+    return sched;
+#else
+    return NULL;
+#endif
+}
+
+/****************************************************************************
+ * x264_scheduler_close:
+ ****************************************************************************/
+void x264_scheduler_close( x264_scheduler_t *sched )
+{
+    if( sched )
+        x264_scheduler_release( sched );
+}
@@ -64,10 +64,22 @@ static void x264_lookahead_update_last_nonb( x264_t *h, x264_frame_t *new_nonb )
     new_nonb->i_reference_count++;
 }
 
+static void x264_lookahead_decide( x264_t *h )
+{
+    int64_t start = x264_stage_start( h );
+    x264_stack_align( x264_slicetype_decide, h );
+    if( h->param.b_stage_timing )
+    {
+        int64_t time = x264_ntime() - start;
+        h->lookahead->i_stage_time += time;
+        h->lookahead->next.list[0]->i_lookahead_time += time;
+    }
+}
+
 #if HAVE_THREAD
 static void x264_lookahead_slicetype_decide( x264_t *h )
 {
-    x264_stack_align( x264_slicetype_decide, h );
+    x264_lookahead_decide( h );
 
     x264_lookahead_update_last_nonb( h, h->lookahead->next.list[0] );
 
@@ -165,6 +177,90 @@ fail:
     return -1;
 }
 
+static void x264_lookahead_share_unref( x264_lookahead_share_t *share )
+{
+    x264_pthread_mutex_lock( &share->mutex );
+    int i_refcount = --share->i_refcount;
+    x264_pthread_mutex_unlock( &share->mutex );
+    if( i_refcount )
+        return;
+    x264_pthread_mutex_destroy( &share->mutex );
+    x264_pthread_cond_destroy( &share->cv_fill );
+    x264_free( share->type );
+    x264_free( share );
+}
+
+int x264_lookahead_share( x264_t *leader, x264_t *follower )
+{
+    x264_lookahead_t *look = leader->lookahead;
+    if( follower->lookahead->share_in || follower->lookahead->share_out || look->share_in || leader == follower )
+        return -1;
+
+    if( !look->share_out )
+    {
+        x264_lookahead_share_t *share;
+        CHECKED_MALLOCZERO( share, sizeof(x264_lookahead_share_t) );
+        share->i_max_size = 1024;
+        CHECKED_MALLOC( share->type, share->i_max_size * sizeof(int8_t) );
+        if( x264_pthread_mutex_init( &share->mutex, NULL ) ||
+            x264_pthread_cond_init( &share->cv_fill, NULL ) )
+            goto fail;
+        share->i_refcount = 1;
+        look->share_out = share;
+    }
+
+    x264_pthread_mutex_lock( &look->share_out->mutex );
+    look->share_out->i_refcount++;
+    x264_pthread_mutex_unlock( &look->share_out->mutex );
+    follower->lookahead->share_in = look->share_out;
+    return 0;
+fail:
+    return -1;
+}
+
+void x264_lookahead_share_put( x264_lookahead_share_t *share, int i_frame, int i_type, int b_final )
+{
+    x264_pthread_mutex_lock( &share->mutex );
+    if( i_frame >= share->i_max_size )
+    {
+        /* one byte per frame, so just keep the whole history */
+        int i_max_size = X264_MAX( share->i_max_size * 2, i_frame + 1 );
+        int8_t *type = x264_malloc( i_max_size * sizeof(int8_t) );
+        if( !type )
+        {
+            share->b_closed = 1;
+            x264_pthread_cond_broadcast( &share->cv_fill );
+            x264_pthread_mutex_unlock( &share->mutex );
+            return;
+        }
+        memcpy( type, share->type, share->i_known * sizeof(int8_t) );
+        x264_free( share->type );
+        share->type = type;
+        share->i_max_size = i_max_size;
+    }
+    /* final decisions are never revised by tentative ones */
+    if( b_final || i_frame >= share->i_decided )
+        share->type[i_frame] = i_type;
+    if( b_final )
+        share->i_decided = X264_MAX( share->i_decided, i_frame + 1 );
+    share->i_known = X264_MAX( share->i_known, i_frame + 1 );
+    x264_pthread_cond_broadcast( &share->cv_fill );
+    x264_pthread_mutex_unlock( &share->mutex );
+}
+
+/* Returns the type the leader gave to the frame, or -1 if it isn't known (yet). */
+int x264_lookahead_share_get( x264_lookahead_share_t *share, int i_frame, int b_final, int b_wait )
+{
+    int i_type = -1;
+    x264_pthread_mutex_lock( &share->mutex );
+    while( b_wait && !share->b_closed && i_frame >= (b_final ? share->i_decided : share->i_known) )
+        x264_pthread_cond_wait( &share->cv_fill, &share->mutex );
+    if( i_frame < (b_final ? share->i_decided : share->i_known) )
+        i_type = share->type[i_frame];
+    x264_pthread_mutex_unlock( &share->mutex );
+    return i_type;
+}
+
 void x264_lookahead_delete( x264_t *h )
 {
     if( h->param.i_sync_lookahead )
@@ -183,6 +279,16 @@ void x264_lookahead_delete( x264_t *h )
     if( h->lookahead->last_nonb )
         x264_frame_push_unused( h, h->lookahead->last_nonb );
     x264_sync_frame_list_delete( &h->lookahead->ofbuf );
+    if( h->lookahead->share_out )
+    {
+        x264_pthread_mutex_lock( &h->lookahead->share_out->mutex );
+        h->lookahead->share_out->b_closed = 1;
+        x264_pthread_cond_broadcast( &h->lookahead->share_out->cv_fill );
+        x264_pthread_mutex_unlock( &h->lookahead->share_out->mutex );
+        x264_lookahead_share_unref( h->lookahead->share_out );
+    }
+    if( h->lookahead->share_in )
+        x264_lookahead_share_unref( h->lookahead->share_in );
     x264_free( h->lookahead );
 }
 
@@ -233,7 +339,7 @@ void x264_lookahead_get_frames( x264_t *h )
         if( h->frames.current[0] || !h->lookahead->next.i_size )
             return;
 
-        x264_stack_align( x264_slicetype_decide, h );
+        x264_lookahead_decide( h );
         x264_lookahead_update_last_nonb( h, h->lookahead->next.list[0] );
         x264_lookahead_shift( &h->lookahead->ofbuf, &h->lookahead->next, h->lookahead->next.list[0]->i_bframes + 1 );
 
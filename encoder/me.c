@@ -180,7 +180,7 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
     const int bh = x264_pixel_size[m->i_pixel].h;
     const int i_pixel = m->i_pixel;
     const int stride = m->i_stride[0];
-    int i_me_range = h->param.analyse.i_me_range;
+    int i_me_range = h->mb.i_me_range;
     int bmx, bmy, bcost;
     int bpred_mx = 0, bpred_my = 0, bpred_cost = COST_MAX;
     int omx, omy, pmx, pmy;
@@ -374,6 +374,34 @@ void x264_me_search_ref( x264_t *h, x264_me_t *m, int16_t (*mvc)[2], int i_mvc,
             break;
         }
 
+        case X264_ME_HASH:
+        {
+            /* Screen content is mostly exact copies of earlier content: try every block
+             * of the reference that hashes like one of our 8x8 quadrants, and skip the
+             * search altogether if the best candidate so far is an exact match.
+             * The tables hash unweighted pixels, so weighted refs go straight to UMH. */
+            if( bw >= 8 && bh >= 8 && !m->weight[0].weightfn )
+            {
+                int fenc_offset = m->p_fenc[0] - h->mb.pic.p_fenc[0];
+                int bx = 16*h->mb.i_mb_x + fenc_offset % FENC_STRIDE;
+                int by = 16*h->mb.i_mb_y + fenc_offset / FENC_STRIDE;
+                for( int qy = 0; qy < bh; qy += 8 )
+                    for( int qx = 0; qx < bw; qx += 8 )
+                    {
+                        uint32_t hash = x264_hash_block8( p_fenc + qx + qy*FENC_STRIDE, FENC_STRIDE );
+                        uint32_t pos = m->hash[x264_hash_bucket( hash, h->fdec->i_hash_mask )];
+                        /* empty buckets and blocks below the rows finished by other
+                         * frame threads both fall outside the mv range */
+                        int mx = (int)(pos & 0xffff) - qx - bx;
+                        int my = (int)(pos >> 16) - qy - by;
+                        if( mx >= mv_x_min && mx <= mv_x_max && my >= mv_y_min && my <= mv_y_max )
+                            COST_MV( mx, my );
+                    }
+            }
+            if( !h->pixf.fpelcmp[i_pixel]( p_fenc, FENC_STRIDE, &p_fref_w[bmy*stride+bmx], stride ) )
+                break;
+        }
+        /* fall through */
         case X264_ME_UMH:
         {
             /* Uneven-cross Multi-Hexagon-grid Search
@@ -45,6 +45,7 @@ typedef struct
     pixel *p_fref_w;
     pixel *p_fenc[3];
     uint16_t *integral;
+    uint32_t *hash;
     int      i_stride[3];
 
     ALIGNED_4( int16_t mvp[2] );
@@ -72,8 +73,6 @@ void x264_me_refine_bidir_rd( x264_t *h, x264_me_t *m0, x264_me_t *m1, int i_wei
 void x264_me_refine_bidir_satd( x264_t *h, x264_me_t *m0, x264_me_t *m1, int i_weight );
 uint64_t x264_rd_cost_part( x264_t *h, int i_lambda2, int i8, int i_pixel );
 
-extern uint16_t *x264_cost_mv_fpel[QP_MAX+1][4];
-
 #define COPY1_IF_LT(x,y)\
 if((y)<(x))\
     (x)=(y);
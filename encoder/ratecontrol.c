@@ -34,6 +34,10 @@
 #include "ratecontrol.h"
 #include "me.h"
 
+#if HAVE_MMAP
+#include <sys/mman.h>
+#endif
+
 typedef struct
 {
     int pict_type;
@@ -69,6 +73,33 @@ typedef struct
     float offset;
 } predictor_t;
 
+/* Read-only view of a whole stats file. */
+typedef struct
+{
+    uint8_t *data;
+    size_t size;
+    int b_mapped;   /* data is an mmap of the file rather than a copy in memory */
+} x264_stat_map_t;
+
+/* Windowed 2nd pass: stats are read and bits planned a window at a time, with
+ * entries kept in a ring indexed by frame number.  Shared by all threads. */
+typedef struct
+{
+    x264_pthread_mutex_t mutex;
+    x264_stat_map_t map;
+    size_t pos;             /* offset of the next record in map */
+    char *line;             /* text records are copied here to be parsed */
+    int b_error;
+    int i_size;             /* frames per window */
+    int i_loaded;           /* records read so far */
+    int i_cleared;          /* entries reset, ready for their record */
+    int i_planned;          /* frames whose bits have been planned */
+    double qp_aq_sum;       /* of the records read */
+    double duration;        /* of the planned frames, in seconds */
+    double planned_bits;    /* expected size of the planned frames */
+    double vbv_init;        /* expected buffer fullness after them, as a fraction */
+} x264_pass2_window_t;
+
 struct x264_ratecontrol_t
 {
     /* constants */
@@ -124,9 +155,19 @@ struct x264_ratecontrol_t
     char *psz_mbtree_stat_file_tmpname;
     char *psz_mbtree_stat_file_name;
     FILE *p_mbtree_stat_file_in;
+    int b_stat_binary_in;       /* 1st pass stats are in the binary format */
+    FILE *p_analysis_file_out;
+    char *psz_analysis_file_tmpname;
+    char *psz_analysis_file_name;
+    FILE *p_analysis_file_in;
+    uint8_t *analysis_buffer;
 
     int num_entries;            /* number of ratecontrol_entry_ts */
     ratecontrol_entry_t *entry; /* FIXME: copy needed data and free this once init is done */
+    int i_entry_size;           /* number of entries allocated: less than num_entries with a window */
+    x264_pass2_window_t *win;
+    float res_factor;           /* scaling of 1st pass stats to the 2nd pass resolution */
+    float res_factor_bits;
     double last_qscale;
     double last_qscale_for[3];  /* last qscale for a specific pict type, used for max_diff & ipb factor stuff */
     int last_non_b_pict_type;
@@ -138,10 +179,15 @@ struct x264_ratecontrol_t
     double lstep;               /* max change (multiply) in qscale per frame */
     struct
     {
-        uint16_t *qp_buffer[2]; /* Global buffers for converting MB-tree quantizer data. */
-        int qpbuf_pos;          /* In order to handle pyramid reordering, QP buffer acts as a stack.
-                                 * This value is the current position (0 or 1). */
+        uint8_t *qp_buffer[2];  /* Global buffers for converting MB-tree quantizer data. */
+        const uint8_t *qp_frame[2]; /* In order to handle pyramid reordering, frames read ahead are kept
+                                 * as a stack: each points into qp_buffer, or into the mapped file. */
+        int qpbuf_pos;          /* Current position in the stack (0 or 1). */
         int src_mb_count;
+        int bytes_per_mb;       /* 2 for FIX8.8 offsets, 1 for compact ones */
+        int compact_shift;      /* fractional bits of compact offsets */
+        x264_stat_map_t map;    /* mapping of the input file, if available */
+        size_t map_pos;
 
         /* For rescaling */
         int rescale_enabled;
@@ -176,9 +222,16 @@ struct x264_ratecontrol_t
     uint64_t hrd_multiply_denom;
 };
 
+static ALWAYS_INLINE ratecontrol_entry_t *rc_entry( x264_ratecontrol_t *rc, int frame )
+{
+    return &rc->entry[frame % rc->i_entry_size];
+}
+
 
 static int parse_zones( x264_t *h );
 static int init_pass2(x264_t *);
+static int pass2_plan_window( x264_t *h );
+static void x264_stat_window_need( x264_t *h, int frame );
 static float rate_estimate_qscale( x264_t *h );
 static int update_vbv( x264_t *h, int bits );
 static void update_vbv_plan( x264_t *h, int overhead );
@@ -420,7 +473,7 @@ static int x264_macroblock_tree_rescale_init( x264_t *h, x264_ratecontrol_t *rc
     rc->mbtree.src_mb_count = srcdimi[0] * srcdimi[1];
 
     CHECKED_MALLOC( rc->mbtree.qp_buffer[0], rc->mbtree.src_mb_count * sizeof(uint16_t) );
-    if( h->param.i_bframe_pyramid && h->param.rc.b_stat_read )
+    if( h->param.i_bframe_pyramid && h->param.rc.b_stat_read && !rc->mbtree.map.data )
         CHECKED_MALLOC( rc->mbtree.qp_buffer[1], rc->mbtree.src_mb_count * sizeof(uint16_t) );
     rc->mbtree.qpbuf_pos = -1;
 
@@ -528,12 +581,129 @@ static void x264_macroblock_tree_rescale( x264_t *h, x264_ratecontrol_t *rc, flo
     }
 }
 
+/* Stats files are mapped where the platform allows it; otherwise, if b_copy is set,
+ * they're read whole into memory. */
+static int x264_stat_map_init( x264_stat_map_t *m, FILE *fh, int b_copy )
+{
+    int64_t size;
+    memset( m, 0, sizeof(x264_stat_map_t) );
+    if( fseek( fh, 0, SEEK_END ) < 0 || (size = ftell( fh )) <= 0 || fseek( fh, 0, SEEK_SET ) < 0 ||
+        (uint64_t)size > SIZE_MAX )
+        return -1;
+    m->size = size;
+#if HAVE_MMAP
+    if( x264_is_regular_file( fh ) )
+    {
+        m->data = mmap( NULL, m->size, PROT_READ, MAP_PRIVATE, fileno( fh ), 0 );
+        if( m->data != MAP_FAILED )
+        {
+            m->b_mapped = 1;
+            return 0;
+        }
+        m->data = NULL;
+    }
+#endif
+    if( !b_copy )
+        return -1;
+    m->data = x264_malloc( m->size );
+    if( !m->data )
+        return -1;
+    if( fread( m->data, 1, m->size, fh ) != m->size )
+    {
+        x264_free( m->data );
+        m->data = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void x264_stat_map_close( x264_stat_map_t *m )
+{
+#if HAVE_MMAP
+    if( m->b_mapped )
+        munmap( m->data, m->size );
+    else
+#endif
+    x264_free( m->data );
+    m->data = NULL;
+    m->b_mapped = 0;
+}
+
+/* MB-tree stats file: for each reference frame in coded order, the slice type followed by
+ * the qp offset of each MB as big-endian FIX8.8.  Compact files start with a header, the
+ * magic, version, and number of fractional bits, and store the offsets as int8 instead. */
+#define MBTREE_MAGIC "x264mbtr"
+#define MBTREE_VERSION 1
+#define MBTREE_HEADER_SIZE 10
+#define MBTREE_COMPACT_SHIFT 2
+
+static int x264_macroblock_tree_read_init( x264_t *h, x264_ratecontrol_t *rc )
+{
+    uint8_t header[MBTREE_HEADER_SIZE];
+    int header_size = 0;
+    rc->mbtree.bytes_per_mb = 2;
+    /* Legacy files have no header: they start with a slice type, which can't match the magic. */
+    if( fread( header, 1, MBTREE_HEADER_SIZE, rc->p_mbtree_stat_file_in ) == MBTREE_HEADER_SIZE &&
+        !memcmp( header, MBTREE_MAGIC, 8 ) )
+    {
+        if( header[8] != MBTREE_VERSION || header[9] > 7 )
+        {
+            x264_log( h, X264_LOG_ERROR, "unsupported mbtree stats file version %d\n", header[8] );
+            return -1;
+        }
+        rc->mbtree.bytes_per_mb = 1;
+        rc->mbtree.compact_shift = header[9];
+        header_size = MBTREE_HEADER_SIZE;
+    }
+    if( !x264_stat_map_init( &rc->mbtree.map, rc->p_mbtree_stat_file_in, 0 ) )
+        rc->mbtree.map_pos = header_size;
+    else if( fseek( rc->p_mbtree_stat_file_in, header_size, SEEK_SET ) < 0 )
+        return -1;
+    return 0;
+}
+
+static int x264_macroblock_tree_read_frame( x264_ratecontrol_t *rc, uint8_t *i_type )
+{
+    int pos = rc->mbtree.qpbuf_pos;
+    size_t size = (size_t)rc->mbtree.src_mb_count * rc->mbtree.bytes_per_mb;
+    if( rc->mbtree.map.data )
+    {
+        if( rc->mbtree.map.size - rc->mbtree.map_pos < size + 1 )
+            return -1;
+        *i_type = rc->mbtree.map.data[rc->mbtree.map_pos];
+        rc->mbtree.qp_frame[pos] = rc->mbtree.map.data + rc->mbtree.map_pos + 1;
+        rc->mbtree.map_pos += size + 1;
+        return 0;
+    }
+    if( !fread( i_type, 1, 1, rc->p_mbtree_stat_file_in ) )
+        return -1;
+    if( fread( rc->mbtree.qp_buffer[pos], 1, size, rc->p_mbtree_stat_file_in ) != size )
+        return -1;
+    rc->mbtree.qp_frame[pos] = rc->mbtree.qp_buffer[pos];
+    return 0;
+}
+
+/* Skip the offsets of the given number of reference frames. */
+static int x264_macroblock_tree_skip( x264_ratecontrol_t *rc, int frames )
+{
+    int64_t size = (int64_t)frames * (rc->mbtree.src_mb_count * rc->mbtree.bytes_per_mb + 1);
+    if( rc->mbtree.map.data )
+    {
+        if( rc->mbtree.map.size - rc->mbtree.map_pos < size )
+            return -1;
+        rc->mbtree.map_pos += size;
+        return 0;
+    }
+    return fseek( rc->p_mbtree_stat_file_in, size, SEEK_CUR );
+}
+
 int x264_macroblock_tree_read( x264_t *h, x264_frame_t *frame, float *quant_offsets )
 {
     x264_ratecontrol_t *rc = h->rc;
-    uint8_t i_type_actual = rc->entry[frame->i_frame].pict_type;
+    x264_stat_window_need( h, frame->i_frame );
+    uint8_t i_type_actual = rc_entry( rc, frame->i_frame )->pict_type;
 
-    if( rc->entry[frame->i_frame].kept_as_ref )
+    if( rc_entry( rc, frame->i_frame )->kept_as_ref )
     {
         uint8_t i_type;
         if( rc->mbtree.qpbuf_pos < 0 )
@@ -542,9 +712,7 @@ int x264_macroblock_tree_read( x264_t *h, x264_frame_t *frame, float *quant_offs
             {
                 rc->mbtree.qpbuf_pos++;
 
-                if( !fread( &i_type, 1, 1, rc->p_mbtree_stat_file_in ) )
-                    goto fail;
-                if( fread( rc->mbtree.qp_buffer[rc->mbtree.qpbuf_pos], sizeof(uint16_t), rc->mbtree.src_mb_count, rc->p_mbtree_stat_file_in ) != rc->mbtree.src_mb_count )
+                if( x264_macroblock_tree_read_frame( rc, &i_type ) < 0 )
                     goto fail;
 
                 if( i_type != i_type_actual && rc->mbtree.qpbuf_pos == 1 )
@@ -556,11 +724,19 @@ int x264_macroblock_tree_read( x264_t *h, x264_frame_t *frame, float *quant_offs
         }
 
         float *dst = rc->mbtree.rescale_enabled ? rc->mbtree.scale_buffer[0] : frame->f_qp_offset;
-        for( int i = 0; i < rc->mbtree.src_mb_count; i++ )
+        const uint8_t *src = rc->mbtree.qp_frame[rc->mbtree.qpbuf_pos];
+        if( rc->mbtree.bytes_per_mb == 1 )
         {
-            int16_t qp_fix8 = endian_fix16( rc->mbtree.qp_buffer[rc->mbtree.qpbuf_pos][i] );
-            dst[i] = qp_fix8 * (1.f/256.f);
+            float scale = 1.f / (1 << rc->mbtree.compact_shift);
+            for( int i = 0; i < rc->mbtree.src_mb_count; i++ )
+                dst[i] = (int8_t)src[i] * scale;
         }
+        else
+            for( int i = 0; i < rc->mbtree.src_mb_count; i++ )
+            {
+                int16_t qp_fix8 = (src[2*i] << 8) | src[2*i+1];
+                dst[i] = qp_fix8 * (1.f/256.f);
+            }
         if( rc->mbtree.rescale_enabled )
             x264_macroblock_tree_rescale( h, rc, frame->f_qp_offset );
         if( h->frames.b_have_lowres )
@@ -735,6 +911,466 @@ void x264_ratecontrol_init_reconfigurable( x264_t *h, int b_init )
     }
 }
 
+/* Binary stats file: the magic and version, the "#options:" line of the text format,
+ * then one fixed-size record per frame in coded order.  All fields are big-endian:
+ * in, out (int32), type, direct (char), dur, cpbdur (int64), q, aq (float), tex, mv,
+ * misc, imb, pmb, smb (int32), the number of refs and 16 refcounts (int32), then
+ * luma denom/scale/offset and chroma denom/scale/offset/scale/offset (int16), with
+ * a denom of -1 meaning no weights. */
+#define STATS_MAGIC "x264stat"
+#define STATS_VERSION 1
+#define STATS_HEADER_SIZE 9
+#define STATS_RECORD_SIZE 139
+
+static uint8_t *x264_stat_put( uint8_t *p, uint64_t val, int bytes )
+{
+    for( int i = bytes-1; i >= 0; i-- )
+        *p++ = val >> (8*i);
+    return p;
+}
+
+static uint64_t x264_stat_get( const uint8_t **p, int bytes )
+{
+    uint64_t val = 0;
+    for( int i = 0; i < bytes; i++ )
+        val = (val << 8) | *(*p)++;
+    return val;
+}
+
+static uint32_t x264_stat_float_bits( float f )
+{
+    union { float f; uint32_t i; } u = { f };
+    return u.i;
+}
+
+static float x264_stat_bits_float( uint32_t i )
+{
+    union { uint32_t i; float f; } u = { i };
+    return u.f;
+}
+
+static int x264_stat_record_write( x264_t *h, char c_type, char c_direct, int *refcount, int refs )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    uint8_t buf[STATS_RECORD_SIZE] = {0};
+    uint8_t *p = buf;
+    p = x264_stat_put( p, h->fenc->i_frame, 4 );
+    p = x264_stat_put( p, h->i_frame, 4 );
+    *p++ = c_type;
+    *p++ = c_direct;
+    p = x264_stat_put( p, h->fenc->i_duration, 8 );
+    p = x264_stat_put( p, h->fenc->i_cpb_duration, 8 );
+    p = x264_stat_put( p, x264_stat_float_bits( rc->qpa_rc ), 4 );
+    p = x264_stat_put( p, x264_stat_float_bits( h->fdec->f_qp_avg_aq ), 4 );
+    p = x264_stat_put( p, h->stat.frame.i_tex_bits, 4 );
+    p = x264_stat_put( p, h->stat.frame.i_mv_bits, 4 );
+    p = x264_stat_put( p, h->stat.frame.i_misc_bits, 4 );
+    p = x264_stat_put( p, h->stat.frame.i_mb_count_i, 4 );
+    p = x264_stat_put( p, h->stat.frame.i_mb_count_p, 4 );
+    p = x264_stat_put( p, h->stat.frame.i_mb_count_skip, 4 );
+    *p++ = refs;
+    for( int i = 0; i < 16; i++ )
+        p = x264_stat_put( p, i < refs ? refcount[i] : 0, 4 );
+    int16_t w[8] = { -1, 0, 0, -1, 0, 0, 0, 0 };
+    if( h->param.analyse.i_weighted_pred >= X264_WEIGHTP_SIMPLE && h->sh.weight[0][0].weightfn )
+    {
+        w[0] = h->sh.weight[0][0].i_denom;
+        w[1] = h->sh.weight[0][0].i_scale;
+        w[2] = h->sh.weight[0][0].i_offset;
+        if( h->sh.weight[0][1].weightfn || h->sh.weight[0][2].weightfn )
+        {
+            w[3] = h->sh.weight[0][1].i_denom;
+            w[4] = h->sh.weight[0][1].i_scale;
+            w[5] = h->sh.weight[0][1].i_offset;
+            w[6] = h->sh.weight[0][2].i_scale;
+            w[7] = h->sh.weight[0][2].i_offset;
+        }
+    }
+    for( int i = 0; i < 8; i++ )
+        p = x264_stat_put( p, (uint16_t)w[i], 2 );
+    return fwrite( buf, 1, STATS_RECORD_SIZE, rc->p_stat_file_out ) < STATS_RECORD_SIZE ? -1 : 0;
+}
+
+/* Entries of frames missing from the stats are skipped P-frames. */
+static ratecontrol_entry_t *x264_stat_entry_reset( x264_ratecontrol_t *rc, int frame )
+{
+    ratecontrol_entry_t *rce = rc_entry( rc, frame );
+    memset( rce, 0, sizeof(ratecontrol_entry_t) );
+    rce->pict_type = SLICE_TYPE_P;
+    rce->qscale = rce->new_qscale = qp2qscale( 20 );
+    rce->misc_bits = rc->nmb + 10;
+    return rce;
+}
+
+/* Returns the entry the record describes, or NULL if the frame number is out of range. */
+static ratecontrol_entry_t *x264_stat_record_read( x264_ratecontrol_t *rc, const uint8_t *p,
+                                                   char *pict_type, float *qp_rc, float *qp_aq )
+{
+    int frame_number = (int32_t)x264_stat_get( &p, 4 );
+    if( frame_number < 0 || frame_number >= rc->num_entries )
+        return NULL;
+    ratecontrol_entry_t *rce = x264_stat_entry_reset( rc, frame_number );
+    p += 4; /* out */
+    *pict_type = *p++;
+    rce->direct_mode = *p++;
+    rce->i_duration = x264_stat_get( &p, 8 );
+    rce->i_cpb_duration = x264_stat_get( &p, 8 );
+    *qp_rc = x264_stat_bits_float( x264_stat_get( &p, 4 ) );
+    *qp_aq = x264_stat_bits_float( x264_stat_get( &p, 4 ) );
+    rce->tex_bits  = (int32_t)x264_stat_get( &p, 4 );
+    rce->mv_bits   = (int32_t)x264_stat_get( &p, 4 );
+    rce->misc_bits = (int32_t)x264_stat_get( &p, 4 );
+    rce->i_count   = (int32_t)x264_stat_get( &p, 4 );
+    rce->p_count   = (int32_t)x264_stat_get( &p, 4 );
+    rce->s_count   = (int32_t)x264_stat_get( &p, 4 );
+    rce->refs = X264_MIN( p[0], 16 );
+    p++;
+    for( int i = 0; i < 16; i++ )
+        rce->refcount[i] = (int32_t)x264_stat_get( &p, 4 );
+    rce->i_weight_denom[0] = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[0][0]      = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[0][1]      = (int16_t)x264_stat_get( &p, 2 );
+    rce->i_weight_denom[1] = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[1][0]      = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[1][1]      = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[2][0]      = (int16_t)x264_stat_get( &p, 2 );
+    rce->weight[2][1]      = (int16_t)x264_stat_get( &p, 2 );
+    return rce;
+}
+
+/* Parse one stats record into its entry: a text line without its ';', or a binary record.
+ * i is the record's position in the file. */
+static int x264_stat_parse_record( x264_t *h, char *p, int i, float *qp_aq )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    ratecontrol_entry_t *rce;
+    int frame_number = -1;
+    char pict_type;
+    int e;
+    float qp_rc;
+    int ref;
+
+    if( rc->b_stat_binary_in )
+    {
+        rce = x264_stat_record_read( rc, (uint8_t*)p, &pict_type, &qp_rc, qp_aq );
+        if( !rce )
+        {
+            x264_log( h, X264_LOG_ERROR, "bad frame number at stats record %d\n", i );
+            return -1;
+        }
+        e = 13;
+        goto parse_type;
+    }
+
+    e = sscanf( p, " in:%d ", &frame_number );
+
+    if( frame_number < 0 || frame_number >= rc->num_entries )
+    {
+        x264_log( h, X264_LOG_ERROR, "bad frame number (%d) at stats line %d\n", frame_number, i );
+        return -1;
+    }
+    rce = x264_stat_entry_reset( rc, frame_number );
+
+    e += sscanf( p, " in:%*d out:%*d type:%c dur:%"SCNd64" cpbdur:%"SCNd64" q:%f aq:%f tex:%d mv:%d misc:%d imb:%d pmb:%d smb:%d d:%c",
+           &pict_type, &rce->i_duration, &rce->i_cpb_duration, &qp_rc, qp_aq, &rce->tex_bits,
+           &rce->mv_bits, &rce->misc_bits, &rce->i_count, &rce->p_count,
+           &rce->s_count, &rce->direct_mode );
+
+    p = strstr( p, "ref:" );
+    if( !p )
+        goto parse_error;
+    p += 4;
+    for( ref = 0; ref < 16; ref++ )
+    {
+        if( sscanf( p, " %d", &rce->refcount[ref] ) != 1 )
+            break;
+        p = strchr( p+1, ' ' );
+        if( !p )
+            goto parse_error;
+    }
+    rce->refs = ref;
+
+    /* find weights */
+    rce->i_weight_denom[0] = rce->i_weight_denom[1] = -1;
+    char *w = strchr( p, 'w' );
+    if( w )
+    {
+        int count = sscanf( w, "w:%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd",
+                            &rce->i_weight_denom[0], &rce->weight[0][0], &rce->weight[0][1],
+                            &rce->i_weight_denom[1], &rce->weight[1][0], &rce->weight[1][1],
+                            &rce->weight[2][0], &rce->weight[2][1] );
+        if( count == 3 )
+            rce->i_weight_denom[1] = -1;
+        else if ( count != 8 )
+            rce->i_weight_denom[0] = rce->i_weight_denom[1] = -1;
+    }
+
+parse_type:
+    rce->tex_bits  *= rc->res_factor_bits;
+    rce->mv_bits   *= rc->res_factor_bits;
+    rce->misc_bits *= rc->res_factor_bits;
+    rce->i_count   *= rc->res_factor;
+    rce->p_count   *= rc->res_factor;
+    rce->s_count   *= rc->res_factor;
+
+    if( pict_type != 'b' )
+        rce->kept_as_ref = 1;
+    switch( pict_type )
+    {
+        case 'I':
+            rce->frame_type = X264_TYPE_IDR;
+            rce->pict_type  = SLICE_TYPE_I;
+            break;
+        case 'i':
+            rce->frame_type = X264_TYPE_I;
+            rce->pict_type  = SLICE_TYPE_I;
+            break;
+        case 'P':
+            rce->frame_type = X264_TYPE_P;
+            rce->pict_type  = SLICE_TYPE_P;
+            break;
+        case 'B':
+            rce->frame_type = X264_TYPE_BREF;
+            rce->pict_type  = SLICE_TYPE_B;
+            break;
+        case 'b':
+            rce->frame_type = X264_TYPE_B;
+            rce->pict_type  = SLICE_TYPE_B;
+            break;
+        default:  e = -1; break;
+    }
+    if( e < 13 )
+    {
+parse_error:
+        x264_log( h, X264_LOG_ERROR, "statistics are damaged at line %d, parser out=%d\n", i, e );
+        return -1;
+    }
+    rce->qscale = qp2qscale( qp_rc );
+    return 0;
+}
+
+#define STATS_LINE_MAX 1024
+
+/* Read records until every frame up to and including frame has its entry.  Records are
+ * in coded order, which is at most i_bframe frames behind display order.  Must be called
+ * with the window locked. */
+static void x264_stat_window_load( x264_t *h, int frame )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    x264_pass2_window_t *win = rc->win;
+    int bframes = h->param.i_bframe;
+    int last = X264_MIN( frame + bframes + 1, rc->num_entries );
+    while( win->i_loaded < last && !win->b_error )
+    {
+        /* reset the entries of every frame the next record could describe */
+        int clear = X264_MIN( win->i_loaded + bframes + 2, rc->num_entries );
+        for( ; win->i_cleared < clear; win->i_cleared++ )
+            x264_stat_entry_reset( rc, win->i_cleared );
+
+        char *record;
+        float qp_aq;
+        if( rc->b_stat_binary_in )
+        {
+            record = (char*)win->map.data + win->pos;
+            win->pos += STATS_RECORD_SIZE;
+        }
+        else
+        {
+            uint8_t *start = win->map.data + win->pos;
+            uint8_t *end = memchr( start, ';', win->map.size - win->pos );
+            if( !end || end - start >= STATS_LINE_MAX )
+            {
+                x264_log( h, X264_LOG_ERROR, "statistics are damaged at line %d\n", win->i_loaded );
+                win->b_error = 1;
+                break;
+            }
+            memcpy( win->line, start, end - start );
+            win->line[end - start] = 0;
+            win->pos = end + 1 - win->map.data;
+            record = win->line;
+        }
+        /* the remaining frames keep their default entries */
+        if( x264_stat_parse_record( h, record, win->i_loaded, &qp_aq ) < 0 )
+        {
+            win->b_error = 1;
+            break;
+        }
+        win->qp_aq_sum += qp_aq;
+        win->i_loaded++;
+    }
+}
+
+static void x264_stat_window_need( x264_t *h, int frame )
+{
+    x264_pass2_window_t *win = h->rc->win;
+    if( !win )
+        return;
+    x264_pthread_mutex_lock( &win->mutex );
+    x264_stat_window_load( h, frame );
+    x264_pthread_mutex_unlock( &win->mutex );
+}
+
+/* Analysis reuse file: for each frame in coded order, a header (frame number as
+ * big-endian int32, slice type) followed by per-MB records of mb_type, partition,
+ * then for each list ref[4] and mv[4][2] (big-endian int16), one per 8x8 block. */
+#define ANALYSIS_FRAME_HEADER 5
+#define ANALYSIS_MB_SIZE (2 + 2*4*5)
+
+static int x264_analysis_reuse_write( x264_t *h )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    uint8_t *p = rc->analysis_buffer;
+    int i_frame = h->fenc->i_frame;
+    p[0] = i_frame >> 24;
+    p[1] = i_frame >> 16;
+    p[2] = i_frame >> 8;
+    p[3] = i_frame;
+    p[4] = h->sh.i_type;
+    p += ANALYSIS_FRAME_HEADER;
+    for( int mb_y = 0; mb_y < h->mb.i_mb_height; mb_y++ )
+        for( int mb_x = 0; mb_x < h->mb.i_mb_width; mb_x++ )
+        {
+            int mb_xy = mb_y * h->mb.i_mb_stride + mb_x;
+            *p++ = h->fdec->mb_type[mb_xy];
+            *p++ = h->fdec->mb_partition[mb_xy];
+            for( int l = 0; l < 2; l++ )
+            {
+                int b_list = l ? h->sh.i_type == SLICE_TYPE_B : h->sh.i_type != SLICE_TYPE_I;
+                for( int i = 0; i < 4; i++ )
+                {
+                    int b8 = (2*mb_y+(i>>1)) * h->mb.i_b8_stride + 2*mb_x + (i&1);
+                    int b4 = (4*mb_y+2*(i>>1)) * h->mb.i_b4_stride + 4*mb_x + 2*(i&1);
+                    int ref = b_list ? h->fdec->ref[l][b8] : -1;
+                    int mvx = ref >= 0 ? h->fdec->mv[l][b4][0] : 0;
+                    int mvy = ref >= 0 ? h->fdec->mv[l][b4][1] : 0;
+                    p[i] = ref;
+                    p[4+4*i+0] = mvx >> 8;
+                    p[4+4*i+1] = mvx;
+                    p[4+4*i+2] = mvy >> 8;
+                    p[4+4*i+3] = mvy;
+                }
+                p += 4*5;
+            }
+        }
+    if( fwrite( rc->analysis_buffer, 1, p - rc->analysis_buffer, rc->p_analysis_file_out ) < p - rc->analysis_buffer )
+        return -1;
+    return 0;
+}
+
+static void x264_analysis_reuse_read( x264_t *h )
+{
+    /* The file handle is shared by all frame threads: reads happen in coded order on the
+     * main thread, and closing it on error must be visible to the next frame. */
+    x264_ratecontrol_t *rc = h->thread[0]->rc;
+    x264_frame_t *frame = h->fenc;
+    int size = ANALYSIS_FRAME_HEADER + h->mb.i_mb_count * ANALYSIS_MB_SIZE;
+    uint8_t *p = rc->analysis_buffer;
+
+    if( !rc->p_analysis_file_in )
+        goto fail;
+    if( fread( p, 1, size, rc->p_analysis_file_in ) < size )
+    {
+        x264_log( h, X264_LOG_WARNING, "analysis file ended early, disabling analysis reuse\n" );
+        goto fail_close;
+    }
+    int i_frame = (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    if( i_frame != frame->i_frame + h->param.rc.i_chunk_start )
+    {
+        x264_log( h, X264_LOG_WARNING, "analysis file out of sync (frame %d, expected %d), disabling analysis reuse\n",
+                  i_frame, frame->i_frame + h->param.rc.i_chunk_start );
+        goto fail_close;
+    }
+    p += ANALYSIS_FRAME_HEADER;
+    for( int i = 0; i < h->mb.i_mb_count; i++ )
+    {
+        p += 2; /* mb_type, partition */
+        for( int l = 0; l < 2; l++ )
+        {
+            for( int j = 0; j < 4; j++ )
+            {
+                frame->reuse_ref[l][4*i+j] = (int8_t)p[j];
+                frame->reuse_mv[l][4*i+j][0] = (int16_t)((p[4+4*j+0] << 8) | p[4+4*j+1]);
+                frame->reuse_mv[l][4*i+j][1] = (int16_t)((p[4+4*j+2] << 8) | p[4+4*j+3]);
+            }
+            p += 4*5;
+        }
+    }
+    return;
+
+fail_close:
+    fclose( rc->p_analysis_file_in );
+    rc->p_analysis_file_in = NULL;
+fail:
+    memset( frame->reuse_ref[0], -1, 4 * h->mb.i_mb_count * sizeof(int8_t) );
+    memset( frame->reuse_ref[1], -1, 4 * h->mb.i_mb_count * sizeof(int8_t) );
+}
+
+/* Chunked encoding: cut the entries down to one closed-GOP chunk of the stats.  Chunk k
+ * starts at the first keyframe at or after k/i_chunks of the way through, so every
+ * chunk's encoder finds the same boundaries.  Bits were planned for the whole stream
+ * before this, so each chunk spends its share of the budget, and starts with the VBV
+ * fullness the plan expects there. */
+static int x264_ratecontrol_chunk_init( x264_t *h )
+{
+    x264_ratecontrol_t *rc = h->rc;
+    int bounds[2];
+    for( int j = 0; j < 2; j++ )
+    {
+        int i = (int64_t)rc->num_entries * (h->param.rc.i_chunk + j) / h->param.rc.i_chunks;
+        while( i < rc->num_entries && rc->entry[i].frame_type != X264_TYPE_IDR )
+            i++;
+        bounds[j] = i;
+    }
+    int start = bounds[0];
+    int end = bounds[1];
+    if( start >= end )
+    {
+        x264_log( h, X264_LOG_ERROR, "chunk %d is empty: the stats have too few keyframes for %d chunks\n",
+                  h->param.rc.i_chunk, h->param.rc.i_chunks );
+        return -1;
+    }
+
+    /* Closed GOPs: the frames before the chunk in display order are exactly the ones
+     * coded before it. */
+    int refs = 0;
+    int idrs = 0;
+    for( int i = 0; i < start; i++ )
+    {
+        refs += rc->entry[i].kept_as_ref;
+        idrs += rc->entry[i].frame_type == X264_TYPE_IDR;
+    }
+    if( rc->p_mbtree_stat_file_in && x264_macroblock_tree_skip( rc, refs ) < 0 )
+    {
+        x264_log( h, X264_LOG_ERROR, "mbtree stats file is too short for chunk %d\n", h->param.rc.i_chunk );
+        return -1;
+    }
+    if( rc->p_analysis_file_in &&
+        fseek( rc->p_analysis_file_in, (int64_t)start * (ANALYSIS_FRAME_HEADER + h->mb.i_mb_count * ANALYSIS_MB_SIZE), SEEK_CUR ) < 0 )
+    {
+        fclose( rc->p_analysis_file_in );
+        rc->p_analysis_file_in = NULL;
+    }
+    /* consecutive IDRs must have different ids */
+    h->i_idr_pic_id = idrs & 1;
+
+    if( start > 0 && rc->b_2pass && rc->b_vbv )
+    {
+        double fill = x264_clip3f( rc->entry[start-1].expected_vbv, 0, rc->buffer_size );
+        rc->buffer_fill_final = fill * h->sps->vui.i_time_scale;
+    }
+    uint64_t base_bits = rc->entry[start].expected_bits;
+    memmove( rc->entry, rc->entry + start, (end - start) * sizeof(ratecontrol_entry_t) );
+    rc->num_entries = rc->i_entry_size = end - start;
+    for( int i = 0; i < rc->num_entries; i++ )
+        rc->entry[i].expected_bits -= base_bits;
+
+    h->param.rc.i_chunk_start = start;
+    h->param.i_frame_total = end - start;
+    x264_log( h, X264_LOG_INFO, "chunk %d of %d: frames %d to %d\n",
+              h->param.rc.i_chunk, h->param.rc.i_chunks, start, end-1 );
+    return 0;
+}
+
 int x264_ratecontrol_new( x264_t *h )
 {
     x264_ratecontrol_t *rc;
@@ -858,15 +1494,64 @@ int x264_ratecontrol_new( x264_t *h )
     if( h->param.rc.b_stat_read )
     {
         char *p, *stats_in, *stats_buf;
+        x264_stat_map_t stats_map;
+        const uint8_t *stats_records = NULL;
 
         /* read 1st pass stats */
         assert( h->param.rc.psz_stat_in );
-        stats_buf = stats_in = x264_slurp_file( h->param.rc.psz_stat_in );
-        if( !stats_buf )
+        FILE *stats_file = fopen( h->param.rc.psz_stat_in, "rb" );
+        if( !stats_file || x264_stat_map_init( &stats_map, stats_file, 1 ) < 0 )
         {
+            if( stats_file )
+                fclose( stats_file );
             x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open stats file\n" );
             return -1;
         }
+        fclose( stats_file );
+        rc->b_stat_binary_in = stats_map.size >= STATS_HEADER_SIZE && !memcmp( stats_map.data, STATS_MAGIC, 8 );
+        if( rc->b_stat_binary_in && stats_map.data[8] != STATS_VERSION )
+        {
+            x264_log( h, X264_LOG_ERROR, "unsupported stats file version %d\n", stats_map.data[8] );
+            x264_stat_map_close( &stats_map );
+            return -1;
+        }
+        if( rc->b_stat_binary_in || h->param.rc.i_pass2_window )
+        {
+            /* Only the options line is copied out: records are read from the mapping. */
+            int header_size = rc->b_stat_binary_in ? STATS_HEADER_SIZE : 0;
+            uint8_t *opts_end = memchr( stats_map.data + header_size, '\n', stats_map.size - header_size );
+            if( !opts_end || (rc->b_stat_binary_in && (stats_map.data + stats_map.size - (opts_end+1)) % STATS_RECORD_SIZE) )
+            {
+                x264_log( h, X264_LOG_ERROR, rc->b_stat_binary_in ? "binary stats file is truncated\n"
+                                                                   : "options list in stats file not valid\n" );
+                x264_stat_map_close( &stats_map );
+                return -1;
+            }
+            stats_records = opts_end + 1;
+            size_t opts_size = stats_records - (stats_map.data + header_size);
+            stats_buf = x264_malloc( opts_size + 1 );
+            if( stats_buf )
+            {
+                memcpy( stats_buf, stats_map.data + header_size, opts_size );
+                stats_buf[opts_size] = 0;
+            }
+        }
+        else
+        {
+            stats_buf = x264_malloc( stats_map.size + 2 );
+            if( stats_buf )
+            {
+                size_t size = stats_map.size;
+                memcpy( stats_buf, stats_map.data, size );
+                if( stats_buf[size-1] != '\n' )
+                    stats_buf[size++] = '\n';
+                stats_buf[size] = 0;
+            }
+            x264_stat_map_close( &stats_map );
+        }
+        if( !stats_buf )
+            return -1;
+        stats_in = stats_buf;
         if( h->param.rc.b_mb_tree )
         {
             char *mbtree_stats_in = x264_strcat_filename( h->param.rc.psz_stat_in, ".mbtree" );
@@ -879,6 +1564,22 @@ int x264_ratecontrol_new( x264_t *h )
                 x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open mbtree stats file\n" );
                 return -1;
             }
+            if( x264_macroblock_tree_read_init( h, rc ) < 0 )
+                return -1;
+        }
+
+        if( h->param.rc.b_analysis_reuse )
+        {
+            char *analysis_in = x264_strcat_filename( h->param.rc.psz_stat_in, ".analysis" );
+            if( !analysis_in )
+                return -1;
+            rc->p_analysis_file_in = fopen( analysis_in, "rb" );
+            x264_free( analysis_in );
+            if( !rc->p_analysis_file_in )
+            {
+                x264_log( h, X264_LOG_WARNING, "can't open analysis file, disabling analysis reuse\n" );
+                h->param.rc.b_analysis_reuse = 0;
+            }
         }
 
         /* check whether 1st pass options were compatible with current options */
@@ -888,7 +1589,6 @@ int x264_ratecontrol_new( x264_t *h )
             return -1;
         }
 
-        float res_factor, res_factor_bits;
         {
             int i, j;
             uint32_t k, l;
@@ -908,10 +1608,17 @@ int x264_ratecontrol_new( x264_t *h )
                 rc->mbtree.srcdim[0] = i;
                 rc->mbtree.srcdim[1] = j;
             }
-            res_factor = (float)h->param.i_width * h->param.i_height / (i*j);
+            if( rc->p_analysis_file_in && (i != h->param.i_width || j != h->param.i_height) )
+            {
+                x264_log( h, X264_LOG_WARNING, "resolution differs from 1st pass, disabling analysis reuse\n" );
+                fclose( rc->p_analysis_file_in );
+                rc->p_analysis_file_in = NULL;
+                h->param.rc.b_analysis_reuse = 0;
+            }
+            rc->res_factor = (float)h->param.i_width * h->param.i_height / (i*j);
             /* Change in bits relative to resolution isn't quite linear on typical sources,
              * so we'll at least try to roughly approximate this effect. */
-            res_factor_bits = powf( res_factor, 0.7 );
+            rc->res_factor_bits = powf( rc->res_factor, 0.7 );
 
             if( ( p = strstr( opts, "timebase=" ) ) && sscanf( p, "timebase=%u/%u", &k, &l ) != 2 )
             {
@@ -981,10 +1688,22 @@ int x264_ratecontrol_new( x264_t *h )
         }
 
         /* find number of pics */
-        p = stats_in;
         int num_entries;
-        for( num_entries = -1; p; num_entries++ )
-            p = strchr( p + 1, ';' );
+        if( rc->b_stat_binary_in )
+            num_entries = (stats_map.data + stats_map.size - stats_records) / STATS_RECORD_SIZE;
+        else if( h->param.rc.i_pass2_window )
+        {
+            const uint8_t *end = stats_map.data + stats_map.size;
+            num_entries = 0;
+            for( const uint8_t *q = stats_records; (q = memchr( q, ';', end - q )); q++ )
+                num_entries++;
+        }
+        else
+        {
+            p = stats_in;
+            for( num_entries = -1; p; num_entries++ )
+                p = strchr( p + 1, ';' );
+        }
         if( !num_entries )
         {
             x264_log( h, X264_LOG_ERROR, "empty stats file\n" );
@@ -1004,123 +1723,64 @@ int x264_ratecontrol_new( x264_t *h )
             return -1;
         }
 
-        CHECKED_MALLOCZERO( rc->entry, rc->num_entries * sizeof(ratecontrol_entry_t) );
-
-        /* init all to skipped p frames */
-        for( int i = 0; i < rc->num_entries; i++ )
+        rc->i_entry_size = rc->num_entries;
+        if( h->param.rc.i_pass2_window )
         {
-            ratecontrol_entry_t *rce = &rc->entry[i];
-            rce->pict_type = SLICE_TYPE_P;
-            rce->qscale = rce->new_qscale = qp2qscale( 20 );
-            rce->misc_bits = rc->nmb + 10;
-            rce->new_qp = 0;
+            CHECKED_MALLOCZERO( rc->win, sizeof(x264_pass2_window_t) );
+            rc->win->map = stats_map;
+            rc->win->pos = stats_records - stats_map.data;
+            rc->win->i_size = h->param.rc.i_pass2_window;
+            rc->win->vbv_init = h->param.rc.f_vbv_buffer_init;
+            CHECKED_MALLOC( rc->win->line, STATS_LINE_MAX );
+            if( x264_pthread_mutex_init( &rc->win->mutex, NULL ) )
+                goto fail;
+            /* Frames in flight and in the lookahead need their entries on top of the window
+             * being planned. */
+            rc->i_entry_size = X264_MIN( rc->num_entries, 2 * (rc->win->i_size + h->frames.i_delay + h->param.i_bframe
+                                                               + h->param.i_threads) + 16 );
         }
+        CHECKED_MALLOCZERO( rc->entry, rc->i_entry_size * sizeof(ratecontrol_entry_t) );
+
+        /* init all to skipped p frames */
+        for( int i = 0; i < rc->i_entry_size; i++ )
+            x264_stat_entry_reset( rc, i );
 
         /* read stats */
-        p = stats_in;
         double total_qp_aq = 0;
-        for( int i = 0; i < rc->num_entries; i++ )
-        {
-            ratecontrol_entry_t *rce;
-            int frame_number;
-            char pict_type;
-            int e;
-            char *next;
-            float qp_rc, qp_aq;
-            int ref;
-
-            next= strchr(p, ';');
-            if( next )
-                *next++ = 0; //sscanf is unbelievably slow on long strings
-            e = sscanf( p, " in:%d ", &frame_number );
-
-            if( frame_number < 0 || frame_number >= rc->num_entries )
-            {
-                x264_log( h, X264_LOG_ERROR, "bad frame number (%d) at stats line %d\n", frame_number, i );
+        if( rc->win )
+        {
+            /* the picture's init qp is only an estimate: the first window will do */
+            x264_stat_window_load( h, X264_MIN( rc->win->i_size, rc->num_entries ) - 1 );
+            if( rc->win->b_error )
                 return -1;
-            }
-            rce = &rc->entry[frame_number];
-            rce->direct_mode = 0;
-
-            e += sscanf( p, " in:%*d out:%*d type:%c dur:%"SCNd64" cpbdur:%"SCNd64" q:%f aq:%f tex:%d mv:%d misc:%d imb:%d pmb:%d smb:%d d:%c",
-                   &pict_type, &rce->i_duration, &rce->i_cpb_duration, &qp_rc, &qp_aq, &rce->tex_bits,
-                   &rce->mv_bits, &rce->misc_bits, &rce->i_count, &rce->p_count,
-                   &rce->s_count, &rce->direct_mode );
-            rce->tex_bits  *= res_factor_bits;
-            rce->mv_bits   *= res_factor_bits;
-            rce->misc_bits *= res_factor_bits;
-            rce->i_count   *= res_factor;
-            rce->p_count   *= res_factor;
-            rce->s_count   *= res_factor;
-
-            p = strstr( p, "ref:" );
-            if( !p )
-                goto parse_error;
-            p += 4;
-            for( ref = 0; ref < 16; ref++ )
-            {
-                if( sscanf( p, " %d", &rce->refcount[ref] ) != 1 )
-                    break;
-                p = strchr( p+1, ' ' );
-                if( !p )
-                    goto parse_error;
-            }
-            rce->refs = ref;
-
-            /* find weights */
-            rce->i_weight_denom[0] = rce->i_weight_denom[1] = -1;
-            char *w = strchr( p, 'w' );
-            if( w )
-            {
-                int count = sscanf( w, "w:%hd,%hd,%hd,%hd,%hd,%hd,%hd,%hd",
-                                    &rce->i_weight_denom[0], &rce->weight[0][0], &rce->weight[0][1],
-                                    &rce->i_weight_denom[1], &rce->weight[1][0], &rce->weight[1][1],
-                                    &rce->weight[2][0], &rce->weight[2][1] );
-                if( count == 3 )
-                    rce->i_weight_denom[1] = -1;
-                else if ( count != 8 )
-                    rce->i_weight_denom[0] = rce->i_weight_denom[1] = -1;
-            }
-
-            if( pict_type != 'b' )
-                rce->kept_as_ref = 1;
-            switch( pict_type )
-            {
-                case 'I':
-                    rce->frame_type = X264_TYPE_IDR;
-                    rce->pict_type  = SLICE_TYPE_I;
-                    break;
-                case 'i':
-                    rce->frame_type = X264_TYPE_I;
-                    rce->pict_type  = SLICE_TYPE_I;
-                    break;
-                case 'P':
-                    rce->frame_type = X264_TYPE_P;
-                    rce->pict_type  = SLICE_TYPE_P;
-                    break;
-                case 'B':
-                    rce->frame_type = X264_TYPE_BREF;
-                    rce->pict_type  = SLICE_TYPE_B;
-                    break;
-                case 'b':
-                    rce->frame_type = X264_TYPE_B;
-                    rce->pict_type  = SLICE_TYPE_B;
-                    break;
-                default:  e = -1; break;
-            }
-            if( e < 13 )
+            total_qp_aq = rc->win->qp_aq_sum * rc->num_entries / rc->win->i_loaded;
+        }
+        else
+        {
+            p = stats_in;
+            for( int i = 0; i < rc->num_entries; i++ )
             {
-parse_error:
-                x264_log( h, X264_LOG_ERROR, "statistics are damaged at line %d, parser out=%d\n", i, e );
-                return -1;
+                char *next = NULL;
+                float qp_aq;
+                if( rc->b_stat_binary_in )
+                    p = (char*)stats_records + i * STATS_RECORD_SIZE;
+                else
+                {
+                    next = strchr(p, ';');
+                    if( next )
+                        *next++ = 0; //sscanf is unbelievably slow on long strings
+                }
+                if( x264_stat_parse_record( h, p, i, &qp_aq ) < 0 )
+                    return -1;
+                total_qp_aq += qp_aq;
+                p = next;
             }
-            rce->qscale = qp2qscale( qp_rc );
-            total_qp_aq += qp_aq;
-            p = next;
         }
         h->pps->i_pic_init_qp = SPEC_QP( (int)(total_qp_aq / rc->num_entries + 0.5) );
 
         x264_free( stats_buf );
+        if( !rc->win )
+            x264_stat_map_close( &stats_map );
 
         if( h->param.rc.i_rc_method == X264_RC_ABR )
         {
@@ -1146,6 +1806,12 @@ parse_error:
             return -1;
         }
 
+        if( h->param.rc.b_stat_binary )
+        {
+            uint8_t header[STATS_HEADER_SIZE] = STATS_MAGIC;
+            header[8] = STATS_VERSION;
+            fwrite( header, 1, STATS_HEADER_SIZE, rc->p_stat_file_out );
+        }
         p = x264_param2string( &h->param, 1 );
         if( p )
             fprintf( rc->p_stat_file_out, "#options: %s\n", p );
@@ -1163,9 +1829,33 @@ parse_error:
                 x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open mbtree stats file\n" );
                 return -1;
             }
+            if( h->param.rc.b_mb_tree_compact )
+            {
+                uint8_t header[MBTREE_HEADER_SIZE] = MBTREE_MAGIC;
+                header[8] = MBTREE_VERSION;
+                header[9] = MBTREE_COMPACT_SHIFT;
+                fwrite( header, 1, MBTREE_HEADER_SIZE, rc->p_mbtree_stat_file_out );
+            }
+        }
+        if( h->param.rc.b_analysis_reuse && !h->param.rc.b_stat_read )
+        {
+            rc->psz_analysis_file_tmpname = x264_strcat_filename( h->param.rc.psz_stat_out, ".analysis.temp" );
+            rc->psz_analysis_file_name = x264_strcat_filename( h->param.rc.psz_stat_out, ".analysis" );
+            if( !rc->psz_analysis_file_tmpname || !rc->psz_analysis_file_name )
+                return -1;
+
+            rc->p_analysis_file_out = fopen( rc->psz_analysis_file_tmpname, "wb" );
+            if( rc->p_analysis_file_out == NULL )
+            {
+                x264_log( h, X264_LOG_ERROR, "ratecontrol_init: can't open analysis file\n" );
+                return -1;
+            }
         }
     }
 
+    if( h->param.rc.b_analysis_reuse )
+        CHECKED_MALLOC( rc->analysis_buffer, ANALYSIS_FRAME_HEADER + h->mb.i_mb_count * ANALYSIS_MB_SIZE );
+
     if( h->param.rc.b_mb_tree && (h->param.rc.b_stat_read || h->param.rc.b_stat_write) )
     {
         if( !h->param.rc.b_stat_read )
@@ -1177,6 +1867,9 @@ parse_error:
             return -1;
     }
 
+    if( h->param.rc.i_chunks && x264_ratecontrol_chunk_init( h ) < 0 )
+        return -1;
+
     for( int i = 0; i<h->param.i_threads; i++ )
     {
         h->thread[i]->rc = rc+i;
@@ -1359,9 +2052,33 @@ void x264_ratecontrol_delete( x264_t *h )
     }
     if( rc->p_mbtree_stat_file_in )
         fclose( rc->p_mbtree_stat_file_in );
+    x264_stat_map_close( &rc->mbtree.map );
+    if( rc->p_analysis_file_out )
+    {
+        b_regular_file = x264_is_regular_file( rc->p_analysis_file_out );
+        fclose( rc->p_analysis_file_out );
+        if( h->i_frame >= rc->num_entries && b_regular_file )
+            if( rename( rc->psz_analysis_file_tmpname, rc->psz_analysis_file_name ) != 0 )
+            {
+                x264_log( h, X264_LOG_ERROR, "failed to rename \"%s\" to \"%s\"\n",
+                          rc->psz_analysis_file_tmpname, rc->psz_analysis_file_name );
+            }
+        x264_free( rc->psz_analysis_file_tmpname );
+        x264_free( rc->psz_analysis_file_name );
+    }
+    if( rc->p_analysis_file_in )
+        fclose( rc->p_analysis_file_in );
+    x264_free( rc->analysis_buffer );
     x264_free( rc->pred );
     x264_free( rc->pred_b_from_p );
     x264_free( rc->entry );
+    if( rc->win )
+    {
+        x264_stat_map_close( &rc->win->map );
+        x264_free( rc->win->line );
+        x264_pthread_mutex_destroy( &rc->win->mutex );
+        x264_free( rc->win );
+    }
     x264_macroblock_tree_rescale_destroy( rc );
     if( rc->zones )
     {
@@ -1404,7 +2121,22 @@ void x264_ratecontrol_start( x264_t *h, int i_force_qp, int overhead )
     {
         int frame = h->fenc->i_frame;
         assert( frame >= 0 && frame < rc->num_entries );
-        rce = h->rc->rce = &h->rc->entry[frame];
+        if( rc->win )
+        {
+            x264_pthread_mutex_lock( &rc->win->mutex );
+            x264_stat_window_load( h, frame );
+            while( rc->b_2pass && frame >= rc->win->i_planned )
+            {
+                /* planning goes through the state kept between frames */
+                x264_ratecontrol_t saved = *rc;
+                int ret = pass2_plan_window( h );
+                *rc = saved;
+                if( ret < 0 )
+                    break;
+            }
+            x264_pthread_mutex_unlock( &rc->win->mutex );
+        }
+        rce = h->rc->rce = rc_entry( rc, frame );
 
         if( h->sh.i_type == SLICE_TYPE_B
             && h->param.analyse.i_direct_mv_pred == X264_DIRECT_PRED_AUTO )
@@ -1412,6 +2144,9 @@ void x264_ratecontrol_start( x264_t *h, int i_force_qp, int overhead )
             h->sh.b_direct_spatial_mv_pred = ( rce->direct_mode == 's' );
             h->mb.b_direct_auto_read = ( rce->direct_mode == 's' || rce->direct_mode == 't' );
         }
+
+        if( h->fenc->reuse_ref[0] )
+            x264_analysis_reuse_read( h );
     }
 
     if( rc->b_vbv )
@@ -1752,7 +2487,8 @@ int x264_ratecontrol_slice_type( x264_t *h, int frame_num )
             }
             return X264_TYPE_AUTO;
         }
-        return rc->entry[frame_num].frame_type;
+        x264_stat_window_need( h, frame_num );
+        return rc_entry( rc, frame_num )->frame_type;
     }
     else
         return X264_TYPE_AUTO;
@@ -1760,7 +2496,7 @@ int x264_ratecontrol_slice_type( x264_t *h, int frame_num )
 
 void x264_ratecontrol_set_weights( x264_t *h, x264_frame_t *frm )
 {
-    ratecontrol_entry_t *rce = &h->rc->entry[frm->i_frame];
+    ratecontrol_entry_t *rce = rc_entry( h->rc, frm->i_frame );
     if( h->param.analyse.i_weighted_pred <= 0 )
         return;
 
@@ -1803,64 +2539,88 @@ int x264_ratecontrol_end( x264_t *h, int bits, int *filler )
                         ( dir_frame>0 ? 's' : dir_frame<0 ? 't' :
                           dir_avg>0 ? 's' : dir_avg<0 ? 't' : '-' )
                         : '-';
-        if( fprintf( rc->p_stat_file_out,
-                 "in:%d out:%d type:%c dur:%"PRId64" cpbdur:%"PRId64" q:%.2f aq:%.2f tex:%d mv:%d misc:%d imb:%d pmb:%d smb:%d d:%c ref:",
-                 h->fenc->i_frame, h->i_frame,
-                 c_type, h->fenc->i_duration,
-                 h->fenc->i_cpb_duration,
-                 rc->qpa_rc, h->fdec->f_qp_avg_aq,
-                 h->stat.frame.i_tex_bits,
-                 h->stat.frame.i_mv_bits,
-                 h->stat.frame.i_misc_bits,
-                 h->stat.frame.i_mb_count_i,
-                 h->stat.frame.i_mb_count_p,
-                 h->stat.frame.i_mb_count_skip,
-                 c_direct) < 0 )
-            goto fail;
 
         /* Only write information for reference reordering once. */
         int use_old_stats = h->param.rc.b_stat_read && rc->rce->refs > 1;
-        for( int i = 0; i < (use_old_stats ? rc->rce->refs : h->i_ref[0]); i++ )
+        int refs = use_old_stats ? rc->rce->refs : h->i_ref[0];
+        int refcount[16];
+        for( int i = 0; i < refs; i++ )
+            refcount[i] = use_old_stats         ? rc->rce->refcount[i]
+                        : PARAM_INTERLACED      ? h->stat.frame.i_mb_count_ref[0][i*2]
+                                                + h->stat.frame.i_mb_count_ref[0][i*2+1]
+                        :                         h->stat.frame.i_mb_count_ref[0][i];
+
+        if( h->param.rc.b_stat_binary )
         {
-            int refcount = use_old_stats         ? rc->rce->refcount[i]
-                         : PARAM_INTERLACED      ? h->stat.frame.i_mb_count_ref[0][i*2]
-                                                 + h->stat.frame.i_mb_count_ref[0][i*2+1]
-                         :                         h->stat.frame.i_mb_count_ref[0][i];
-            if( fprintf( rc->p_stat_file_out, "%d ", refcount ) < 0 )
+            if( x264_stat_record_write( h, c_type, c_direct, refcount, refs ) < 0 )
                 goto fail;
         }
-
-        if( h->param.analyse.i_weighted_pred >= X264_WEIGHTP_SIMPLE && h->sh.weight[0][0].weightfn )
+        else
         {
-            if( fprintf( rc->p_stat_file_out, "w:%d,%d,%d",
-                         h->sh.weight[0][0].i_denom, h->sh.weight[0][0].i_scale, h->sh.weight[0][0].i_offset ) < 0 )
+            if( fprintf( rc->p_stat_file_out,
+                     "in:%d out:%d type:%c dur:%"PRId64" cpbdur:%"PRId64" q:%.2f aq:%.2f tex:%d mv:%d misc:%d imb:%d pmb:%d smb:%d d:%c ref:",
+                     h->fenc->i_frame, h->i_frame,
+                     c_type, h->fenc->i_duration,
+                     h->fenc->i_cpb_duration,
+                     rc->qpa_rc, h->fdec->f_qp_avg_aq,
+                     h->stat.frame.i_tex_bits,
+                     h->stat.frame.i_mv_bits,
+                     h->stat.frame.i_misc_bits,
+                     h->stat.frame.i_mb_count_i,
+                     h->stat.frame.i_mb_count_p,
+                     h->stat.frame.i_mb_count_skip,
+                     c_direct) < 0 )
                 goto fail;
-            if( h->sh.weight[0][1].weightfn || h->sh.weight[0][2].weightfn )
+
+            for( int i = 0; i < refs; i++ )
+                if( fprintf( rc->p_stat_file_out, "%d ", refcount[i] ) < 0 )
+                    goto fail;
+
+            if( h->param.analyse.i_weighted_pred >= X264_WEIGHTP_SIMPLE && h->sh.weight[0][0].weightfn )
             {
-                if( fprintf( rc->p_stat_file_out, ",%d,%d,%d,%d,%d ",
-                             h->sh.weight[0][1].i_denom, h->sh.weight[0][1].i_scale, h->sh.weight[0][1].i_offset,
-                             h->sh.weight[0][2].i_scale, h->sh.weight[0][2].i_offset ) < 0 )
+                if( fprintf( rc->p_stat_file_out, "w:%d,%d,%d",
+                             h->sh.weight[0][0].i_denom, h->sh.weight[0][0].i_scale, h->sh.weight[0][0].i_offset ) < 0 )
+                    goto fail;
+                if( h->sh.weight[0][1].weightfn || h->sh.weight[0][2].weightfn )
+                {
+                    if( fprintf( rc->p_stat_file_out, ",%d,%d,%d,%d,%d ",
+                                 h->sh.weight[0][1].i_denom, h->sh.weight[0][1].i_scale, h->sh.weight[0][1].i_offset,
+                                 h->sh.weight[0][2].i_scale, h->sh.weight[0][2].i_offset ) < 0 )
+                        goto fail;
+                }
+                else if( fprintf( rc->p_stat_file_out, " " ) < 0 )
                     goto fail;
             }
-            else if( fprintf( rc->p_stat_file_out, " " ) < 0 )
+
+            if( fprintf( rc->p_stat_file_out, ";\n") < 0 )
                 goto fail;
         }
 
-        if( fprintf( rc->p_stat_file_out, ";\n") < 0 )
-            goto fail;
-
         /* Don't re-write the data in multi-pass mode. */
         if( h->param.rc.b_mb_tree && h->fenc->b_kept_as_ref && !h->param.rc.b_stat_read )
         {
             uint8_t i_type = h->sh.i_type;
-            /* Values are stored as big-endian FIX8.8 */
-            for( int i = 0; i < h->mb.i_mb_count; i++ )
-                rc->mbtree.qp_buffer[0][i] = endian_fix16( h->fenc->f_qp_offset[i]*256.0 );
+            uint8_t *buf = rc->mbtree.qp_buffer[0];
+            int size = h->mb.i_mb_count;
+            if( h->param.rc.b_mb_tree_compact )
+                for( int i = 0; i < h->mb.i_mb_count; i++ )
+                    buf[i] = x264_clip3( lrintf( h->fenc->f_qp_offset[i] * (1 << MBTREE_COMPACT_SHIFT) ), -128, 127 );
+            else
+            {
+                /* Values are stored as big-endian FIX8.8 */
+                for( int i = 0; i < h->mb.i_mb_count; i++ )
+                    M16( &buf[2*i] ) = endian_fix16( h->fenc->f_qp_offset[i]*256.0 );
+                size *= 2;
+            }
             if( fwrite( &i_type, 1, 1, rc->p_mbtree_stat_file_out ) < 1 )
                 goto fail;
-            if( fwrite( rc->mbtree.qp_buffer[0], sizeof(uint16_t), h->mb.i_mb_count, rc->p_mbtree_stat_file_out ) < h->mb.i_mb_count )
+            if( fwrite( buf, 1, size, rc->p_mbtree_stat_file_out ) < size )
                 goto fail;
         }
+
+        if( h->param.rc.b_analysis_reuse && !h->param.rc.b_stat_read )
+            if( x264_analysis_reuse_write( h ) < 0 )
+                goto fail;
     }
 
     if( rc->b_abr )
@@ -2416,7 +3176,9 @@ static float rate_estimate_qscale( x264_t *h )
             /* Adjust ABR buffer based on distance to the end of the video. */
             if( rcc->num_entries > h->i_frame )
             {
-                double final_bits = rcc->entry[rcc->num_entries-1].expected_bits;
+                /* with a window, the end of the video isn't planned yet: use its target size */
+                double final_bits = rcc->win ? rcc->bitrate * rcc->num_entries / rcc->fps
+                                             : rcc->entry[rcc->num_entries-1].expected_bits;
                 double video_pos = rce.expected_bits / final_bits;
                 double scale_factor = sqrt( (1 - video_pos) * rcc->num_entries );
                 abr_buffer *= 0.5 * X264_MAX( scale_factor, 0.5 );
@@ -2676,6 +3438,8 @@ void x264_thread_sync_ratecontrol( x264_t *cur, x264_t *prev, x264_t *next )
         COPY(bframes);
         COPY(prev_zone);
         COPY(mbtree.qpbuf_pos);
+        COPY(mbtree.qp_frame);
+        COPY(mbtree.map_pos);
         /* these vars can be updated by x264_ratecontrol_init_reconfigurable */
         COPY(bitrate);
         COPY(buffer_size);
@@ -2708,70 +3472,75 @@ void x264_thread_sync_ratecontrol( x264_t *cur, x264_t *prev, x264_t *next )
     /* the rest of the variables are either constant or thread-local */
 }
 
-static int find_underflow( x264_t *h, double *fills, int *t0, int *t1, int over )
+static int find_underflow( x264_t *h, double *fills, int start, int end, int *t0, int *t1, int over )
 {
     /* find an interval ending on an overflow or underflow (depending on whether
      * we're adding or removing bits), and starting on the earliest frame that
-     * can influence the buffer fill of that end frame. */
+     * can influence the buffer fill of that end frame.
+     * fills[i-start] is the fill after frame i, fills[-1] the fill before start. */
     x264_ratecontrol_t *rcc = h->rc;
     const double buffer_min = (over ? .1 : .1) * rcc->buffer_size;
     const double buffer_max = .9 * rcc->buffer_size;
-    double fill = fills[*t0-1];
+    double fill = fills[*t0-start-1];
     double parity = over ? 1. : -1.;
-    int start = -1, end = -1;
-    for( int i = *t0; i < rcc->num_entries; i++ )
+    int i_start = -1, i_end = -1;
+    for( int i = *t0; i < end; i++ )
     {
-        fill += (rcc->entry[i].i_cpb_duration * rcc->vbv_max_rate * h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale -
-                 qscale2bits( &rcc->entry[i], rcc->entry[i].new_qscale )) * parity;
+        ratecontrol_entry_t *rce = rc_entry( rcc, i );
+        fill += (rce->i_cpb_duration * rcc->vbv_max_rate * h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale -
+                 qscale2bits( rce, rce->new_qscale )) * parity;
         fill = x264_clip3f(fill, 0, rcc->buffer_size);
-        fills[i] = fill;
-        if( fill <= buffer_min || i == 0 )
+        fills[i-start] = fill;
+        if( fill <= buffer_min || i == start )
         {
-            if( end >= 0 )
+            if( i_end >= 0 )
                 break;
-            start = i;
+            i_start = i;
         }
-        else if( fill >= buffer_max && start >= 0 )
-            end = i;
+        else if( fill >= buffer_max && i_start >= 0 )
+            i_end = i;
     }
-    *t0 = start;
-    *t1 = end;
-    return start >= 0 && end >= 0;
+    *t0 = i_start;
+    *t1 = i_end;
+    return i_start >= 0 && i_end >= 0;
 }
 
-static int fix_underflow( x264_t *h, int t0, int t1, double adjustment, double qscale_min, double qscale_max)
+static int fix_underflow( x264_t *h, int start, int t0, int t1, double adjustment, double qscale_min, double qscale_max)
 {
     x264_ratecontrol_t *rcc = h->rc;
     double qscale_orig, qscale_new;
     int adjusted = 0;
-    if( t0 > 0 )
+    if( t0 > start )
         t0++;
     for( int i = t0; i <= t1; i++ )
     {
-        qscale_orig = rcc->entry[i].new_qscale;
+        ratecontrol_entry_t *rce = rc_entry( rcc, i );
+        qscale_orig = rce->new_qscale;
         qscale_orig = x264_clip3f( qscale_orig, qscale_min, qscale_max );
         qscale_new  = qscale_orig * adjustment;
         qscale_new  = x264_clip3f( qscale_new, qscale_min, qscale_max );
-        rcc->entry[i].new_qscale = qscale_new;
+        rce->new_qscale = qscale_new;
         adjusted = adjusted || (qscale_new != qscale_orig);
     }
     return adjusted;
 }
 
-static double count_expected_bits( x264_t *h )
+/* Returns the expected size of frames [start,end), and sets their cumulative
+ * expected_bits counting from base_bits. */
+static double count_expected_bits( x264_t *h, int start, int end, double base_bits )
 {
     x264_ratecontrol_t *rcc = h->rc;
     double expected_bits = 0;
-    for( int i = 0; i < rcc->num_entries; i++ )
+    for( int i = start; i < end; i++ )
     {
-        ratecontrol_entry_t *rce = &rcc->entry[i];
-        rce->expected_bits = expected_bits;
+        ratecontrol_entry_t *rce = rc_entry( rcc, i );
+        rce->expected_bits = base_bits + expected_bits;
         expected_bits += qscale2bits( rce, rce->new_qscale );
     }
     return expected_bits;
 }
 
-static int vbv_pass2( x264_t *h, double all_available_bits )
+static int vbv_pass2( x264_t *h, int start, int end, double all_available_bits, double base_bits, double vbv_init )
 {
     /* for each interval of buffer_full .. underflow, uniformly increase the qp of all
      * frames in the interval until either buffer is full at some intermediate frame or the
@@ -2788,7 +3557,7 @@ static int vbv_pass2( x264_t *h, double all_available_bits )
     double qscale_max = qp2qscale( h->param.rc.i_qp_max );
     int iterations = 0;
     int adj_min, adj_max;
-    CHECKED_MALLOC( fills, (rcc->num_entries+1)*sizeof(double) );
+    CHECKED_MALLOC( fills, (end-start+1)*sizeof(double) );
 
     fills++;
 
@@ -2801,33 +3570,33 @@ static int vbv_pass2( x264_t *h, double all_available_bits )
         if( expected_bits )
         {   /* not first iteration */
             adjustment = X264_MAX(X264_MIN(expected_bits / all_available_bits, 0.999), 0.9);
-            fills[-1] = rcc->buffer_size * h->param.rc.f_vbv_buffer_init;
-            t0 = 0;
+            fills[-1] = rcc->buffer_size * vbv_init;
+            t0 = start;
             /* fix overflows */
             adj_min = 1;
-            while(adj_min && find_underflow( h, fills, &t0, &t1, 1 ))
+            while(adj_min && find_underflow( h, fills, start, end, &t0, &t1, 1 ))
             {
-                adj_min = fix_underflow( h, t0, t1, adjustment, qscale_min, qscale_max );
+                adj_min = fix_underflow( h, start, t0, t1, adjustment, qscale_min, qscale_max );
                 t0 = t1;
             }
         }
 
-        fills[-1] = rcc->buffer_size * (1. - h->param.rc.f_vbv_buffer_init);
-        t0 = 0;
+        fills[-1] = rcc->buffer_size * (1. - vbv_init);
+        t0 = start;
         /* fix underflows -- should be done after overflow, as we'd better undersize target than underflowing VBV */
         adj_max = 1;
-        while( adj_max && find_underflow( h, fills, &t0, &t1, 0 ) )
-            adj_max = fix_underflow( h, t0, t1, 1.001, qscale_min, qscale_max );
+        while( adj_max && find_underflow( h, fills, start, end, &t0, &t1, 0 ) )
+            adj_max = fix_underflow( h, start, t0, t1, 1.001, qscale_min, qscale_max );
 
-        expected_bits = count_expected_bits( h );
+        expected_bits = count_expected_bits( h, start, end, base_bits );
     } while( (expected_bits < .995*all_available_bits) && ((int64_t)(expected_bits+.5) > (int64_t)(prev_bits+.5)) );
 
     if( !adj_max )
         x264_log( h, X264_LOG_WARNING, "vbv-maxrate issue, qpmax or vbv-maxrate too low\n");
 
     /* store expected vbv filling values for tracking when encoding */
-    for( int i = 0; i < rcc->num_entries; i++ )
-        rcc->entry[i].expected_vbv = rcc->buffer_size - fills[i];
+    for( int i = start; i < end; i++ )
+        rc_entry( rcc, i )->expected_vbv = rcc->buffer_size - fills[i-start];
 
     x264_free( fills-1 );
     return 0;
@@ -2835,16 +3604,14 @@ fail:
     return -1;
 }
 
-static int init_pass2( x264_t *h )
+/* Plan the bits of frames [start,end) to add up to all_available_bits.  base_bits and
+ * vbv_init are the expected size and buffer fullness (as a fraction) after the frames
+ * before start. */
+static int pass2_plan( x264_t *h, int start, int end, double all_available_bits, double base_bits, double vbv_init )
 {
     x264_ratecontrol_t *rcc = h->rc;
     uint64_t all_const_bits = 0;
     double timescale = (double)h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale;
-    double duration = 0;
-    for( int i = 0; i < rcc->num_entries; i++ )
-        duration += rcc->entry[i].i_duration;
-    duration *= timescale;
-    uint64_t all_available_bits = h->param.rc.i_bitrate * 1000. * duration;
     double rate_factor, step_mult;
     double qblur = h->param.rc.f_qblur;
     double cplxblur = h->param.rc.f_complexity_blur;
@@ -2852,36 +3619,42 @@ static int init_pass2( x264_t *h )
     double expected_bits;
     double *qscale, *blurred_qscale;
     double base_cplx = h->mb.i_mb_count * (h->param.i_bframe ? 120 : 80);
+    int b_window = !!rcc->win;
+    int num_frames = end - start;
 
     /* find total/average complexity & const_bits */
-    for( int i = 0; i < rcc->num_entries; i++ )
-    {
-        ratecontrol_entry_t *rce = &rcc->entry[i];
-        all_const_bits += rce->misc_bits;
-    }
+    for( int i = start; i < end; i++ )
+        all_const_bits += rc_entry( rcc, i )->misc_bits;
 
     if( all_available_bits < all_const_bits)
     {
-        x264_log( h, X264_LOG_ERROR, "requested bitrate is too low. estimated minimum is %d kbps\n",
-                 (int)(all_const_bits * rcc->fps / (rcc->num_entries * 1000.)) );
-        return -1;
+        /* A window can be squeezed by the ones before it overshooting: give it what it needs
+         * and let the following windows make up for it. */
+        if( b_window )
+            all_available_bits = all_const_bits;
+        else
+        {
+            x264_log( h, X264_LOG_ERROR, "requested bitrate is too low. estimated minimum is %d kbps\n",
+                     (int)(all_const_bits * rcc->fps / (num_frames * 1000.)) );
+            return -1;
+        }
     }
 
     /* Blur complexities, to reduce local fluctuation of QP.
      * We don't blur the QPs directly, because then one very simple frame
      * could drag down the QP of a nearby complex frame and give it more
      * bits than intended. */
-    for( int i = 0; i < rcc->num_entries; i++ )
+    for( int i = start; i < end; i++ )
     {
-        ratecontrol_entry_t *rce = &rcc->entry[i];
+        ratecontrol_entry_t *rce = rc_entry( rcc, i );
         double weight_sum = 0;
         double cplx_sum = 0;
         double weight = 1.0;
         double gaussian_weight;
         /* weighted average of cplx of future frames */
-        for( int j = 1; j < cplxblur*2 && j < rcc->num_entries-i; j++ )
+        for( int j = 1; j < cplxblur*2 && j < end-i; j++ )
         {
-            ratecontrol_entry_t *rcj = &rcc->entry[i+j];
+            ratecontrol_entry_t *rcj = rc_entry( rcc, i+j );
             double frame_duration = CLIP_DURATION(rcj->i_duration * timescale) / BASE_FRAME_DURATION;
             weight *= 1 - pow( (float)rcj->i_count / rcc->nmb, 2 );
             if( weight < .0001 )
@@ -2892,9 +3665,9 @@ static int init_pass2( x264_t *h )
         }
         /* weighted average of cplx of past frames */
         weight = 1.0;
-        for( int j = 0; j <= cplxblur*2 && j <= i; j++ )
+        for( int j = 0; j <= cplxblur*2 && j <= i-start; j++ )
         {
-            ratecontrol_entry_t *rcj = &rcc->entry[i-j];
+            ratecontrol_entry_t *rcj = rc_entry( rcc, i-j );
             double frame_duration = CLIP_DURATION(rcj->i_duration * timescale) / BASE_FRAME_DURATION;
             gaussian_weight = weight * exp( -j*j/200.0 );
             weight_sum += gaussian_weight;
@@ -2906,9 +3679,9 @@ static int init_pass2( x264_t *h )
         rce->blurred_complexity = cplx_sum / weight_sum;
     }
 
-    CHECKED_MALLOC( qscale, sizeof(double)*rcc->num_entries );
+    CHECKED_MALLOC( qscale, sizeof(double)*num_frames );
     if( filter_size > 1 )
-        CHECKED_MALLOC( blurred_qscale, sizeof(double)*rcc->num_entries );
+        CHECKED_MALLOC( blurred_qscale, sizeof(double)*num_frames );
     else
         blurred_qscale = qscale;
 
@@ -2920,11 +3693,12 @@ static int init_pass2( x264_t *h )
      * The search range is probably overkill, but speed doesn't matter here. */
 
     expected_bits = 1;
-    for( int i = 0; i < rcc->num_entries; i++ )
+    for( int i = start; i < end; i++ )
     {
-        double q = get_qscale(h, &rcc->entry[i], 1.0, i);
-        expected_bits += qscale2bits(&rcc->entry[i], q);
-        rcc->last_qscale_for[rcc->entry[i].pict_type] = q;
+        ratecontrol_entry_t *rce = rc_entry( rcc, i );
+        double q = get_qscale(h, rce, 1.0, i);
+        expected_bits += qscale2bits(rce, q);
+        rcc->last_qscale_for[rce->pict_type] = q;
     }
     step_mult = all_available_bits / expected_bits;
 
@@ -2943,26 +3717,27 @@ static int init_pass2( x264_t *h )
         rcc->last_qscale_for[2] = pow( base_cplx, 1 - rcc->qcompress ) / rate_factor;
 
         /* find qscale */
-        for( int i = 0; i < rcc->num_entries; i++ )
+        for( int i = start; i < end; i++ )
         {
-            qscale[i] = get_qscale( h, &rcc->entry[i], rate_factor, -1 );
-            rcc->last_qscale_for[rcc->entry[i].pict_type] = qscale[i];
+            ratecontrol_entry_t *rce = rc_entry( rcc, i );
+            qscale[i-start] = get_qscale( h, rce, rate_factor, -1 );
+            rcc->last_qscale_for[rce->pict_type] = qscale[i-start];
         }
 
         /* fixed I/B qscale relative to P */
-        for( int i = rcc->num_entries-1; i >= 0; i-- )
+        for( int i = end-1; i >= start; i-- )
         {
-            qscale[i] = get_diff_limited_q( h, &rcc->entry[i], qscale[i], i );
-            assert(qscale[i] >= 0);
+            qscale[i-start] = get_diff_limited_q( h, rc_entry( rcc, i ), qscale[i-start], i );
+            assert(qscale[i-start] >= 0);
         }
 
         /* smooth curve */
         if( filter_size > 1 )
         {
             assert( filter_size%2 == 1 );
-            for( int i = 0; i < rcc->num_entries; i++ )
+            for( int i = start; i < end; i++ )
             {
-                ratecontrol_entry_t *rce = &rcc->entry[i];
+                ratecontrol_entry_t *rce = rc_entry( rcc, i );
                 double q = 0.0, sum = 0.0;
 
                 for( int j = 0; j < filter_size; j++ )
@@ -2970,22 +3745,22 @@ static int init_pass2( x264_t *h )
                     int idx = i+j-filter_size/2;
                     double d = idx-i;
                     double coeff = qblur==0 ? 1.0 : exp( -d*d/(qblur*qblur) );
-                    if( idx < 0 || idx >= rcc->num_entries )
+                    if( idx < start || idx >= end )
                         continue;
-                    if( rce->pict_type != rcc->entry[idx].pict_type )
+                    if( rce->pict_type != rc_entry( rcc, idx )->pict_type )
                         continue;
-                    q += qscale[idx] * coeff;
+                    q += qscale[idx-start] * coeff;
                     sum += coeff;
                 }
-                blurred_qscale[i] = q/sum;
+                blurred_qscale[i-start] = q/sum;
             }
         }
 
         /* find expected bits */
-        for( int i = 0; i < rcc->num_entries; i++ )
+        for( int i = start; i < end; i++ )
         {
-            ratecontrol_entry_t *rce = &rcc->entry[i];
-            rce->new_qscale = clip_qscale( h, rce->pict_type, blurred_qscale[i] );
+            ratecontrol_entry_t *rce = rc_entry( rcc, i );
+            rce->new_qscale = clip_qscale( h, rce->pict_type, blurred_qscale[i-start] );
             assert(rce->new_qscale >= 0);
             expected_bits += qscale2bits( rce, rce->new_qscale );
         }
@@ -2999,22 +3774,23 @@ static int init_pass2( x264_t *h )
         x264_free( blurred_qscale );
 
     if( rcc->b_vbv )
-        if( vbv_pass2( h, all_available_bits ) )
+        if( vbv_pass2( h, start, end, all_available_bits, base_bits, vbv_init ) )
             return -1;
-    expected_bits = count_expected_bits( h );
+    expected_bits = count_expected_bits( h, start, end, base_bits );
 
-    if( fabs( expected_bits/all_available_bits - 1.0 ) > 0.01 )
+    /* Windows are expected to miss their share a little, the next one corrects for it. */
+    if( fabs( expected_bits/all_available_bits - 1.0 ) > 0.01 && !b_window )
     {
         double avgq = 0;
-        for( int i = 0; i < rcc->num_entries; i++ )
-            avgq += rcc->entry[i].new_qscale;
-        avgq = qscale2qp( avgq / rcc->num_entries );
+        for( int i = start; i < end; i++ )
+            avgq += rc_entry( rcc, i )->new_qscale;
+        avgq = qscale2qp( avgq / num_frames );
 
         if( expected_bits > all_available_bits || !rcc->b_vbv )
             x264_log( h, X264_LOG_WARNING, "Error: 2pass curve failed to converge\n" );
         x264_log( h, X264_LOG_WARNING, "target: %.2f kbit/s, expected: %.2f kbit/s, avg QP: %.4f\n",
                   (float)h->param.rc.i_bitrate,
-                  expected_bits * rcc->fps / (rcc->num_entries * 1000.),
+                  expected_bits * rcc->fps / (num_frames * 1000.),
                   avgq );
         if( expected_bits < all_available_bits && avgq < h->param.rc.i_qp_min + 2 )
         {
@@ -3038,3 +3814,44 @@ static int init_pass2( x264_t *h )
 fail:
     return -1;
 }
+
+/* Windowed 2nd pass: plan the next window of frames, aiming the expected size of
+ * everything planned so far at the target bitrate.  Must be called with the window
+ * locked. */
+static int pass2_plan_window( x264_t *h )
+{
+    x264_ratecontrol_t *rcc = h->rc;
+    x264_pass2_window_t *win = rcc->win;
+    double timescale = (double)h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale;
+    int start = win->i_planned;
+    int end = X264_MIN( start + win->i_size, rcc->num_entries );
+
+    x264_stat_window_load( h, end-1 );
+    for( int i = start; i < end; i++ )
+        win->duration += rc_entry( rcc, i )->i_duration * timescale;
+    double all_available_bits = h->param.rc.i_bitrate * 1000. * win->duration - win->planned_bits;
+    if( pass2_plan( h, start, end, all_available_bits, win->planned_bits, win->vbv_init ) < 0 )
+        return -1;
+
+    ratecontrol_entry_t *last = rc_entry( rcc, end-1 );
+    win->planned_bits = last->expected_bits + qscale2bits( last, last->new_qscale );
+    if( rcc->b_vbv )
+        win->vbv_init = last->expected_vbv / rcc->buffer_size;
+    win->i_planned = end;
+    return 0;
+}
+
+static int init_pass2( x264_t *h )
+{
+    x264_ratecontrol_t *rcc = h->rc;
+    if( rcc->win )
+        return pass2_plan_window( h );
+
+    double timescale = (double)h->sps->vui.i_num_units_in_tick / h->sps->vui.i_time_scale;
+    double duration = 0;
+    for( int i = 0; i < rcc->num_entries; i++ )
+        duration += rcc->entry[i].i_duration;
+    duration *= timescale;
+    uint64_t all_available_bits = h->param.rc.i_bitrate * 1000. * duration;
+    return pass2_plan( h, 0, rcc->num_entries, all_available_bits, 0, h->param.rc.f_vbv_buffer_init );
+}
@@ -370,9 +370,18 @@ static uint64_t x264_rd_cost_chroma( x264_t *h, int i_lambda2, int i_mode, int b
 #define CABAC_SIZE_BITS 8
 #define LAMBDA_BITS 4
 
-/* precalculate the cost of coding various combinations of bits in a single context */
+/* precalculate the cost of coding various combinations of bits in a single context.
+ * The tables are the same for every encoder in the process: only the first call fills them. */
 void x264_rdo_init( void )
 {
+    static UNUSED x264_pthread_mutex_t init_mutex = X264_PTHREAD_MUTEX_INITIALIZER;
+    static int b_init = 0;
+    x264_pthread_mutex_lock( &init_mutex );
+    if( b_init )
+    {
+        x264_pthread_mutex_unlock( &init_mutex );
+        return;
+    }
     for( int i_prefix = 0; i_prefix < 15; i_prefix++ )
     {
         for( int i_ctx = 0; i_ctx < 128; i_ctx++ )
@@ -402,6 +411,8 @@ void x264_rdo_init( void )
         cabac_size_5ones[i_ctx] = f8_bits;
         cabac_transition_5ones[i_ctx] = ctx;
     }
+    b_init = 1;
+    x264_pthread_mutex_unlock( &init_mutex );
 }
 
 typedef struct
@@ -51,9 +51,43 @@ static void x264_lowres_context_init( x264_t *h, x264_mb_analysis_t *a )
         h->mb.i_me_method = X264_ME_DIA;
         h->mb.i_subpel_refine = 2;
     }
+    h->mb.i_me_range = h->param.analyse.i_me_range;
     h->mb.b_chroma_me = 0;
 }
 
+/* Lookahead threads need the lowres settings and the frame level being analysed. */
+static void x264_lowres_context_sync( x264_t *dst, x264_t *src )
+{
+    dst->mb.i_me_method = src->mb.i_me_method;
+    dst->mb.i_me_range = src->mb.i_me_range;
+    dst->mb.i_subpel_refine = src->mb.i_subpel_refine;
+    dst->mb.b_chroma_me = src->mb.b_chroma_me;
+    dst->mb.i_mb_width = src->mb.i_mb_width;
+    dst->mb.i_mb_height = src->mb.i_mb_height;
+    dst->mb.i_mb_stride = src->mb.i_mb_stride;
+    dst->mb.i_mb_count = src->mb.i_mb_count;
+}
+
+/* b_lookahead_quarter: point the lowres analysis at the quarter resolution level of
+ * frames[0..num_frames], until x264_slicetype_quarter_leave. */
+static void x264_slicetype_quarter_enter( x264_t *h, x264_frame_t **frames, x264_frame_t **quarter, int num_frames )
+{
+    for( int i = 0; i <= num_frames; i++ )
+        quarter[i] = frames[i]->quarter;
+    h->mb.i_mb_width = quarter[0]->i_width_lowres / 8;
+    h->mb.i_mb_height = quarter[0]->i_lines_lowres / 8;
+    h->mb.i_mb_stride = h->mb.i_mb_width;
+    h->mb.i_mb_count = h->mb.i_mb_width * h->mb.i_mb_height;
+}
+
+static void x264_slicetype_quarter_leave( x264_t *h, x264_frame_t **frames )
+{
+    h->mb.i_mb_width = frames[0]->i_width_lowres / 8;
+    h->mb.i_mb_height = frames[0]->i_lines_lowres / 8;
+    h->mb.i_mb_stride = h->mb.i_mb_width;
+    h->mb.i_mb_count = h->mb.i_mb_width * h->mb.i_mb_height;
+}
+
 /* makes a non-h264 weight (i.e. fix7), into an h264 weight */
 static void x264_weight_get_h264( int weight_nonh264, int offset, x264_weight_t *w )
 {
@@ -750,140 +784,146 @@ static void x264_slicetype_slice_cost( x264_slicetype_slice_t *s )
                                     s->do_search, s->w, s->output_inter, s->output_intra );
 }
 
-static int x264_slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
-                                      x264_frame_t **frames, int p0, int p1, int b,
-                                      int b_intra_penalty )
+/* Check whether we already evaluated this frame
+ * If we have tried this frame as P, then we have also tried
+ * the preceding frames as B. (is this still true?) */
+/* Also check that we already calculated the row SATDs for the current frame. */
+static int x264_slicetype_frame_cost_known( x264_t *h, x264_frame_t *fenc, int p0, int p1, int b )
 {
-    int i_score = 0;
+    return fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1);
+}
+
+/* Fill in fenc->i_cost_est[b-p0][p1-b] and the per-mb costs, splitting the frame
+ * into threads slices.  With threads == 1 the whole frame is done by h itself. */
+static void x264_slicetype_frame_estimate( x264_t *h, x264_mb_analysis_t *a,
+                                           x264_frame_t **frames, int p0, int p1, int b, int threads )
+{
+    int i_score;
     int do_search[2];
     const x264_weight_t *w = x264_weight_none;
     x264_frame_t *fenc = frames[b];
+    int dist_scale_factor = 128;
 
-    /* Check whether we already evaluated this frame
-     * If we have tried this frame as P, then we have also tried
-     * the preceding frames as B. (is this still true?) */
-    /* Also check that we already calculated the row SATDs for the current frame. */
-    if( fenc->i_cost_est[b-p0][p1-b] >= 0 && (!h->param.rc.i_vbv_buffer_size || fenc->i_row_satds[b-p0][p1-b][0] != -1) )
-        i_score = fenc->i_cost_est[b-p0][p1-b];
-    else
+    /* For each list, check to see whether we have lowres motion-searched this reference frame before. */
+    do_search[0] = b != p0 && fenc->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
+    do_search[1] = b != p1 && fenc->lowres_mvs[1][p1-b-1][0][0] == 0x7FFF;
+    if( do_search[0] )
     {
-        int dist_scale_factor = 128;
-
-        /* For each list, check to see whether we have lowres motion-searched this reference frame before. */
-        do_search[0] = b != p0 && fenc->lowres_mvs[0][b-p0-1][0][0] == 0x7FFF;
-        do_search[1] = b != p1 && fenc->lowres_mvs[1][p1-b-1][0][0] == 0x7FFF;
-        if( do_search[0] )
+        if( h->param.analyse.i_weighted_pred && b == p1 )
         {
-            if( h->param.analyse.i_weighted_pred && b == p1 )
-            {
-                x264_emms();
-                x264_weights_analyse( h, fenc, frames[p0], 1 );
-                w = fenc->weight[0];
-            }
-            fenc->lowres_mvs[0][b-p0-1][0][0] = 0;
+            x264_emms();
+            x264_weights_analyse( h, fenc, frames[p0], 1 );
+            w = fenc->weight[0];
         }
-        if( do_search[1] ) fenc->lowres_mvs[1][p1-b-1][0][0] = 0;
-
-        if( p1 != p0 )
-            dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
+        fenc->lowres_mvs[0][b-p0-1][0][0] = 0;
+    }
+    if( do_search[1] ) fenc->lowres_mvs[1][p1-b-1][0][0] = 0;
 
-        int output_buf_size = h->mb.i_mb_height + (NUM_INTS + PAD_SIZE) * h->param.i_lookahead_threads;
-        int *output_inter[X264_LOOKAHEAD_THREAD_MAX+1];
-        int *output_intra[X264_LOOKAHEAD_THREAD_MAX+1];
-        output_inter[0] = h->scratch_buffer2;
-        output_intra[0] = output_inter[0] + output_buf_size;
+    if( p1 != p0 )
+        dist_scale_factor = ( ((b-p0) << 8) + ((p1-p0) >> 1) ) / (p1-p0);
 
-        if( h->param.i_lookahead_threads > 1 )
-        {
-            x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
+    int output_buf_size = h->mb.i_mb_height + (NUM_INTS + PAD_SIZE) * threads;
+    int *output_inter[X264_LOOKAHEAD_THREAD_MAX+1];
+    int *output_intra[X264_LOOKAHEAD_THREAD_MAX+1];
+    output_inter[0] = h->scratch_buffer2;
+    output_intra[0] = output_inter[0] + output_buf_size;
 
-            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
-            {
-                x264_t *t = h->lookahead_thread[i];
+    if( threads > 1 )
+    {
+        x264_slicetype_slice_t s[X264_LOOKAHEAD_THREAD_MAX];
 
-                /* FIXME move this somewhere else */
-                t->mb.i_me_method = h->mb.i_me_method;
-                t->mb.i_subpel_refine = h->mb.i_subpel_refine;
-                t->mb.b_chroma_me = h->mb.b_chroma_me;
+        for( int i = 0; i < threads; i++ )
+        {
+            x264_t *t = h->lookahead_thread[i];
+            x264_lowres_context_sync( t, h );
 
-                s[i] = (x264_slicetype_slice_t){ t, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                                                 output_inter[i], output_intra[i] };
+            s[i] = (x264_slicetype_slice_t){ t, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
+                                             output_inter[i], output_intra[i] };
 
-                t->i_threadslice_start = ((h->mb.i_mb_height *  i    + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
-                t->i_threadslice_end   = ((h->mb.i_mb_height * (i+1) + h->param.i_lookahead_threads/2) / h->param.i_lookahead_threads);
+            t->i_threadslice_start = ((h->mb.i_mb_height *  i    + threads/2) / threads);
+            t->i_threadslice_end   = ((h->mb.i_mb_height * (i+1) + threads/2) / threads);
 
-                int thread_height = t->i_threadslice_end - t->i_threadslice_start;
-                int thread_output_size = thread_height + NUM_INTS;
-                memset( output_inter[i], 0, thread_output_size * sizeof(int) );
-                memset( output_intra[i], 0, thread_output_size * sizeof(int) );
-                output_inter[i][NUM_ROWS] = output_intra[i][NUM_ROWS] = thread_height;
+            int thread_height = t->i_threadslice_end - t->i_threadslice_start;
+            int thread_output_size = thread_height + NUM_INTS;
+            memset( output_inter[i], 0, thread_output_size * sizeof(int) );
+            memset( output_intra[i], 0, thread_output_size * sizeof(int) );
+            output_inter[i][NUM_ROWS] = output_intra[i][NUM_ROWS] = thread_height;
 
-                output_inter[i+1] = output_inter[i] + thread_output_size + PAD_SIZE;
-                output_intra[i+1] = output_intra[i] + thread_output_size + PAD_SIZE;
+            output_inter[i+1] = output_inter[i] + thread_output_size + PAD_SIZE;
+            output_intra[i+1] = output_intra[i] + thread_output_size + PAD_SIZE;
 
-                x264_threadpool_run( h->lookaheadpool, (void*)x264_slicetype_slice_cost, &s[i] );
-            }
-            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
-                x264_threadpool_wait( h->lookaheadpool, &s[i] );
-        }
-        else
-        {
-            h->i_threadslice_start = 0;
-            h->i_threadslice_end = h->mb.i_mb_height;
-            memset( output_inter[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-            memset( output_intra[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
-            output_inter[0][NUM_ROWS] = output_intra[0][NUM_ROWS] = h->mb.i_mb_height;
-            x264_slicetype_slice_t s = (x264_slicetype_slice_t){ h, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
-                                                                 output_inter[0], output_intra[0] };
-            x264_slicetype_slice_cost( &s );
+            x264_threadpool_run( h->lookaheadpool, (void*)x264_slicetype_slice_cost, &s[i] );
         }
+        for( int i = 0; i < threads; i++ )
+            x264_threadpool_wait( h->lookaheadpool, &s[i] );
+    }
+    else
+    {
+        h->i_threadslice_start = 0;
+        h->i_threadslice_end = h->mb.i_mb_height;
+        memset( output_inter[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
+        memset( output_intra[0], 0, (output_buf_size - PAD_SIZE) * sizeof(int) );
+        output_inter[0][NUM_ROWS] = output_intra[0][NUM_ROWS] = h->mb.i_mb_height;
+        x264_slicetype_slice_t s = (x264_slicetype_slice_t){ h, a, frames, p0, p1, b, dist_scale_factor, do_search, w,
+                                                             output_inter[0], output_intra[0] };
+        x264_slicetype_slice_cost( &s );
+    }
+
+    /* Sum up accumulators */
+    if( b == p1 )
+        fenc->i_intra_mbs[b-p0] = 0;
+    if( !fenc->b_intra_calculated )
+    {
+        fenc->i_cost_est[0][0] = 0;
+        fenc->i_cost_est_aq[0][0] = 0;
+    }
+    fenc->i_cost_est[b-p0][p1-b] = 0;
+    fenc->i_cost_est_aq[b-p0][p1-b] = 0;
 
-        /* Sum up accumulators */
+    int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
+    int *row_satd_intra = fenc->i_row_satds[0][0];
+    for( int i = 0; i < threads; i++ )
+    {
         if( b == p1 )
-            fenc->i_intra_mbs[b-p0] = 0;
+            fenc->i_intra_mbs[b-p0] += output_inter[i][INTRA_MBS];
         if( !fenc->b_intra_calculated )
         {
-            fenc->i_cost_est[0][0] = 0;
-            fenc->i_cost_est_aq[0][0] = 0;
+            fenc->i_cost_est[0][0] += output_intra[i][COST_EST];
+            fenc->i_cost_est_aq[0][0] += output_intra[i][COST_EST_AQ];
         }
-        fenc->i_cost_est[b-p0][p1-b] = 0;
-        fenc->i_cost_est_aq[b-p0][p1-b] = 0;
 
-        int *row_satd_inter = fenc->i_row_satds[b-p0][p1-b];
-        int *row_satd_intra = fenc->i_row_satds[0][0];
-        for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+        fenc->i_cost_est[b-p0][p1-b] += output_inter[i][COST_EST];
+        fenc->i_cost_est_aq[b-p0][p1-b] += output_inter[i][COST_EST_AQ];
+
+        if( h->param.rc.i_vbv_buffer_size )
         {
-            if( b == p1 )
-                fenc->i_intra_mbs[b-p0] += output_inter[i][INTRA_MBS];
+            int row_count = output_inter[i][NUM_ROWS];
+            memcpy( row_satd_inter, output_inter[i] + NUM_INTS, row_count * sizeof(int) );
             if( !fenc->b_intra_calculated )
-            {
-                fenc->i_cost_est[0][0] += output_intra[i][COST_EST];
-                fenc->i_cost_est_aq[0][0] += output_intra[i][COST_EST_AQ];
-            }
-
-            fenc->i_cost_est[b-p0][p1-b] += output_inter[i][COST_EST];
-            fenc->i_cost_est_aq[b-p0][p1-b] += output_inter[i][COST_EST_AQ];
-
-            if( h->param.rc.i_vbv_buffer_size )
-            {
-                int row_count = output_inter[i][NUM_ROWS];
-                memcpy( row_satd_inter, output_inter[i] + NUM_INTS, row_count * sizeof(int) );
-                if( !fenc->b_intra_calculated )
-                    memcpy( row_satd_intra, output_intra[i] + NUM_INTS, row_count * sizeof(int) );
-                row_satd_inter += row_count;
-                row_satd_intra += row_count;
-            }
+                memcpy( row_satd_intra, output_intra[i] + NUM_INTS, row_count * sizeof(int) );
+            row_satd_inter += row_count;
+            row_satd_intra += row_count;
         }
+    }
 
-        i_score = fenc->i_cost_est[b-p0][p1-b];
-        if( b != p1 )
-            i_score = (uint64_t)i_score * 100 / (120 + h->param.i_bframe_bias);
-        else
-            fenc->b_intra_calculated = 1;
+    i_score = fenc->i_cost_est[b-p0][p1-b];
+    if( b != p1 )
+        i_score = (uint64_t)i_score * 100 / (120 + h->param.i_bframe_bias);
+    else
+        fenc->b_intra_calculated = 1;
 
-        fenc->i_cost_est[b-p0][p1-b] = i_score;
-        x264_emms();
-    }
+    fenc->i_cost_est[b-p0][p1-b] = i_score;
+    x264_emms();
+}
+
+static int x264_slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
+                                      x264_frame_t **frames, int p0, int p1, int b,
+                                      int b_intra_penalty )
+{
+    x264_frame_t *fenc = frames[b];
+    if( !x264_slicetype_frame_cost_known( h, fenc, p0, p1, b ) )
+        x264_slicetype_frame_estimate( h, a, frames, p0, p1, b, h->param.i_lookahead_threads );
+    int i_score = fenc->i_cost_est[b-p0][p1-b];
 
     if( b_intra_penalty )
     {
@@ -894,6 +934,140 @@ static int x264_slicetype_frame_cost( x264_t *h, x264_mb_analysis_t *a,
     return i_score;
 }
 
+/* Batched lookahead: rather than splitting each estimate into slices and joining after
+ * every one, list the estimates a decision is going to make and give whole frames to
+ * the lookahead threads.  Estimates of the same frame share its lowres mvs and intra
+ * costs, so one thread runs all of them in order.  B-frame estimates read the vectors
+ * of their future reference, so they run in a second wave after every P-frame. */
+typedef struct
+{
+    x264_t *h;
+    x264_mb_analysis_t *a;
+    x264_frame_t **frames;
+    int num_frames;
+    int dist;               /* 1 + the largest b-p0 or p1-b that can be queued */
+    uint8_t *queued;        /* [b][b-p0][p1-b] */
+    int count[2];           /* queued estimates without and with a future reference */
+    int b_bidir;            /* wave currently running */
+    int next_b;
+    x264_pthread_mutex_t mutex;
+} x264_slicetype_batch_t;
+
+typedef struct
+{
+    x264_t *t;
+    x264_slicetype_batch_t *batch;
+} x264_slicetype_batch_thread_t;
+
+#define BATCH_QUEUED( batch, p0, p1, b ) (batch)->queued[((b) * (batch)->dist + (b)-(p0)) * (batch)->dist + (p1)-(b)]
+
+static void x264_slicetype_batch_add( x264_slicetype_batch_t *batch, int p0, int p1, int b )
+{
+    if( p1 > batch->num_frames || b-p0 >= batch->dist || p1-b >= batch->dist )
+        return;
+    if( !BATCH_QUEUED( batch, p0, p1, b ) &&
+        !x264_slicetype_frame_cost_known( batch->h, batch->frames[b], p0, p1, b ) )
+    {
+        BATCH_QUEUED( batch, p0, p1, b ) = 1;
+        batch->count[b != p1]++;
+    }
+    if( b != p1 )
+        x264_slicetype_batch_add( batch, p0, p1, p1 );
+}
+
+/* Queue the estimates x264_slicetype_path_cost and x264_macroblock_tree make
+ * for a minigop with references cur and next. */
+static void x264_slicetype_batch_minigop( x264_slicetype_batch_t *batch, int cur, int next )
+{
+    x264_slicetype_batch_add( batch, cur, next, next );
+    if( batch->h->param.i_bframe_pyramid && next - cur > 2 )
+    {
+        int middle = cur + (next - cur)/2;
+        x264_slicetype_batch_add( batch, cur, next, middle );
+        for( int b = cur+1; b < middle; b++ )
+            x264_slicetype_batch_add( batch, cur, middle, b );
+        for( int b = middle+1; b < next; b++ )
+            x264_slicetype_batch_add( batch, middle, next, b );
+    }
+    else
+        for( int b = cur+1; b < next; b++ )
+            x264_slicetype_batch_add( batch, cur, next, b );
+}
+
+static int x264_slicetype_batch_init( x264_t *h, x264_slicetype_batch_t *batch, x264_mb_analysis_t *a,
+                                      x264_frame_t **frames, int num_frames )
+{
+    if( !h->param.b_lookahead_batch )
+        return -1;
+    memset( batch, 0, sizeof(x264_slicetype_batch_t) );
+    batch->h = h;
+    batch->a = a;
+    batch->frames = frames;
+    batch->num_frames = num_frames;
+    batch->dist = h->param.i_bframe + 2;
+    int size = (num_frames + 1) * batch->dist * batch->dist;
+    batch->queued = x264_malloc( size );
+    if( !batch->queued )
+        return -1;
+    memset( batch->queued, 0, size );
+    return 0;
+}
+
+static void x264_slicetype_batch_thread( x264_slicetype_batch_thread_t *bt )
+{
+    x264_slicetype_batch_t *batch = bt->batch;
+    x264_t *h = bt->t;
+    int dist = batch->dist;
+    for( ;; )
+    {
+        x264_pthread_mutex_lock( &batch->mutex );
+        int b = batch->next_b++;
+        x264_pthread_mutex_unlock( &batch->mutex );
+        if( b > batch->num_frames )
+            break;
+
+        uint8_t *queued = &BATCH_QUEUED( batch, b, b, b );
+        for( int d0 = 0; d0 < dist && d0 <= b; d0++ )
+            for( int d1 = batch->b_bidir; d1 < (batch->b_bidir ? dist : 1); d1++ )
+                if( queued[d0*dist+d1] )
+                {
+                    /* Weight analysis wants the intra costs first, and must not get them
+                     * through the thread pool we are running on. */
+                    if( h->param.analyse.i_weighted_pred && !batch->frames[b]->b_intra_calculated )
+                        x264_slicetype_frame_estimate( h, batch->a, batch->frames, b, b, b, 1 );
+                    if( !x264_slicetype_frame_cost_known( h, batch->frames[b], b-d0, b+d1, b ) )
+                        x264_slicetype_frame_estimate( h, batch->a, batch->frames, b-d0, b+d1, b, 1 );
+                }
+    }
+}
+
+static void x264_slicetype_batch_run( x264_slicetype_batch_t *batch )
+{
+    x264_t *h = batch->h;
+    x264_slicetype_batch_thread_t bt[X264_LOOKAHEAD_THREAD_MAX];
+
+    if( (batch->count[0] || batch->count[1]) && !x264_pthread_mutex_init( &batch->mutex, NULL ) )
+    {
+        for( batch->b_bidir = 0; batch->b_bidir < 2; batch->b_bidir++ )
+        {
+            if( !batch->count[batch->b_bidir] )
+                continue;
+            batch->next_b = 0;
+            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+            {
+                x264_t *t = h->lookahead_thread[i];
+                x264_lowres_context_sync( t, h );
+                bt[i] = (x264_slicetype_batch_thread_t){ t, batch };
+                x264_threadpool_run( h->lookaheadpool, (void*)x264_slicetype_batch_thread, &bt[i] );
+            }
+            for( int i = 0; i < h->param.i_lookahead_threads; i++ )
+                x264_threadpool_wait( h->lookaheadpool, &bt[i] );
+        }
+        x264_pthread_mutex_destroy( &batch->mutex );
+    }
+    x264_free( batch->queued );
+}
+
 /* If MB-tree changes the quantizers, we need to recalculate the frame cost without
  * re-running lookahead. */
 static int x264_slicetype_frame_cost_recalculate( x264_t *h, x264_frame_t **frames, int p0, int p1, int b )
@@ -954,6 +1128,7 @@ static void x264_macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, fl
     int bipred_weights[2] = {i_bipred_weight, 64 - i_bipred_weight};
     int *buf = h->scratch_buffer;
     uint16_t *propagate_cost = frames[b]->i_propagate_cost;
+    uint16_t *lowres_costs = frames[b]->lowres_costs[b-p0][p1-b];
 
     x264_emms();
     float fps_factor = CLIP_DURATION(frames[b]->f_duration) / CLIP_DURATION(average_duration);
@@ -966,73 +1141,17 @@ static void x264_macroblock_tree_propagate( x264_t *h, x264_frame_t **frames, fl
     {
         int mb_index = h->mb.i_mb_y*h->mb.i_mb_stride;
         h->mc.mbtree_propagate_cost( buf, propagate_cost,
-            frames[b]->i_intra_cost+mb_index, frames[b]->lowres_costs[b-p0][p1-b]+mb_index,
+            frames[b]->i_intra_cost+mb_index, lowres_costs+mb_index,
             frames[b]->i_inv_qscale_factor+mb_index, &fps_factor, h->mb.i_mb_width );
         if( referenced )
             propagate_cost += h->mb.i_mb_width;
-        for( h->mb.i_mb_x = 0; h->mb.i_mb_x < h->mb.i_mb_width; h->mb.i_mb_x++, mb_index++ )
-        {
-            int propagate_amount = buf[h->mb.i_mb_x];
-            /* Don't propagate for an intra block. */
-            if( propagate_amount > 0 )
-            {
-                /* Access width-2 bitfield. */
-                int lists_used = frames[b]->lowres_costs[b-p0][p1-b][mb_index] >> LOWRES_COST_SHIFT;
-                /* Follow the MVs to the previous frame(s). */
-                for( int list = 0; list < 2; list++ )
-                    if( (lists_used >> list)&1 )
-                    {
-#define CLIP_ADD(s,x) (s) = X264_MIN((s)+(x),(1<<16)-1)
-                        int listamount = propagate_amount;
-                        /* Apply bipred weighting. */
-                        if( lists_used == 3 )
-                            listamount = (listamount * bipred_weights[list] + 32) >> 6;
-
-                        /* Early termination for simple case of mv0. */
-                        if( !M32( mvs[list][mb_index] ) )
-                        {
-                            CLIP_ADD( ref_costs[list][mb_index], listamount );
-                            continue;
-                        }
-
-                        int x = mvs[list][mb_index][0];
-                        int y = mvs[list][mb_index][1];
-                        int mbx = (x>>5)+h->mb.i_mb_x;
-                        int mby = (y>>5)+h->mb.i_mb_y;
-                        int idx0 = mbx + mby * h->mb.i_mb_stride;
-                        int idx1 = idx0 + 1;
-                        int idx2 = idx0 + h->mb.i_mb_stride;
-                        int idx3 = idx0 + h->mb.i_mb_stride + 1;
-                        x &= 31;
-                        y &= 31;
-                        int idx0weight = (32-y)*(32-x);
-                        int idx1weight = (32-y)*x;
-                        int idx2weight = y*(32-x);
-                        int idx3weight = y*x;
-
-                        /* We could just clip the MVs, but pixels that lie outside the frame probably shouldn't
-                         * be counted. */
-                        if( mbx < h->mb.i_mb_width-1 && mby < h->mb.i_mb_height-1 && mbx >= 0 && mby >= 0 )
-                        {
-                            CLIP_ADD( ref_costs[list][idx0], (listamount*idx0weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx1], (listamount*idx1weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx2], (listamount*idx2weight+512)>>10 );
-                            CLIP_ADD( ref_costs[list][idx3], (listamount*idx3weight+512)>>10 );
-                        }
-                        else /* Check offsets individually */
-                        {
-                            if( mbx < h->mb.i_mb_width && mby < h->mb.i_mb_height && mbx >= 0 && mby >= 0 )
-                                CLIP_ADD( ref_costs[list][idx0], (listamount*idx0weight+512)>>10 );
-                            if( mbx+1 < h->mb.i_mb_width && mby < h->mb.i_mb_height && mbx+1 >= 0 && mby >= 0 )
-                                CLIP_ADD( ref_costs[list][idx1], (listamount*idx1weight+512)>>10 );
-                            if( mbx < h->mb.i_mb_width && mby+1 < h->mb.i_mb_height && mbx >= 0 && mby+1 >= 0 )
-                                CLIP_ADD( ref_costs[list][idx2], (listamount*idx2weight+512)>>10 );
-                            if( mbx+1 < h->mb.i_mb_width && mby+1 < h->mb.i_mb_height && mbx+1 >= 0 && mby+1 >= 0 )
-                                CLIP_ADD( ref_costs[list][idx3], (listamount*idx3weight+512)>>10 );
-                        }
-                    }
-            }
-        }
+
+        h->mc.mbtree_propagate_list( h, ref_costs[0], &mvs[0][mb_index], buf, &lowres_costs[mb_index],
+                                     bipred_weights[0], h->mb.i_mb_y, h->mb.i_mb_width, 0 );
+        /* P-frames have no list 1 */
+        if( b != p1 )
+            h->mc.mbtree_propagate_list( h, ref_costs[1], &mvs[1][mb_index], buf, &lowres_costs[mb_index],
+                                         bipred_weights[1], h->mb.i_mb_y, h->mb.i_mb_width, 1 );
     }
 
     if( h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead && referenced )
@@ -1081,6 +1200,21 @@ static void x264_macroblock_tree( x264_t *h, x264_mb_analysis_t *a, x264_frame_t
         memset( frames[last_nonb]->i_propagate_cost, 0, h->mb.i_mb_count * sizeof(uint16_t) );
     }
 
+    x264_slicetype_batch_t batch;
+    if( !x264_slicetype_batch_init( h, &batch, a, frames, last_nonb ) )
+    {
+        for( int next = last_nonb, cur; next > idx; next = cur )
+        {
+            cur = next - 1;
+            while( cur > 0 && frames[cur]->i_type == X264_TYPE_B )
+                cur--;
+            if( cur < idx )
+                break;
+            x264_slicetype_batch_minigop( &batch, cur, next );
+        }
+        x264_slicetype_batch_run( &batch );
+    }
+
     while( i-- > idx )
     {
         cur_nonb = i;
@@ -1392,10 +1526,29 @@ static int scenecut( x264_t *h, x264_mb_analysis_t *a, x264_frame_t **frames, in
     return scenecut_internal( h, a, frames, p0, p1, real_scenecut );
 }
 
+/* Load the frame types planned by the leader encoder into frames[1..framecnt].
+ * Returns the number of frames whose type is known, 0 if the leader is gone. */
+static int x264_slicetype_shared_types( x264_t *h, x264_frame_t **frames, int framecnt )
+{
+    int num_frames = 0;
+    for( int j = 1; j <= framecnt; j++ )
+    {
+        /* Only wait for the first one, the leader may not have looked as far ahead as we have. */
+        int type = x264_lookahead_share_get( h->lookahead->share_in, frames[j]->i_frame, 0, j == 1 );
+        if( type < 0 )
+            break;
+        frames[j]->i_type = type;
+        num_frames = j;
+    }
+    return num_frames;
+}
+
 void x264_slicetype_analyse( x264_t *h, int keyframe )
 {
     x264_mb_analysis_t a;
     x264_frame_t *frames[X264_LOOKAHEAD_MAX+3] = { NULL, };
+    x264_frame_t *quarter[X264_LOOKAHEAD_MAX+3];
+    x264_frame_t **dframes = frames; /* the level frametype decisions are made on */
     int num_frames, orig_num_frames, keyint_limit, framecnt;
     int i_mb_count = NUM_MBS;
     int cost1p0, cost2p0, cost1b1, cost2p1;
@@ -1421,6 +1574,19 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
         return;
     }
 
+    if( h->lookahead->share_in && (num_frames = x264_slicetype_shared_types( h, frames, framecnt )) )
+    {
+        /* The frame types come from the leader encoder; only the propagation analysis
+         * is specific to this encoder.  x264_slicetype_decide applies the final types. */
+        if( h->param.rc.b_mb_tree )
+            x264_macroblock_tree( h, &a, frames, X264_MIN(num_frames, h->param.i_keyint_max), keyframe );
+        if( vbv_lookahead )
+            x264_vbv_lookahead( h, &a, frames, num_frames, keyframe );
+        for( int j = 1; j <= num_frames; j++ )
+            frames[j]->i_type = X264_TYPE_AUTO;
+        return;
+    }
+
     keyint_limit = h->param.i_keyint_max - frames[0]->i_frame + h->lookahead->i_last_keyframe - 1;
     orig_num_frames = num_frames = h->param.b_intra_refresh ? framecnt : X264_MIN( framecnt, keyint_limit );
 
@@ -1441,8 +1607,17 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
     int num_bframes = 0;
     int num_analysed_frames = num_frames;
     int reset_start;
-    if( h->param.i_scenecut_threshold && scenecut( h, &a, frames, 0, 1, 1, orig_num_frames, i_max_search ) )
+    if( h->param.rc.b_lookahead_quarter )
+    {
+        x264_slicetype_quarter_enter( h, frames, quarter, framecnt );
+        dframes = quarter;
+        i_mb_count = NUM_MBS;
+    }
+
+    if( h->param.i_scenecut_threshold && scenecut( h, &a, dframes, 0, 1, 1, orig_num_frames, i_max_search ) )
     {
+        if( dframes != frames )
+            x264_slicetype_quarter_leave( h, frames );
         frames[1]->i_type = X264_TYPE_I;
         return;
     }
@@ -1455,10 +1630,20 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
             {
                 char best_paths[X264_BFRAME_MAX+1][X264_LOOKAHEAD_MAX+1] = {"","P"};
                 int best_path_index = num_frames % (X264_BFRAME_MAX+1);
+                x264_slicetype_batch_t batch;
+
+                /* Every minigop the trellis can try, early termination notwithstanding. */
+                if( !x264_slicetype_batch_init( h, &batch, &a, dframes, num_frames ) )
+                {
+                    for( int cur = 0; cur < num_frames; cur++ )
+                        for( int next = cur+1; next <= X264_MIN( cur+h->param.i_bframe+1, num_frames ); next++ )
+                            x264_slicetype_batch_minigop( &batch, cur, next );
+                    x264_slicetype_batch_run( &batch );
+                }
 
                 /* Perform the frametype analysis. */
                 for( int j = 2; j <= num_frames; j++ )
-                    x264_slicetype_path( h, &a, frames, j, best_paths );
+                    x264_slicetype_path( h, &a, dframes, j, best_paths );
 
                 num_bframes = strspn( best_paths[best_path_index], "B" );
                 /* Load the results of the analysis into the frame types. */
@@ -1469,10 +1654,20 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
         }
         else if( h->param.i_bframe_adaptive == X264_B_ADAPT_FAST )
         {
+            x264_slicetype_batch_t batch;
+            if( !x264_slicetype_batch_init( h, &batch, &a, dframes, num_frames ) )
+            {
+                for( int i = 0; i < num_frames; i++ )
+                {
+                    x264_slicetype_batch_add( &batch, i, i+1, i+1 );
+                    x264_slicetype_batch_add( &batch, i, i+2, i+1 );
+                }
+                x264_slicetype_batch_run( &batch );
+            }
             for( int i = 0; i <= num_frames-2; )
             {
-                cost2p1 = x264_slicetype_frame_cost( h, &a, frames, i+0, i+2, i+2, 1 );
-                if( frames[i+2]->i_intra_mbs[2] > i_mb_count / 2 )
+                cost2p1 = x264_slicetype_frame_cost( h, &a, dframes, i+0, i+2, i+2, 1 );
+                if( dframes[i+2]->i_intra_mbs[2] > i_mb_count / 2 )
                 {
                     frames[i+1]->i_type = X264_TYPE_P;
                     frames[i+2]->i_type = X264_TYPE_P;
@@ -1480,9 +1675,9 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
                     continue;
                 }
 
-                cost1b1 = x264_slicetype_frame_cost( h, &a, frames, i+0, i+2, i+1, 0 );
-                cost1p0 = x264_slicetype_frame_cost( h, &a, frames, i+0, i+1, i+1, 0 );
-                cost2p0 = x264_slicetype_frame_cost( h, &a, frames, i+1, i+2, i+2, 0 );
+                cost1b1 = x264_slicetype_frame_cost( h, &a, dframes, i+0, i+2, i+1, 0 );
+                cost1p0 = x264_slicetype_frame_cost( h, &a, dframes, i+0, i+1, i+1, 0 );
+                cost2p0 = x264_slicetype_frame_cost( h, &a, dframes, i+1, i+2, i+2, 0 );
 
                 if( cost1p0 + cost2p0 < cost1b1 + cost2p1 )
                 {
@@ -1500,8 +1695,8 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
                 for( j = i+2; j <= X264_MIN( i+h->param.i_bframe, num_frames-1 ); j++ )
                 {
                     int pthresh = X264_MAX(INTER_THRESH - P_SENS_BIAS * (j-i-1), INTER_THRESH/10);
-                    int pcost = x264_slicetype_frame_cost( h, &a, frames, i+0, j+1, j+1, 1 );
-                    if( pcost > pthresh*i_mb_count || frames[j+1]->i_intra_mbs[j-i+1] > i_mb_count/3 )
+                    int pcost = x264_slicetype_frame_cost( h, &a, dframes, i+0, j+1, j+1, 1 );
+                    if( pcost > pthresh*i_mb_count || dframes[j+1]->i_intra_mbs[j-i+1] > i_mb_count/3 )
                         break;
                     frames[j]->i_type = X264_TYPE_B;
                 }
@@ -1523,7 +1718,7 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
 
         /* Check scenecut on the first minigop. */
         for( int j = 1; j < num_bframes+1; j++ )
-            if( h->param.i_scenecut_threshold && scenecut( h, &a, frames, j, j+1, 0, orig_num_frames, i_max_search ) )
+            if( h->param.i_scenecut_threshold && scenecut( h, &a, dframes, j, j+1, 0, orig_num_frames, i_max_search ) )
             {
                 frames[j]->i_type = X264_TYPE_P;
                 num_analysed_frames = j;
@@ -1540,6 +1735,9 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
         num_bframes = 0;
     }
 
+    if( dframes != frames )
+        x264_slicetype_quarter_leave( h, frames );
+
     /* Perform the actual macroblock tree analysis.
      * Don't go farther than the maximum keyframe interval; this helps in short GOPs. */
     if( h->param.rc.b_mb_tree )
@@ -1559,6 +1757,11 @@ void x264_slicetype_analyse( x264_t *h, int keyframe )
     if( vbv_lookahead )
         x264_vbv_lookahead( h, &a, frames, num_frames, keyframe );
 
+    /* Give encoders following this lookahead the frame types it is planning with. */
+    if( h->lookahead->share_out )
+        for( int j = 1; j <= num_frames; j++ )
+            x264_lookahead_share_put( h->lookahead->share_out, frames[j]->i_frame, frames[j]->i_type, 0 );
+
     /* Restore frametypes for all frames that haven't actually been decided yet. */
     for( int j = reset_start; j <= num_frames; j++ )
         frames[j]->i_type = X264_TYPE_AUTO;
@@ -1612,6 +1815,23 @@ void x264_slicetype_decide( x264_t *h )
             h->lookahead->next.list[i]->i_type =
                 x264_ratecontrol_slice_type( h, h->lookahead->next.list[i]->i_frame );
     }
+    else if( h->lookahead->share_in &&
+             x264_lookahead_share_get( h->lookahead->share_in, h->lookahead->next.list[0]->i_frame, 1, 1 ) >= 0 )
+    {
+        if( h->param.rc.b_mb_tree || (h->param.rc.i_vbv_buffer_size && h->param.rc.i_lookahead) )
+            x264_slicetype_analyse( h, 0 );
+
+        /* Use the frame types of the leader encoder, up to the end of its minigop */
+        for( int i = 0; i < h->lookahead->next.i_size; i++ )
+        {
+            int type = x264_lookahead_share_get( h->lookahead->share_in, h->lookahead->next.list[i]->i_frame, 1, 1 );
+            if( type < 0 )
+                break;
+            h->lookahead->next.list[i]->i_type = type;
+            if( !IS_X264_TYPE_B( type ) )
+                break;
+        }
+    }
     else if( (h->param.i_bframe && h->param.i_bframe_adaptive)
              || h->param.i_scenecut_threshold
              || h->param.rc.b_mb_tree
@@ -1706,6 +1926,11 @@ void x264_slicetype_decide( x264_t *h )
         brefs++;
     }
 
+    if( h->lookahead->share_out )
+        for( int i = 0; i <= bframes; i++ )
+            x264_lookahead_share_put( h->lookahead->share_out, h->lookahead->next.list[i]->i_frame,
+                                      h->lookahead->next.list[i]->i_type, 1 );
+
     /* calculate the frame costs ahead of time for x264_rc_analyse_slice while we still have lowres */
     if( h->param.rc.i_rc_method != X264_RC_CQP )
     {
@@ -0,0 +1,169 @@
+/*****************************************************************************
+ * speedcontrol.c: adapt analysis settings to a target encoding speed
+ *****************************************************************************
+ * Copyright (C) 2012 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+/* The speed controller models a real-time source: every frame adds one frame
+ * duration (scaled by the requested speed) of slack to a buffer, and the wall
+ * time actually spent between frames drains it.  Before each frame, it picks
+ * the slowest analysis level whose predicted cost fits in the time available,
+ * spending more when the buffer is full and less when it runs low.
+ *
+ * The settings the encoder was opened with act as a ceiling: levels only ever
+ * lower them, so the controller never enables a tool that was off (which in
+ * several cases reconfig couldn't do anyway). */
+
+#include "common/common.h"
+#include "ratecontrol.h"
+
+typedef struct
+{
+    float cost;         /* relative time per frame, measured on typical content */
+    int subme;
+    int me_method;
+    int me_range;
+    int refs;
+    int mixed_refs;
+    int trellis;
+    int partitions;
+    int b_8x8dct;
+} x264_speedcontrol_level_t;
+
+#define P_ALL (X264_ANALYSE_I4x4|X264_ANALYSE_I8x8|X264_ANALYSE_PSUB16x16|X264_ANALYSE_BSUB16x16)
+
+/* roughly superfast through veryslow */
+static const x264_speedcontrol_level_t x264_speedcontrol_levels[] =
+{
+    {  1.00,  1, X264_ME_DIA, 16,  1, 0, 0, X264_ANALYSE_I4x4|X264_ANALYSE_I8x8, 0 },
+    {  1.35,  2, X264_ME_HEX, 16,  1, 0, 0, P_ALL, 1 },
+    {  1.70,  4, X264_ME_HEX, 16,  2, 0, 1, P_ALL, 1 },
+    {  2.10,  6, X264_ME_HEX, 16,  2, 1, 1, P_ALL, 1 },
+    {  2.50,  7, X264_ME_HEX, 16,  3, 1, 1, P_ALL, 1 },
+    {  3.30,  8, X264_ME_HEX, 16,  4, 1, 1, P_ALL, 1 },
+    {  4.50,  8, X264_ME_UMH, 16,  5, 1, 2, P_ALL, 1 },
+    {  7.50,  9, X264_ME_UMH, 16,  8, 1, 2, P_ALL|X264_ANALYSE_PSUB8x8, 1 },
+    { 15.00, 10, X264_ME_UMH, 24, 16, 1, 2, P_ALL|X264_ANALYSE_PSUB8x8, 1 },
+};
+#define SC_LEVELS (int)(sizeof(x264_speedcontrol_levels)/sizeof(x264_speedcontrol_levels[0]))
+
+struct x264_speedcontrol_t
+{
+    x264_param_t user;      /* settings at open time: the ceiling for every level */
+    int     i_level;        /* level currently applied, -1 before the first frame */
+    int64_t i_prev_time;
+    double  f_frame_time;   /* time budget per frame at the target speed (us) */
+    double  f_buffer_size;  /* us */
+    double  f_buffer_fill;  /* us */
+    double  f_cplx_num;     /* decaying sums: elapsed time and level cost */
+    double  f_cplx_den;
+    int     i_frames[SC_LEVELS];
+    int     i_underflow;
+};
+
+int x264_speedcontrol_new( x264_t *h )
+{
+    x264_speedcontrol_t *sc;
+    CHECKED_MALLOCZERO( sc, sizeof(x264_speedcontrol_t) );
+    h->sc = sc;
+
+    sc->user = h->param;
+    sc->i_level = -1;
+    sc->f_frame_time = 1e6 * h->param.i_fps_den / h->param.i_fps_num / h->param.rc.f_speed;
+    sc->f_buffer_size = sc->f_frame_time * h->param.rc.i_speed_bufsize;
+    sc->f_buffer_fill = sc->f_buffer_size * h->param.rc.f_speed_bufinit;
+    return 0;
+fail:
+    return -1;
+}
+
+void x264_speedcontrol_delete( x264_t *h )
+{
+    x264_speedcontrol_t *sc = h->sc;
+    if( !sc )
+        return;
+    char buf[SC_LEVELS*8], *p = buf;
+    for( int i = 0; i < SC_LEVELS; i++ )
+        p += sprintf( p, " %d", sc->i_frames[i] );
+    x264_log( h, X264_LOG_INFO, "speedcontrol: frames per level:%s, buffer underflows: %d\n", buf, sc->i_underflow );
+    x264_free( sc );
+}
+
+static void x264_speedcontrol_apply( x264_t *h, int level )
+{
+    x264_speedcontrol_t *sc = h->thread[0]->sc;
+    const x264_speedcontrol_level_t *l = &x264_speedcontrol_levels[level];
+    x264_param_t p = h->param;
+
+    p.analyse.i_subpel_refine = X264_MIN( l->subme, sc->user.analyse.i_subpel_refine );
+    p.analyse.i_me_method     = X264_MIN( l->me_method, sc->user.analyse.i_me_method );
+    if( sc->user.analyse.i_me_method == X264_ME_HASH && l->me_method >= X264_ME_UMH )
+        p.analyse.i_me_method = X264_ME_HASH;
+    p.analyse.i_me_range      = X264_MIN( l->me_range, sc->user.analyse.i_me_range );
+    p.i_frame_reference       = X264_MIN( l->refs, sc->user.i_frame_reference );
+    p.analyse.b_mixed_references = l->mixed_refs && sc->user.analyse.b_mixed_references;
+    p.analyse.i_trellis       = X264_MIN( l->trellis, sc->user.analyse.i_trellis );
+    p.analyse.inter           = l->partitions & sc->user.analyse.inter;
+    p.analyse.b_transform_8x8 = l->b_8x8dct && sc->user.analyse.b_transform_8x8;
+    x264_encoder_reconfig( h, &p );
+}
+
+/* Called once per frame in x264_encoder_encode, before the frame is analysed. */
+void x264_speedcontrol_frame( x264_t *h )
+{
+    x264_speedcontrol_t *sc = h->thread[0]->sc;
+    int64_t now = x264_mdate();
+
+    if( sc->i_prev_time )
+    {
+        double elapsed = now - sc->i_prev_time;
+        /* with frame threads, the time between calls is the pipeline throughput,
+         * which lags level changes by a few frames; the decay smooths that out */
+        sc->f_cplx_num = sc->f_cplx_num * 0.9 + elapsed;
+        sc->f_cplx_den = sc->f_cplx_den * 0.9 + x264_speedcontrol_levels[sc->i_level].cost;
+        sc->f_buffer_fill += sc->f_frame_time - elapsed;
+        if( sc->f_buffer_fill < 0 )
+        {
+            sc->f_buffer_fill = 0;
+            sc->i_underflow++;
+        }
+        sc->f_buffer_fill = X264_MIN( sc->f_buffer_fill, sc->f_buffer_size );
+    }
+    sc->i_prev_time = now;
+
+    int level = sc->i_level < 0 ? SC_LEVELS/2 : sc->i_level;
+    if( sc->f_cplx_den > 0 )
+    {
+        /* Aim to bring the buffer back to half full over half a buffer's worth of frames. */
+        double time_per_cost = sc->f_cplx_num / sc->f_cplx_den;
+        double target = sc->f_frame_time + (sc->f_buffer_fill - sc->f_buffer_size * 0.5)
+                      / X264_MAX( h->param.rc.i_speed_bufsize * 0.5, 1 );
+        level = 0;
+        while( level < SC_LEVELS-1 && x264_speedcontrol_levels[level+1].cost * time_per_cost <= target )
+            level++;
+    }
+
+    if( level != sc->i_level )
+    {
+        x264_speedcontrol_apply( h, level );
+        sc->i_level = level;
+    }
+    sc->i_frames[level]++;
+}
@@ -25,6 +25,11 @@
 
 #include "input.h"
 
+#if HAVE_MMAP
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 const x264_cli_csp_t x264_cli_csps[] = {
     [X264_CSP_I420] = { "i420", 3, { 1, .5, .5 }, { 1, .5, .5 }, 2, 2 },
     [X264_CSP_I422] = { "i422", 3, { 1, .5, .5 }, { 1,  1,  1 }, 2, 1 },
@@ -74,7 +79,7 @@ uint64_t x264_cli_pic_size( int csp, int width, int height )
     return size;
 }
 
-int x264_cli_pic_alloc( cli_pic_t *pic, int csp, int width, int height )
+int x264_cli_pic_init_noalloc( cli_pic_t *pic, int csp, int width, int height )
 {
     memset( pic, 0, sizeof(cli_pic_t) );
     int csp_mask = csp & X264_CSP_MASK;
@@ -85,12 +90,19 @@ int x264_cli_pic_alloc( cli_pic_t *pic, int csp, int width, int height )
     pic->img.csp    = csp;
     pic->img.width  = width;
     pic->img.height = height;
+    for( int i = 0; i < pic->img.planes; i++ )
+        pic->img.stride[i] = width * x264_cli_csps[csp_mask].width[i] * x264_cli_csp_depth_factor( csp );
+    return 0;
+}
+
+int x264_cli_pic_alloc( cli_pic_t *pic, int csp, int width, int height )
+{
+    x264_cli_pic_init_noalloc( pic, csp, width, height );
     for( int i = 0; i < pic->img.planes; i++ )
     {
          pic->img.plane[i] = x264_malloc( x264_cli_pic_plane_size( csp, width, height, i ) );
          if( !pic->img.plane[i] )
              return -1;
-         pic->img.stride[i] = width * x264_cli_csps[csp_mask].width[i] * x264_cli_csp_depth_factor( csp );
     }
 
     return 0;
@@ -133,3 +145,60 @@ int read_picture_with_correct_bit_depth( cli_pic_t *pic, input_depth_hnd_t *h )
 
     return error;
 }
+
+int x264_cli_mmap_init( cli_mmap_t *h, FILE *fh )
+{
+#if HAVE_MMAP
+    int fd = fileno( fh );
+    struct stat file_stat;
+    if( fstat( fd, &file_stat ) || !S_ISREG( file_stat.st_mode ) ||
+        !file_stat.st_size || (uint64_t)file_stat.st_size > SIZE_MAX )
+        return -1;
+    h->size = file_stat.st_size;
+    h->page_size = sysconf( _SC_PAGESIZE );
+    h->addr = mmap( NULL, h->size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( h->addr == MAP_FAILED )
+    {
+        h->addr = NULL;
+        return -1;
+    }
+    /* frames are consumed in order: ask for aggressive read-ahead */
+    madvise( h->addr, h->size, MADV_SEQUENTIAL );
+    return 0;
+#else
+    return -1;
+#endif
+}
+
+/* point the planes of pic, set up with x264_cli_pic_init_noalloc, at a frame
+ * stored contiguously at offset in the mapping */
+void x264_cli_mmap_frame( cli_pic_t *pic, cli_mmap_t *h, uint64_t offset )
+{
+    uint8_t *data = h->addr + offset;
+    for( int i = 0; i < pic->img.planes; i++ )
+    {
+        pic->img.plane[i] = data;
+        data += x264_cli_pic_plane_size( pic->img.csp, pic->img.width, pic->img.height, i );
+    }
+}
+
+/* drop the pages of a consumed frame from the mapping; they are still in the page cache
+ * if the frame is read again. */
+void x264_cli_mmap_release( cli_mmap_t *h, cli_pic_t *pic )
+{
+#if HAVE_MMAP
+    intptr_t mask = h->page_size - 1;
+    intptr_t start = (intptr_t)pic->img.plane[0] & ~mask;
+    intptr_t end = ((intptr_t)pic->img.plane[0] + x264_cli_pic_size( pic->img.csp, pic->img.width, pic->img.height )) & ~mask;
+    if( end > start )
+        madvise( (void*)start, end - start, MADV_DONTNEED );
+#endif
+}
+
+void x264_cli_mmap_close( cli_mmap_t *h )
+{
+#if HAVE_MMAP
+    if( h->addr )
+        munmap( h->addr, h->size );
+#endif
+}
@@ -44,6 +44,7 @@ typedef struct
     int output_csp; /* convert to this csp, if applicable */
     int output_range; /* user desired output range */
     int input_range; /* user override input range */
+    int input_queue; /* frames read ahead by the input thread */
 } cli_input_opt_t;
 
 /* properties of the source given by the demuxer */
@@ -88,10 +89,10 @@ typedef struct
 typedef struct
 {
     int (*open_file)( char *psz_filename, hnd_t *p_handle, video_info_t *info, cli_input_opt_t *opt );
-    int (*picture_alloc)( cli_pic_t *pic, int csp, int width, int height );
+    int (*picture_alloc)( cli_pic_t *pic, hnd_t handle, int csp, int width, int height );
     int (*read_frame)( cli_pic_t *pic, hnd_t handle, int i_frame );
     int (*release_frame)( cli_pic_t *pic, hnd_t handle );
-    void (*picture_clean)( cli_pic_t *pic );
+    void (*picture_clean)( cli_pic_t *pic, hnd_t handle );
     int (*close_file)( hnd_t handle );
 } cli_input_t;
 
@@ -124,6 +125,7 @@ extern const x264_cli_csp_t x264_cli_csps[];
 int      x264_cli_csp_is_invalid( int csp );
 int      x264_cli_csp_depth_factor( int csp );
 int      x264_cli_pic_alloc( cli_pic_t *pic, int csp, int width, int height );
+int      x264_cli_pic_init_noalloc( cli_pic_t *pic, int csp, int width, int height );
 void     x264_cli_pic_clean( cli_pic_t *pic );
 uint64_t x264_cli_pic_plane_size( int csp, int width, int height, int plane );
 uint64_t x264_cli_pic_size( int csp, int width, int height );
@@ -138,4 +140,18 @@ typedef struct
 
 int read_picture_with_correct_bit_depth( cli_pic_t *pic, input_depth_hnd_t *h );
 
+/* read-only mapping of a whole input file, used by the raw and y4m demuxers so that
+ * frames can be handed out in place instead of being copied */
+typedef struct
+{
+    uint8_t *addr;
+    uint64_t size;
+    int page_size;
+} cli_mmap_t;
+
+int  x264_cli_mmap_init( cli_mmap_t *h, FILE *fh );
+void x264_cli_mmap_frame( cli_pic_t *pic, cli_mmap_t *h, uint64_t offset );
+void x264_cli_mmap_release( cli_mmap_t *h, cli_pic_t *pic );
+void x264_cli_mmap_close( cli_mmap_t *h );
+
 #endif
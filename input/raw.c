@@ -35,6 +35,8 @@ typedef struct
     uint64_t plane_size[4];
     uint64_t frame_size;
     int bit_depth;
+    int use_mmap;
+    cli_mmap_t mmap;
 
     input_depth_hnd_t *handler;
 } raw_hnd_t;
@@ -103,16 +105,36 @@ static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, c
         uint64_t size = ftell( h->fh );
         fseek( h->fh, 0, SEEK_SET );
         info->num_frames = size / h->frame_size;
+
+        /* frames are handed out straight from a mapping of the file, unless the samples
+         * have to be upconverted in place */
+        h->use_mmap = !(h->bit_depth & 7) && !x264_cli_mmap_init( &h->mmap, h->fh );
+        if( h->use_mmap )
+            info->thread_safe = 0; /* reading is free, a read-ahead thread would only add overhead */
     }
 
     *p_handle = h;
     return 0;
 }
 
+static int picture_alloc( cli_pic_t *pic, hnd_t handle, int csp, int width, int height )
+{
+    raw_hnd_t *h = handle;
+    return (h->use_mmap ? x264_cli_pic_init_noalloc : x264_cli_pic_alloc)( pic, csp, width, height );
+}
+
 static int read_frame( cli_pic_t *pic, hnd_t handle, int i_frame )
 {
     raw_hnd_t *h = handle;
 
+    if( h->use_mmap )
+    {
+        if( (i_frame + 1) * h->frame_size > h->mmap.size )
+            return -1;
+        x264_cli_mmap_frame( pic, &h->mmap, i_frame * h->frame_size );
+        return 0;
+    }
+
     if( i_frame > h->next_frame )
     {
         if( x264_is_regular_file( h->fh ) )
@@ -133,14 +155,33 @@ static int read_frame( cli_pic_t *pic, hnd_t handle, int i_frame )
     return 0;
 }
 
+static int release_frame( cli_pic_t *pic, hnd_t handle )
+{
+    raw_hnd_t *h = handle;
+    if( h->use_mmap )
+        x264_cli_mmap_release( &h->mmap, pic );
+    return 0;
+}
+
+static void picture_clean( cli_pic_t *pic, hnd_t handle )
+{
+    raw_hnd_t *h = handle;
+    if( h->use_mmap )
+        memset( pic, 0, sizeof(cli_pic_t) );
+    else
+        x264_cli_pic_clean( pic );
+}
+
 static int close_file( hnd_t handle )
 {
     raw_hnd_t *h = handle;
     if( !h || !h->fh )
         return 0;
+    if( h->use_mmap )
+        x264_cli_mmap_close( &h->mmap );
     fclose( h->fh );
     free( h );
     return 0;
 }
 
-const cli_input_t raw_input = { open_file, x264_cli_pic_alloc, read_frame, NULL, x264_cli_pic_clean, close_file };
+const cli_input_t raw_input = { open_file, picture_alloc, read_frame, release_frame, picture_clean, close_file };
@@ -26,79 +26,135 @@
 
 #include "input.h"
 
+typedef struct
+{
+    cli_pic_t pic;
+    int i_frame;
+    int status;
+} thread_input_slot_t;
+
+/* The reader runs as a single long job on the pool and keeps a ring of up to
+ * queue_size frames read ahead of the encoder, so that a frame that is slow to
+ * decode (e.g. a keyframe with lavf/ffms) is absorbed by the queue instead of
+ * stalling encoding.  Demuxers read sequentially, so there is only one reader. */
 typedef struct
 {
     cli_input_t input;
     hnd_t p_handle;
-    cli_pic_t pic;
     x264_threadpool_t *pool;
-    int next_frame;
     int frame_total;
-    struct thread_input_arg_t *next_args;
-} thread_hnd_t;
+    int b_started;
 
-typedef struct thread_input_arg_t
-{
-    thread_hnd_t *h;
-    cli_pic_t *pic;
-    int i_frame;
-    int status;
-} thread_input_arg_t;
+    /* everything below is protected by mutex */
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t cv;
+    thread_input_slot_t *slot;
+    int queue_size;
+    int head;       /* slot of the oldest frame read */
+    int count;      /* frames read and not yet consumed */
+    int next_read;  /* next frame for the reader */
+    int b_eof;      /* reader hit the end of input or an error */
+    int b_exit;
+} thread_hnd_t;
 
 static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, cli_input_opt_t *opt )
 {
-    thread_hnd_t *h = malloc( sizeof(thread_hnd_t) );
-    FAIL_IF_ERR( !h || cli_input.picture_alloc( &h->pic, info->csp, info->width, info->height ),
-                 "x264", "malloc failed\n" )
+    thread_hnd_t *h = calloc( 1, sizeof(thread_hnd_t) );
+    FAIL_IF_ERR( !h, "x264", "malloc failed\n" )
     h->input = cli_input;
     h->p_handle = *p_handle;
-    h->next_frame = -1;
-    h->next_args = malloc( sizeof(thread_input_arg_t) );
-    if( !h->next_args )
-        return -1;
-    h->next_args->h = h;
-    h->next_args->status = 0;
     h->frame_total = info->num_frames;
-    thread_input.picture_alloc = h->input.picture_alloc;
-    thread_input.picture_clean = h->input.picture_clean;
+    h->queue_size = X264_MAX( opt->input_queue, 1 );
+    h->slot = calloc( h->queue_size, sizeof(thread_input_slot_t) );
+    FAIL_IF_ERR( !h->slot, "x264", "malloc failed\n" )
+    for( int i = 0; i < h->queue_size; i++ )
+        FAIL_IF_ERR( h->input.picture_alloc( &h->slot[i].pic, h->p_handle, info->csp, info->width, info->height ),
+                     "x264", "malloc failed\n" )
 
-    if( x264_threadpool_init( &h->pool, 1, NULL, NULL ) )
+    if( x264_pthread_mutex_init( &h->mutex, NULL ) || x264_pthread_cond_init( &h->cv, NULL ) ||
+        x264_threadpool_init( &h->pool, 1, NULL, NULL ) )
         return -1;
 
     *p_handle = h;
     return 0;
 }
 
-static void read_frame_thread_int( thread_input_arg_t *i )
+static int picture_alloc( cli_pic_t *pic, hnd_t handle, int csp, int width, int height )
 {
-    i->status = i->h->input.read_frame( i->pic, i->h->p_handle, i->i_frame );
+    thread_hnd_t *h = handle;
+    return h->input.picture_alloc( pic, h->p_handle, csp, width, height );
+}
+
+static void *read_frames_thread( thread_hnd_t *h )
+{
+    x264_pthread_mutex_lock( &h->mutex );
+    while( !h->b_exit )
+    {
+        if( h->count == h->queue_size || h->b_eof )
+        {
+            x264_pthread_cond_wait( &h->cv, &h->mutex );
+            continue;
+        }
+        /* the consumer only takes from the head, so this slot stays ours while unlocked */
+        thread_input_slot_t *slot = &h->slot[(h->head + h->count) % h->queue_size];
+        int i_frame = h->next_read++;
+        x264_pthread_mutex_unlock( &h->mutex );
+
+        int status = h->frame_total && i_frame >= h->frame_total ? -1 :
+                     h->input.read_frame( &slot->pic, h->p_handle, i_frame );
+
+        x264_pthread_mutex_lock( &h->mutex );
+        slot->i_frame = i_frame;
+        slot->status = status;
+        h->b_eof = !!status;
+        h->count++;
+        x264_pthread_cond_broadcast( &h->cv );
+    }
+    x264_pthread_mutex_unlock( &h->mutex );
+    return NULL;
 }
 
 static int read_frame( cli_pic_t *p_pic, hnd_t handle, int i_frame )
 {
     thread_hnd_t *h = handle;
-    int ret = 0;
+    int ret = -1;
 
-    if( h->next_frame >= 0 )
+    x264_pthread_mutex_lock( &h->mutex );
+    /* frames skipped over (--seek, select_every) are not read at all if the reader
+     * hasn't got to them yet */
+    h->next_read = X264_MAX( h->next_read, i_frame );
+    if( !h->b_started )
     {
-        x264_threadpool_wait( h->pool, h->next_args );
-        ret |= h->next_args->status;
+        h->b_started = 1;
+        x264_threadpool_run( h->pool, (void*)read_frames_thread, h );
     }
-
-    if( h->next_frame == i_frame )
-        XCHG( cli_pic_t, *p_pic, h->pic );
-    else
-        ret |= h->input.read_frame( p_pic, h->p_handle, i_frame );
-
-    if( !h->frame_total || i_frame+1 < h->frame_total )
+    while( 1 )
     {
-        h->next_frame =
-        h->next_args->i_frame = i_frame+1;
-        h->next_args->pic = &h->pic;
-        x264_threadpool_run( h->pool, (void*)read_frame_thread_int, h->next_args );
+        if( h->count )
+        {
+            thread_input_slot_t *slot = &h->slot[h->head];
+            if( slot->i_frame > i_frame )
+                break;
+            if( slot->i_frame == i_frame )
+            {
+                ret = slot->status;
+                if( !ret )
+                    XCHG( cli_pic_t, *p_pic, slot->pic );
+            }
+            else if( !slot->status && h->input.release_frame )
+                h->input.release_frame( &slot->pic, h->p_handle );
+            h->head = (h->head + 1) % h->queue_size;
+            h->count--;
+            x264_pthread_cond_broadcast( &h->cv );
+            if( slot->i_frame == i_frame )
+                break;
+        }
+        else if( h->b_eof )
+            break;
+        else
+            x264_pthread_cond_wait( &h->cv, &h->mutex );
     }
-    else
-        h->next_frame = -1;
+    x264_pthread_mutex_unlock( &h->mutex );
 
     return ret;
 }
@@ -111,15 +167,36 @@ static int release_frame( cli_pic_t *pic, hnd_t handle )
     return 0;
 }
 
+static void picture_clean( cli_pic_t *pic, hnd_t handle )
+{
+    thread_hnd_t *h = handle;
+    h->input.picture_clean( pic, h->p_handle );
+}
+
 static int close_file( hnd_t handle )
 {
     thread_hnd_t *h = handle;
+    x264_pthread_mutex_lock( &h->mutex );
+    h->b_exit = 1;
+    x264_pthread_cond_broadcast( &h->cv );
+    x264_pthread_mutex_unlock( &h->mutex );
+    if( h->b_started )
+        x264_threadpool_wait( h->pool, h );
     x264_threadpool_delete( h->pool );
+    for( int i = 0; i < h->count; i++ )
+    {
+        thread_input_slot_t *slot = &h->slot[(h->head + i) % h->queue_size];
+        if( !slot->status && h->input.release_frame )
+            h->input.release_frame( &slot->pic, h->p_handle );
+    }
+    for( int i = 0; i < h->queue_size; i++ )
+        h->input.picture_clean( &h->slot[i].pic, h->p_handle );
     h->input.close_file( h->p_handle );
-    h->input.picture_clean( &h->pic );
-    free( h->next_args );
+    x264_pthread_mutex_destroy( &h->mutex );
+    x264_pthread_cond_destroy( &h->cv );
+    free( h->slot );
     free( h );
     return 0;
 }
 
-cli_input_t thread_input = { open_file, NULL, read_frame, release_frame, NULL, close_file };
+cli_input_t thread_input = { open_file, picture_alloc, read_frame, release_frame, picture_clean, close_file };
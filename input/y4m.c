@@ -36,6 +36,12 @@ typedef struct
     uint64_t frame_size;
     uint64_t plane_size[3];
     int bit_depth;
+    int use_mmap;
+    cli_mmap_t mmap;
+    uint64_t data_size;       /* frame size without the header */
+    uint64_t *frame_offset;   /* offset of the data of each frame in the mapping, */
+    int index_count;          /* indexed on demand */
+    int index_size;
 
     input_depth_hnd_t *handler;
 } y4m_hnd_t;
@@ -67,7 +73,7 @@ static int parse_csp_and_depth( char *csp_name, int *bit_depth )
 
 static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, cli_input_opt_t *opt )
 {
-    y4m_hnd_t *h = malloc( sizeof(y4m_hnd_t) );
+    y4m_hnd_t *h = calloc( 1, sizeof(y4m_hnd_t) );
     int i;
     uint32_t n, d;
     char header[MAX_YUV4_HEADER+10];
@@ -219,6 +225,7 @@ static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, c
         h->plane_size[i] /= x264_cli_csp_depth_factor( info->csp );
         h->handler->plane_size[i] = h->plane_size[i];
     }
+    h->data_size = h->frame_size - h->frame_header_len;
 
     /* Most common case: frame_header = "FRAME" */
     if( x264_is_regular_file( h->fh ) )
@@ -228,6 +235,12 @@ static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, c
         uint64_t i_size = ftell( h->fh );
         fseek( h->fh, init_pos, SEEK_SET );
         info->num_frames = (i_size - h->seq_header_len) / h->frame_size;
+
+        /* frames are handed out straight from a mapping of the file, unless the samples
+         * have to be upconverted in place */
+        h->use_mmap = !(h->bit_depth & 7) && !x264_cli_mmap_init( &h->mmap, h->fh );
+        if( h->use_mmap )
+            info->thread_safe = 0; /* reading is free, a read-ahead thread would only add overhead */
     }
 
     *p_handle = h;
@@ -237,8 +250,8 @@ static int open_file( char *psz_filename, hnd_t *p_handle, video_info_t *info, c
 static int read_frame_internal( cli_pic_t *pic, y4m_hnd_t *h )
 {
     size_t slen = strlen( Y4M_FRAME_MAGIC );
-    int i = 0;
-    char header[16];
+    int i;
+    char header[MAX_FRAME_HEADER+1];
 
     /* Read frame header - without terminating '\n' */
     if( fread( header, 1, slen, h->fh ) != slen )
@@ -249,19 +262,66 @@ static int read_frame_internal( cli_pic_t *pic, y4m_hnd_t *h )
                    M32(header), header )
 
     /* Skip most of it */
-    while( i < MAX_FRAME_HEADER && fgetc( h->fh ) != '\n' )
-        i++;
-    FAIL_IF_ERROR( i == MAX_FRAME_HEADER, "bad frame header!\n" )
+    FAIL_IF_ERROR( !fgets( header, sizeof(header), h->fh ), "bad frame header!\n" )
+    i = strlen( header ) - 1;
+    FAIL_IF_ERROR( i < 0 || header[i] != '\n', "bad frame header!\n" )
     h->frame_size = h->frame_size - h->frame_header_len + i+slen+1;
     h->frame_header_len = i+slen+1;
 
     return read_picture_with_correct_bit_depth( pic, h->handler );
 }
 
+/* Extend the index of frame offsets up to i_frame by parsing the frame headers in the mapping.
+ * Headers may carry parameters, so the position of a frame is only known once all those
+ * before it have been seen; each header is only parsed once. */
+static int index_frames( y4m_hnd_t *h, int i_frame )
+{
+    size_t slen = strlen( Y4M_FRAME_MAGIC );
+    while( h->index_count <= i_frame )
+    {
+        uint64_t pos = h->index_count ? h->frame_offset[h->index_count-1] + h->data_size : h->seq_header_len;
+        if( pos + slen > h->mmap.size )
+            return -1;
+        const uint8_t *header = h->mmap.addr + pos;
+        FAIL_IF_ERROR( memcmp( header, Y4M_FRAME_MAGIC, slen ), "bad header magic (%"PRIx32" <=> %.5s)\n",
+                       M32(header), header )
+        const uint8_t *end = memchr( header + slen, '\n', X264_MIN( MAX_FRAME_HEADER, h->mmap.size - pos - slen ) );
+        FAIL_IF_ERROR( !end, "bad frame header!\n" )
+        pos += end + 1 - header;
+        if( pos + h->data_size > h->mmap.size )
+            return -1;
+
+        if( h->index_count == h->index_size )
+        {
+            int size = X264_MAX( 2 * h->index_size, 256 );
+            uint64_t *offset = realloc( h->frame_offset, size * sizeof(uint64_t) );
+            FAIL_IF_ERROR( !offset, "malloc failed\n" )
+            h->frame_offset = offset;
+            h->index_size = size;
+        }
+        h->frame_offset[h->index_count++] = pos;
+    }
+    return 0;
+}
+
+static int picture_alloc( cli_pic_t *pic, hnd_t handle, int csp, int width, int height )
+{
+    y4m_hnd_t *h = handle;
+    return (h->use_mmap ? x264_cli_pic_init_noalloc : x264_cli_pic_alloc)( pic, csp, width, height );
+}
+
 static int read_frame( cli_pic_t *pic, hnd_t handle, int i_frame )
 {
     y4m_hnd_t *h = handle;
 
+    if( h->use_mmap )
+    {
+        if( index_frames( h, i_frame ) )
+            return -1;
+        x264_cli_mmap_frame( pic, &h->mmap, h->frame_offset[i_frame] );
+        return 0;
+    }
+
     if( i_frame > h->next_frame )
     {
         if( x264_is_regular_file( h->fh ) )
@@ -282,14 +342,34 @@ static int read_frame( cli_pic_t *pic, hnd_t handle, int i_frame )
     return 0;
 }
 
+static int release_frame( cli_pic_t *pic, hnd_t handle )
+{
+    y4m_hnd_t *h = handle;
+    if( h->use_mmap )
+        x264_cli_mmap_release( &h->mmap, pic );
+    return 0;
+}
+
+static void picture_clean( cli_pic_t *pic, hnd_t handle )
+{
+    y4m_hnd_t *h = handle;
+    if( h->use_mmap )
+        memset( pic, 0, sizeof(cli_pic_t) );
+    else
+        x264_cli_pic_clean( pic );
+}
+
 static int close_file( hnd_t handle )
 {
     y4m_hnd_t *h = handle;
     if( !h || !h->fh )
         return 0;
+    if( h->use_mmap )
+        x264_cli_mmap_close( &h->mmap );
+    free( h->frame_offset );
     fclose( h->fh );
     free( h );
     return 0;
 }
 
-const cli_input_t y4m_input = { open_file, x264_cli_pic_alloc, read_frame, NULL, x264_cli_pic_clean, close_file };
+const cli_input_t y4m_input = { open_file, picture_alloc, read_frame, release_frame, picture_clean, close_file };
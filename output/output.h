@@ -47,5 +47,8 @@ extern const cli_output_t raw_output;
 extern const cli_output_t mkv_output;
 extern const cli_output_t mp4_output;
 extern const cli_output_t flv_output;
+extern cli_output_t thread_output;
+
+extern cli_output_t cli_output;
 
 #endif
@@ -0,0 +1,172 @@
+/*****************************************************************************
+ * thread.c: threaded output
+ *****************************************************************************
+ * Copyright (C) 2012 x264 project
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02111, USA.
+ *
+ * This program is also available under a commercial proprietary license.
+ * For more information, contact us at licensing@x264.com.
+ *****************************************************************************/
+
+#include "output.h"
+
+/* Frames waiting to be written.  Each slot keeps its buffer between frames, so
+ * after the first few frames nothing is allocated. */
+#define THREAD_OUTPUT_QUEUE 32
+
+typedef struct
+{
+    uint8_t *data;
+    int i_size;
+    int i_alloc;
+    x264_picture_t pic;
+} thread_output_slot_t;
+
+/* The writer runs as a single long job on the pool and calls the real muxer's
+ * write_frame for each queued frame, so that blocking writes and seeks in the
+ * muxers don't hold up encoding.  Headers and the final close are done by the
+ * calling thread, when the queue is empty. */
+typedef struct
+{
+    cli_output_t output;
+    hnd_t p_handle;
+    x264_threadpool_t *pool;
+
+    /* everything below is protected by mutex */
+    x264_pthread_mutex_t mutex;
+    x264_pthread_cond_t cv;
+    thread_output_slot_t slot[THREAD_OUTPUT_QUEUE];
+    int head;       /* oldest queued frame */
+    int count;      /* frames queued, including the one being written */
+    int b_error;    /* a write failed; reported by the next write_frame */
+    int b_exit;
+} thread_output_hnd_t;
+
+static void *write_frames_thread( thread_output_hnd_t *h )
+{
+    x264_pthread_mutex_lock( &h->mutex );
+    while( 1 )
+    {
+        if( !h->count )
+        {
+            if( h->b_exit )
+                break;
+            x264_pthread_cond_wait( &h->cv, &h->mutex );
+            continue;
+        }
+        /* the caller only appends behind the head, so this slot stays ours while unlocked */
+        thread_output_slot_t *slot = &h->slot[h->head];
+        x264_pthread_mutex_unlock( &h->mutex );
+
+        int ret = h->output.write_frame( h->p_handle, slot->data, slot->i_size, &slot->pic );
+
+        x264_pthread_mutex_lock( &h->mutex );
+        h->b_error |= ret < 0;
+        h->head = (h->head + 1) % THREAD_OUTPUT_QUEUE;
+        h->count--;
+        x264_pthread_cond_broadcast( &h->cv );
+    }
+    x264_pthread_mutex_unlock( &h->mutex );
+    return NULL;
+}
+
+/* Wraps the muxer already opened in cli_output. */
+static int open_file( char *psz_filename, hnd_t *p_handle, cli_output_opt_t *opt )
+{
+    thread_output_hnd_t *h = calloc( 1, sizeof(thread_output_hnd_t) );
+    FAIL_IF_ERR( !h, "x264", "malloc failed\n" )
+    h->output = cli_output;
+    h->p_handle = *p_handle;
+    if( x264_pthread_mutex_init( &h->mutex, NULL ) || x264_pthread_cond_init( &h->cv, NULL ) ||
+        x264_threadpool_init( &h->pool, 1, NULL, NULL ) )
+        return -1;
+    x264_threadpool_run( h->pool, (void*)write_frames_thread, h );
+
+    *p_handle = h;
+    return 0;
+}
+
+static int set_param( hnd_t handle, x264_param_t *p_param )
+{
+    thread_output_hnd_t *h = handle;
+    return h->output.set_param( h->p_handle, p_param );
+}
+
+static int write_headers( hnd_t handle, x264_nal_t *p_nal )
+{
+    thread_output_hnd_t *h = handle;
+    return h->output.write_headers( h->p_handle, p_nal );
+}
+
+static int write_frame( hnd_t handle, uint8_t *p_nalu, int i_size, x264_picture_t *p_picture )
+{
+    thread_output_hnd_t *h = handle;
+
+    x264_pthread_mutex_lock( &h->mutex );
+    while( h->count == THREAD_OUTPUT_QUEUE )
+        x264_pthread_cond_wait( &h->cv, &h->mutex );
+    int b_error = h->b_error;
+    thread_output_slot_t *slot = &h->slot[(h->head + h->count) % THREAD_OUTPUT_QUEUE];
+    x264_pthread_mutex_unlock( &h->mutex );
+
+    if( b_error )
+        return -1;
+    if( i_size > slot->i_alloc )
+    {
+        /* leave room to grow so that the buffer isn't reallocated for every larger frame */
+        int i_alloc = i_size + i_size/4;
+        uint8_t *data = realloc( slot->data, i_alloc );
+        FAIL_IF_ERR( !data, "x264", "malloc failed\n" )
+        slot->data = data;
+        slot->i_alloc = i_alloc;
+    }
+    memcpy( slot->data, p_nalu, i_size );
+    slot->i_size = i_size;
+    slot->pic = *p_picture;
+
+    x264_pthread_mutex_lock( &h->mutex );
+    h->count++;
+    x264_pthread_cond_broadcast( &h->cv );
+    x264_pthread_mutex_unlock( &h->mutex );
+
+    /* the muxer's container overhead isn't known yet: report the size of the frame itself */
+    return i_size;
+}
+
+static int close_file( hnd_t handle, int64_t largest_pts, int64_t second_largest_pts )
+{
+    thread_output_hnd_t *h = handle;
+
+    x264_pthread_mutex_lock( &h->mutex );
+    h->b_exit = 1;
+    x264_pthread_cond_broadcast( &h->cv );
+    x264_pthread_mutex_unlock( &h->mutex );
+    x264_threadpool_wait( h->pool, h );
+    x264_threadpool_delete( h->pool );
+
+    if( h->b_error )
+        x264_cli_log( "x264", X264_LOG_ERROR, "error writing to output file\n" );
+    int ret = h->output.close_file( h->p_handle, largest_pts, second_largest_pts );
+
+    for( int i = 0; i < THREAD_OUTPUT_QUEUE; i++ )
+        free( h->slot[i].data );
+    x264_pthread_mutex_destroy( &h->mutex );
+    x264_pthread_cond_destroy( &h->cv );
+    free( h );
+    return ret;
+}
+
+cli_output_t thread_output = { open_file, set_param, write_headers, write_frame, close_file };
@@ -86,7 +86,7 @@ typedef struct {
 
 /* file i/o operation structs */
 cli_input_t cli_input;
-static cli_output_t cli_output;
+cli_output_t cli_output;
 
 /* video filter operation struct */
 static cli_vid_filter_t filter;
@@ -620,9 +620,16 @@ static void help( x264_param_t *defaults, int longhelp )
     H0( "  -B, --bitrate <integer>     Set bitrate (kbit/s)\n" );
     H0( "      --crf <float>           Quality-based VBR (%d-51) [%.1f]\n", 51 - QP_MAX_SPEC, defaults->rc.f_rf_constant );
     H1( "      --rc-lookahead <integer> Number of frames for frametype lookahead [%d]\n", defaults->rc.i_lookahead );
+    H2( "      --lookahead-quarter     Decide frametypes and scenecuts at 1/4 resolution,\n"
+        "                                  keeping 1/2 resolution for mb-tree (for 4K and up)\n" );
     H0( "      --vbv-maxrate <integer> Max local bitrate (kbit/s) [%d]\n", defaults->rc.i_vbv_max_bitrate );
     H0( "      --vbv-bufsize <integer> Set size of the VBV buffer (kbit) [%d]\n", defaults->rc.i_vbv_buffer_size );
     H2( "      --vbv-init <float>      Initial VBV buffer occupancy [%.1f]\n", defaults->rc.f_vbv_buffer_init );
+    H1( "      --speed <float>         Lower analysis settings as needed to encode at\n"
+        "                                  this multiple of realtime (fps) [off]\n"
+        "                                  The given preset is the highest quality used\n" );
+    H2( "      --speed-bufsize <integer>  Frames of slack for --speed [%d]\n", defaults->rc.i_speed_bufsize );
+    H2( "      --speed-bufinit <float> Initial slack for --speed (fraction) [%.2f]\n", defaults->rc.f_speed_bufinit );
     H2( "      --crf-max <float>       With CRF+VBV, limit RF to this value\n"
         "                                  May cause VBV underflows!\n" );
     H2( "      --qpmin <integer>       Set min QP [%d]\n", defaults->rc.i_qp_min );
@@ -644,7 +651,20 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - 2: Last pass, does not overwrite stats file\n" );
     H2( "                                  - 3: Nth pass, overwrites stats file\n" );
     H1( "      --stats <string>        Filename for 2 pass stats [\"%s\"]\n", defaults->rc.psz_stat_out );
+    H2( "      --stats-binary          Write the stats file in a binary format, faster\n"
+        "                              to write and parse than text\n" );
+    H2( "      --pass2-window <integer> Plan bits this many frames at a time in later\n"
+        "                              passes, in bounded memory, instead of planning\n"
+        "                              the whole video before the first frame\n" );
+    H2( "      --chunks <integer>      Split later passes into this many chunks at\n"
+        "                              keyframes of the stats, to encode in parallel\n"
+        "      --chunk <integer>       Encode only this chunk (0 to chunks-1).  The raw\n"
+        "                              outputs of all chunks, in order, form one stream\n" );
     H2( "      --no-mbtree             Disable mb-tree ratecontrol.\n");
+    H2( "      --mbtree-compact        Store mb-tree offsets in quarter-QPs, halving\n"
+        "                              the size of the .mbtree file\n" );
+    H2( "      --analysis-reuse        Save per-MB motion in the 1st pass and use it\n"
+        "                              as motion search predictors in later passes\n" );
     H2( "      --qcomp <float>         QP curve compression [%.2f]\n", defaults->rc.f_qcompress );
     H2( "      --cplxblur <float>      Reduce fluctuations in QP (before curve compression) [%.1f]\n", defaults->rc.f_complexity_blur );
     H2( "      --qblur <float>         Reduce fluctuations in QP (after curve compression) [%.1f]\n", defaults->rc.f_qblur );
@@ -680,7 +700,9 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - hex: hexagonal search, radius 2\n"
         "                                  - umh: uneven multi-hexagon search\n"
         "                                  - esa: exhaustive search\n"
-        "                                  - tesa: hadamard exhaustive search (slow)\n" );
+        "                                  - tesa: hadamard exhaustive search (slow)\n"
+        "                                  - hash: exact block matches, then umh\n"
+        "                                          (screen content)\n" );
     else H1( "                                  - dia, hex, umh\n" );
     H2( "      --merange <integer>     Maximum motion vector search range [%d]\n", defaults->analyse.i_me_range );
     H2( "      --mvrange <integer>     Maximum motion vector length [-1 (auto)]\n" );
@@ -711,6 +733,8 @@ static void help( x264_param_t *defaults, int longhelp )
         "                                  - 1: enabled only on the final encode of a MB\n"
         "                                  - 2: enabled on all mode decisions\n", defaults->analyse.i_trellis );
     H2( "      --no-fast-pskip         Disables early SKIP detection on P-frames\n" );
+    H2( "      --fast-lowres-me        Halve the P 16x16 search range where lookahead\n"
+        "                              motion agrees with the predicted mv\n" );
     H2( "      --no-dct-decimate       Disables coefficient thresholding on P-frames\n" );
     H1( "      --nr <integer>          Noise reduction [%d]\n", defaults->analyse.i_noise_reduction );
     H2( "\n" );
@@ -796,10 +820,18 @@ static void help( x264_param_t *defaults, int longhelp )
                                        stringify_names( buf, log_level_names ) );
     H1( "      --psnr                  Enable PSNR computation\n" );
     H1( "      --ssim                  Enable SSIM computation\n" );
+    H2( "      --async-metrics         Compute PSNR/SSIM on a background thread\n" );
     H1( "      --threads <integer>     Force a specific number of threads\n" );
     H2( "      --lookahead-threads <integer> Force a specific number of lookahead threads\n" );
+    H2( "      --lookahead-batch       Lookahead threads work on separate frames rather than\n"
+        "                                  slices of one frame; faster with many B-frames\n" );
     H2( "      --sliced-threads        Low-latency but lower-efficiency threading\n" );
+    H2( "      --filter-thread         Deblock and hpel-filter on an extra thread per frame,\n"
+        "                                  pipelined with encoding\n" );
     H2( "      --thread-input          Run Avisynth in its own thread\n" );
+    H2( "      --thread-output         Write the output file from its own thread\n" );
+    H2( "      --input-queue <integer> Frames decoded ahead by the input thread [1]\n"
+        "                                  - Implies --thread-input if greater than 1\n" );
     H2( "      --sync-lookahead <integer> Number of buffer frames for threaded lookahead\n" );
     H2( "      --non-deterministic     Slightly improve quality of SMP, at the cost of repeatability\n" );
     H2( "      --cpu-independent       Ensure exact reproducibility across different cpus,\n"
@@ -808,6 +840,7 @@ static void help( x264_param_t *defaults, int longhelp )
     H2( "      --no-asm                Disable all CPU optimizations\n" );
     H2( "      --visualize             Show MB types overlayed on the encoded video\n" );
     H2( "      --dump-yuv <string>     Save reconstructed frames\n" );
+    H2( "      --stage-timing          Measure and print the time spent in each encoder stage\n" );
     H2( "      --sps-id <integer>      Set SPS and PPS id numbers [%d]\n", defaults->i_sps_id );
     H2( "      --aud                   Use access unit delimiters\n" );
     H2( "      --force-cfr             Force constant framerate timestamp generation\n" );
@@ -836,6 +869,8 @@ typedef enum
     OPT_SEEK,
     OPT_QPFILE,
     OPT_THREAD_INPUT,
+    OPT_THREAD_OUTPUT,
+    OPT_INPUT_QUEUE,
     OPT_QUIET,
     OPT_NOPROGRESS,
     OPT_VISUALIZE,
@@ -907,6 +942,7 @@ static struct option long_options[] =
     { "qpstep",      required_argument, NULL, 0 },
     { "crf",         required_argument, NULL, 0 },
     { "rc-lookahead",required_argument, NULL, 0 },
+    { "lookahead-quarter", no_argument, NULL, 0 },
     { "ref",         required_argument, NULL, 'r' },
     { "asm",         required_argument, NULL, 0 },
     { "no-asm",            no_argument, NULL, 0 },
@@ -942,6 +978,7 @@ static struct option long_options[] =
     { "trellis",     required_argument, NULL, 't' },
     { "fast-pskip",        no_argument, NULL, 0 },
     { "no-fast-pskip",     no_argument, NULL, 0 },
+    { "fast-lowres-me",    no_argument, NULL, 0 },
     { "no-dct-decimate",   no_argument, NULL, 0 },
     { "aq-strength", required_argument, NULL, 0 },
     { "aq-mode",     required_argument, NULL, 0 },
@@ -949,6 +986,9 @@ static struct option long_options[] =
     { "deadzone-intra", required_argument, NULL, 0 },
     { "level",       required_argument, NULL, 0 },
     { "ratetol",     required_argument, NULL, 0 },
+    { "speed",       required_argument, NULL, 0 },
+    { "speed-bufsize", required_argument, NULL, 0 },
+    { "speed-bufinit", required_argument, NULL, 0 },
     { "vbv-maxrate", required_argument, NULL, 0 },
     { "vbv-bufsize", required_argument, NULL, 0 },
     { "vbv-init",    required_argument, NULL, 0 },
@@ -958,32 +998,44 @@ static struct option long_options[] =
     { "chroma-qp-offset", required_argument, NULL, 0 },
     { "pass",        required_argument, NULL, 'p' },
     { "stats",       required_argument, NULL, 0 },
+    { "stats-binary",      no_argument, NULL, 0 },
+    { "pass2-window", required_argument, NULL, 0 },
+    { "chunks",      required_argument, NULL, 0 },
+    { "chunk",       required_argument, NULL, 0 },
     { "qcomp",       required_argument, NULL, 0 },
     { "mbtree",            no_argument, NULL, 0 },
     { "no-mbtree",         no_argument, NULL, 0 },
+    { "mbtree-compact",    no_argument, NULL, 0 },
+    { "analysis-reuse",    no_argument, NULL, 0 },
     { "qblur",       required_argument, NULL, 0 },
     { "cplxblur",    required_argument, NULL, 0 },
     { "zones",       required_argument, NULL, 0 },
     { "qpfile",      required_argument, NULL, OPT_QPFILE },
     { "threads",     required_argument, NULL, 0 },
     { "lookahead-threads", required_argument, NULL, 0 },
+    { "lookahead-batch",   no_argument, NULL, 0 },
     { "sliced-threads",    no_argument, NULL, 0 },
     { "no-sliced-threads", no_argument, NULL, 0 },
+    { "filter-thread",     no_argument, NULL, 0 },
     { "slice-max-size",    required_argument, NULL, 0 },
     { "slice-max-mbs",     required_argument, NULL, 0 },
     { "slices",            required_argument, NULL, 0 },
     { "thread-input",      no_argument, NULL, OPT_THREAD_INPUT },
+    { "thread-output",     no_argument, NULL, OPT_THREAD_OUTPUT },
+    { "input-queue",       required_argument, NULL, OPT_INPUT_QUEUE },
     { "sync-lookahead",    required_argument, NULL, 0 },
     { "non-deterministic", no_argument, NULL, 0 },
     { "cpu-independent",   no_argument, NULL, 0 },
     { "psnr",              no_argument, NULL, 0 },
     { "ssim",              no_argument, NULL, 0 },
+    { "async-metrics",     no_argument, NULL, 0 },
     { "quiet",             no_argument, NULL, OPT_QUIET },
     { "verbose",           no_argument, NULL, 'v' },
     { "log-level",   required_argument, NULL, OPT_LOG_LEVEL },
     { "no-progress",       no_argument, NULL, OPT_NOPROGRESS },
     { "visualize",         no_argument, NULL, OPT_VISUALIZE },
     { "dump-yuv",    required_argument, NULL, 0 },
+    { "stage-timing", no_argument,      NULL, 0 },
     { "sps-id",      required_argument, NULL, 0 },
     { "aud",               no_argument, NULL, 0 },
     { "nr",          required_argument, NULL, 0 },
@@ -1237,6 +1289,7 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
     char *profile = NULL;
     char *vid_filters = NULL;
     int b_thread_input = 0;
+    int b_thread_output = 0;
     int b_turbo = 1;
     int b_user_ref = 0;
     int b_user_fps = 0;
@@ -1334,6 +1387,14 @@ static int parse( int argc, char **argv, x264_param_t *param, cli_opt_t *opt )
             case OPT_THREAD_INPUT:
                 b_thread_input = 1;
                 break;
+            case OPT_THREAD_OUTPUT:
+                b_thread_output = 1;
+                break;
+            case OPT_INPUT_QUEUE:
+                input_opt.input_queue = atoi( optarg );
+                FAIL_IF_ERROR( input_opt.input_queue < 1, "invalid input queue size `%s'\n", optarg )
+                b_thread_input |= input_opt.input_queue > 1;
+                break;
             case OPT_QUIET:
                 cli_log_level = param->i_log_level = X264_LOG_NONE;
                 break;
@@ -1471,6 +1532,13 @@ generic_option:
     if( select_output( muxer, output_filename, param ) )
         return -1;
     FAIL_IF_ERROR( cli_output.open_file( output_filename, &opt->hout, &output_opt ), "could not open output file `%s'\n", output_filename )
+#if HAVE_THREAD
+    if( b_thread_output )
+    {
+        FAIL_IF_ERROR( thread_output.open_file( NULL, &opt->hout, &output_opt ), "threaded output failed\n" )
+        cli_output = thread_output;
+    }
+#endif
 
     input_filename = argv[optind++];
     video_info_t info = {0};
@@ -1516,7 +1584,7 @@ generic_option:
     if( info.thread_safe && (b_thread_input || param->i_threads > 1
         || (param->i_threads == X264_THREADS_AUTO && x264_cpu_num_processors() > 1)) )
     {
-        if( thread_input.open_file( NULL, &opt->hin, &info, NULL ) )
+        if( thread_input.open_file( NULL, &opt->hin, &info, &input_opt ) )
         {
             fprintf( stderr, "x264 [error]: threaded input failed\n" );
             return -1;
@@ -1753,6 +1821,7 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
     int     pts_warning_cnt = 0;
     int64_t largest_pts = -1;
     int64_t second_largest_pts = -1;
+    int64_t first_pts = 0;
     int64_t ticks_per_frame;
     double  duration;
     double  pulldown_pts = 0;
@@ -1777,6 +1846,12 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
 
     x264_encoder_parameters( h, param );
 
+    /* a chunk picks up the input, timestamps and pulldown where the previous one left off */
+    opt->i_seek += param->rc.i_chunk_start;
+    if( opt->i_pulldown && !param->b_vfr_input )
+        for( int i = 0; i < param->rc.i_chunk_start; i++ )
+            pulldown_pts += pulldown_frame_duration[pulldown->pattern[ i % pulldown->mod ]];
+
     FAIL_IF_ERROR2( cli_output.set_param( opt->hout, param ), "can't set outfile param\n" );
 
     i_start = x264_mdate();
@@ -1808,11 +1883,11 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
         convert_cli_to_lib_pic( &pic, &cli_pic );
 
         if( !param->b_vfr_input )
-            pic.i_pts = i_frame;
+            pic.i_pts = i_frame + param->rc.i_chunk_start;
 
         if( opt->i_pulldown && !param->b_vfr_input )
         {
-            pic.i_pic_struct = pulldown->pattern[ i_frame % pulldown->mod ];
+            pic.i_pic_struct = pulldown->pattern[ (i_frame + param->rc.i_chunk_start) % pulldown->mod ];
             pic.i_pts = (int64_t)( pulldown_pts + 0.5 );
             pulldown_pts += pulldown_frame_duration[pic.i_pic_struct];
         }
@@ -1830,6 +1905,9 @@ static int encode( x264_param_t *param, cli_opt_t *opt )
             pic.i_pts = largest_pts + ticks_per_frame;
         }
 
+        /* chunks after the first don't start at 0 */
+        if( !i_frame && param->rc.i_chunks )
+            first_pts = pic.i_pts;
         second_largest_pts = largest_pts;
         largest_pts = pic.i_pts;
         if( opt->tcfile_out )
@@ -1890,7 +1968,7 @@ fail:
     else if( b_ctrl_c )
         duration = (double)(2 * last_dts - prev_dts - first_dts) * param->i_timebase_num / param->i_timebase_den;
     else
-        duration = (double)(2 * largest_pts - second_largest_pts) * param->i_timebase_num / param->i_timebase_den;
+        duration = (double)(2 * largest_pts - second_largest_pts - first_pts) * param->i_timebase_num / param->i_timebase_den;
 
     i_end = x264_mdate();
     /* Erase progress indicator before printing encoding stats. */
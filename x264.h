@@ -41,7 +41,7 @@
 
 #include "x264_config.h"
 
-#define X264_BUILD 128
+#define X264_BUILD 143
 
 /* Application developers planning to link against a shared library version of
  * libx264 from a Microsoft Visual Studio or similar development environment
@@ -160,6 +160,7 @@ typedef struct
 #define X264_ME_UMH                  2
 #define X264_ME_ESA                  3
 #define X264_ME_TESA                 4
+#define X264_ME_HASH                 5
 #define X264_CQM_FLAT                0
 #define X264_CQM_JVT                 1
 #define X264_CQM_CUSTOM              2
@@ -183,7 +184,7 @@ typedef struct
 #define X264_KEYINT_MAX_INFINITE     (1<<30)
 
 static const char * const x264_direct_pred_names[] = { "none", "spatial", "temporal", "auto", 0 };
-static const char * const x264_motion_est_names[] = { "dia", "hex", "umh", "esa", "tesa", 0 };
+static const char * const x264_motion_est_names[] = { "dia", "hex", "umh", "esa", "tesa", "hash", 0 };
 static const char * const x264_b_pyramid_names[] = { "none", "strict", "normal", 0 };
 static const char * const x264_overscan_names[] = { "undef", "show", "crop", 0 };
 static const char * const x264_vidformat_names[] = { "component", "pal", "ntsc", "secam", "mac", "undef", 0 };
@@ -233,6 +234,9 @@ static const char * const x264_nal_hrd_names[] = { "none", "vbr", "cbr", 0 };
 #define X264_THREADS_AUTO 0 /* Automatically select optimal number of threads */
 #define X264_SYNC_LOOKAHEAD_AUTO (-1) /* Automatically select optimal lookahead thread buffer size */
 
+/* Worker threads shared by several encoders, see x264_scheduler_open() */
+typedef struct x264_scheduler_t x264_scheduler_t;
+
 /* HRD */
 #define X264_NAL_HRD_NONE            0
 #define X264_NAL_HRD_VBR             1
@@ -256,10 +260,15 @@ typedef struct x264_param_t
     unsigned int cpu;
     int         i_threads;           /* encode multiple frames in parallel */
     int         i_lookahead_threads; /* multiple threads for lookahead analysis */
+    int         b_lookahead_batch; /* lookahead threads estimate whole frames concurrently rather than
+                                    * splitting each frame into slices; needs i_lookahead_threads > 1 */
     int         b_sliced_threads;  /* Whether to use slice-based threading. */
+    int         b_filter_thread; /* deblock and hpel-filter each frame on a separate thread, one row behind encoding */
     int         b_deterministic; /* whether to allow non-deterministic optimizations when threaded */
     int         b_cpu_independent; /* force canonical behavior rather than cpu-dependent optimal algorithms */
     int         i_sync_lookahead; /* threaded lookahead buffer */
+    x264_scheduler_t *scheduler;  /* if set, run frame, slice and lookahead threads as jobs on these
+                                   * shared workers instead of creating the encoder's own threads */
 
     /* Video Properties */
     int         i_width;
@@ -337,6 +346,7 @@ typedef struct x264_param_t
     int         b_visualize;
     int         b_full_recon;   /* fully reconstruct frames, even when not necessary for encoding.  Implied by psz_dump_yuv */
     char        *psz_dump_yuv;  /* filename for reconstructed frames */
+    int         b_stage_timing; /* measure the time spent in each encoder stage, see X264_STAGE_* */
 
     /* Encoder analyser parameters */
     struct
@@ -359,6 +369,7 @@ typedef struct x264_param_t
         int          b_mixed_references; /* allow each mb partition to have its own reference number */
         int          i_trellis;  /* trellis RD quantization */
         int          b_fast_pskip; /* early SKIP detection on P-frames */
+        int          b_fast_lowres_me; /* narrow the P 16x16 search where lookahead motion agrees with the predictor */
         int          b_dct_decimate; /* transform coefficient thresholding on P-frames */
         int          i_noise_reduction; /* adaptive pseudo-deadzone */
         float        f_psy_rd; /* Psy RD strength */
@@ -373,6 +384,7 @@ typedef struct x264_param_t
 
         int          b_psnr;    /* compute and print PSNR stats */
         int          b_ssim;    /* compute and print SSIM stats */
+        int          b_async_metrics; /* compute PSNR/SSIM on a background thread; results arrive one frame late */
     } analyse;
 
     /* Rate control parameters */
@@ -399,12 +411,30 @@ typedef struct x264_param_t
         float       f_aq_strength;
         int         b_mb_tree;      /* Macroblock-tree ratecontrol. */
         int         i_lookahead;
+        int         b_lookahead_quarter; /* B-adapt and scenecut on 1/4 resolution frames; mb-tree stays at 1/2 */
+
+        /* Speed control: lower analysis settings per frame to sustain a target speed */
+        float       f_speed;        /* target speed as a multiple of i_fps_num/i_fps_den, 0 = disabled */
+        int         i_speed_bufsize; /* slack allowed before falling behind, in frames */
+        float       f_speed_bufinit; /* initial slack, as a fraction of i_speed_bufsize */
 
         /* 2pass */
         int         b_stat_write;   /* Enable stat writing in psz_stat_out */
         char        *psz_stat_out;
         int         b_stat_read;    /* Read stat from psz_stat_in and use it */
         char        *psz_stat_in;
+        int         b_stat_binary;  /* Write stats in the binary format (read back either way) */
+        int         b_mb_tree_compact; /* Write mbtree offsets as int8 quarter-QPs rather than FIX8.8 */
+        int         i_pass2_window; /* Read stats and plan bits this many frames at a time, rather than
+                                     * for the whole video at once. 0 = disabled */
+        int         i_chunks;       /* Split later passes at keyframes of the stats into this many closed-GOP chunks,
+                                     * and encode only chunk i_chunk, so that chunks can be encoded in parallel
+                                     * and concatenated. 0 = disabled */
+        int         i_chunk;
+        int         i_chunk_start;  /* Set by x264_encoder_open: the chunk's first input frame.  i_frame_total
+                                     * is set to its length. */
+        int         b_analysis_reuse; /* Write (1st pass) or read (later passes) per-MB motion in psz_stat_*.analysis,
+                                       * used as motion search predictors by later passes */
 
         /* 2pass params (same as ffmpeg ones) */
         float       f_qcompress;    /* 0.0 => cbr, 1.0 => constant qp */
@@ -747,9 +777,19 @@ typedef struct
     double f_psnr_avg;
     /* Out: PSNR of Y, U, and V (if x264_param_t.b_psnr is set) */
     double f_psnr[3];
+    /* Out: whether f_ssim and f_psnr* are set, and the pts of the frame they measure.
+     *      This is the frame itself, unless x264_param_t.b_async_metrics is set: then the
+     *      metrics are those of the previous output frame, none come with the first frame,
+     *      and those of the last frame only appear in the summary printed on close. */
+    int     b_metrics;
+    int64_t i_metrics_pts;
 
     /* Out: Average effective CRF of the encoded frame */
     double f_crf_avg;
+
+    /* Out: time spent on this frame in each X264_STAGE_*, in nanoseconds (if x264_param_t.b_stage_timing is set).
+     *      Summed over slice threads, so it can exceed the wall time of the frame. */
+    int64_t i_stage_time[7];
 } x264_image_properties_t;
 
 typedef struct
@@ -796,6 +836,13 @@ typedef struct
     x264_sei_t extra_sei;
     /* private user data. copied from input to output frames. */
     void *opaque;
+    /* In: optional callback for zero-copy input.  If set, img must already be in the layout
+     *     returned by x264_encoder_input_layout, and x264 encodes directly from img.plane[]
+     *     instead of copying the picture.  The planes must remain valid until x264 calls
+     *     img_free( opaque ), which may happen from another thread.  x264 may write to the
+     *     padding around each plane, and to the area between the picture width/height and
+     *     the next multiple of 16.  If x264_encoder_encode fails, the planes are not used. */
+    void (*img_free)( void* );
 } x264_picture_t;
 
 /* x264_picture_init:
@@ -867,6 +914,54 @@ int     x264_encoder_delayed_frames( x264_t * );
  *      return the maximum number of delayed (buffered) frames that can occur with the current
  *      parameters. */
 int     x264_encoder_maximum_delayed_frames( x264_t *h );
+/* x264_encoder_lookahead_share:
+ *      makes follower use the frame types (including scenecuts) decided by leader's lookahead
+ *      instead of running its own frametype decision, e.g. for encoding several renditions of
+ *      the same input.  The follower still runs its own MB-tree and VBV lookahead analysis,
+ *      using the leader's frame types.  Both encoders must receive the same input frames in
+ *      the same order, and the leader must be given each frame (and flushed) before the
+ *      follower, since the follower waits for the leader's decisions.
+ *      The GOP structure parameters (bframes, b-pyramid, keyint, open-gop, intra-refresh,
+ *      interlacing) must match, and the follower's delay must be at least the leader's.
+ *      Must be called before the first frame is passed to either encoder.  A leader may
+ *      have several followers.  returns 0 on success, negative on error. */
+int     x264_encoder_lookahead_share( x264_t *leader, x264_t *follower );
+/* Encoder stages measured with b_stage_timing */
+#define X264_STAGE_LOOKAHEAD   0 /* frametype decision, MB-tree and VBV lookahead (x264_slicetype_decide) */
+#define X264_STAGE_ANALYSE     1 /* MB mode decision and motion search, including RD */
+#define X264_STAGE_ENCODE      2 /* transform, quantization and reconstruction of the chosen mode */
+#define X264_STAGE_ENTROPY     3 /* CABAC/CAVLC coding */
+#define X264_STAGE_FILTER      4 /* deblocking, hpel interpolation and PSNR/SSIM of finished rows */
+#define X264_STAGE_RATECONTROL 5 /* frame and row ratecontrol */
+#define X264_STAGE_WAIT        6 /* waiting for rows of reference frames being encoded by other threads */
+#define X264_STAGE_MAX         7
+/* x264_encoder_stage_times:
+ *      if b_stage_timing is set, fills times[] with the nanoseconds spent so far in each
+ *      X264_STAGE_* by encoding thread i_thread, or by the whole encoder if i_thread is negative
+ *      (only the whole encoder includes X264_STAGE_LOOKAHEAD).  returns the number of encoding
+ *      threads, or negative if b_stage_timing is not set. */
+int     x264_encoder_stage_times( x264_t *, int i_thread, int64_t times[X264_STAGE_MAX] );
+/* x264_encoder_input_layout:
+ *      fills *img with the colorspace, number of planes and strides (in bytes) required for
+ *      zero-copy input (see x264_picture_t.img_free).  Each plane must be aligned to 32 bytes,
+ *      have a height rounded up to a multiple of 16 (32 if interlaced) lines, and be surrounded
+ *      by *pad_h addressable pixels on the left and right and *pad_v addressable lines above
+ *      and below (halved vertically for the chroma plane of 4:2:0). */
+void    x264_encoder_input_layout( x264_t *, x264_image_t *img, int *pad_h, int *pad_v );
+/* x264_scheduler_open:
+ *      creates i_threads worker threads for many encoders to share, e.g. when running more
+ *      streams at once than there are cores.  Encoders opened with x264_param_t.scheduler
+ *      set to it queue the work of their frame threads (i_threads), sliced threads and
+ *      lookahead threads (i_lookahead_threads) on these workers instead of creating threads
+ *      of their own; i_threads then only sets how many frames an encoder keeps in flight.
+ *      Idle workers take jobs from the attached encoders in turn, so every stream gets a
+ *      fair share.  Such encoders use no threaded lookahead buffer (i_sync_lookahead).
+ *      returns NULL on error or when x264 was built without thread support. */
+x264_scheduler_t *x264_scheduler_open( int i_threads );
+/* x264_scheduler_close:
+ *      releases the scheduler.  Encoders still attached to it keep it alive: its threads
+ *      exit once the last of them has been closed too. */
+void    x264_scheduler_close( x264_scheduler_t * );
 /* x264_encoder_intra_refresh:
  *      If an intra refresh is not in progress, begin one with the next P-frame.
  *      If an intra refresh is in progress, begin one as soon as the current one finishes.
@@ -0,0 +1,8 @@
+#define X264_BIT_DEPTH     8
+#define X264_GPL           1
+#define X264_INTERLACED    1
+#define X264_CHROMA_FORMAT 0
+#define X264_REV 0
+#define X264_REV_DIFF 13
+#define X264_VERSION " r0+13M cd50ef3"
+#define X264_POINTVER "0.135.0+13M cd50ef3"